@@ -0,0 +1,209 @@
+#include "libBitmap.h"
+
+/* ~ HELPER FUNCTIONS ~ */
+
+/* _mark_dirty(): remember that word 'w' no longer matches the disk */
+static void _mark_dirty(freeMap* map, int w) {
+    map->dirty[w / FREEMAP_WORD_BITS] |= (uint64_t) 1 << (w % FREEMAP_WORD_BITS);
+}
+
+/* _next_bit(): find the first block at or after 'from' whose bit is 'value'
+    + works a word at a time, inverting the word to look for clear bits
+    > returns numBlocks if there is no such block */
+static int _next_bit(freeMap* map, int from, bool value) {
+    if (from >= map->numBlocks) {
+        return map->numBlocks;
+    }
+    int w = from / FREEMAP_WORD_BITS;
+    uint64_t word = value ? map->words[w] : ~map->words[w];
+    word &= ~(uint64_t) 0 << (from % FREEMAP_WORD_BITS);
+    while (word == 0) {
+        if (++w == map->numWords) {
+            return map->numBlocks;
+        }
+        word = value ? map->words[w] : ~map->words[w];
+    }
+    int block = w * FREEMAP_WORD_BITS + __builtin_ctzll(word);
+    return block < map->numBlocks ? block : map->numBlocks;
+}
+
+/* ^ HELPER FUNCTIONS ^ */
+
+freeMap* freeMapCreate(int numBlocks) {
+    if (numBlocks <= 0) {
+        return NULL;
+    }
+
+    freeMap* map = (freeMap*) malloc(sizeof(freeMap));
+    if (map == NULL) {
+        return NULL;
+    }
+    map->numBlocks = numBlocks;
+    map->numWords = (numBlocks + FREEMAP_WORD_BITS - 1) / FREEMAP_WORD_BITS;
+    map->words = (uint64_t*) calloc(map->numWords, sizeof(uint64_t));
+    map->dirty = (uint64_t*) calloc((map->numWords + FREEMAP_WORD_BITS - 1) / FREEMAP_WORD_BITS, sizeof(uint64_t));
+    if (map->words == NULL || map->dirty == NULL) {
+        free(map->words);
+        free(map->dirty);
+        free(map);
+        return NULL;
+    }
+    map->freeCount = 0;
+    map->hint = 0;
+    return map;
+}
+
+void freeMapDestroy(freeMap* map) {
+    if (map == NULL) {
+        return;
+    }
+    free(map->words);
+    free(map->dirty);
+    free(map);
+}
+
+bool freeMapIsFree(freeMap* map, int block) {
+    if (block < 0 || block >= map->numBlocks) {
+        return false;
+    }
+    return (map->words[block / FREEMAP_WORD_BITS] >> (block % FREEMAP_WORD_BITS)) & 1;
+}
+
+int freeMapSetFree(freeMap* map, int block, bool isFree) {
+    if (block < 0 || block >= map->numBlocks) {
+        return ERR_INVALID_INPUT;
+    }
+    if (freeMapIsFree(map, block) == isFree) {
+        return TFS_SUCCESS;
+    }
+
+    int w = block / FREEMAP_WORD_BITS;
+    map->words[w] ^= (uint64_t) 1 << (block % FREEMAP_WORD_BITS);
+    _mark_dirty(map, w);
+    if (isFree) {
+        map->freeCount++;
+        if (w < map->hint) {
+            map->hint = w;
+        }
+    } else {
+        map->freeCount--;
+    }
+    return TFS_SUCCESS;
+}
+
+int freeMapAlloc(freeMap* map) {
+    /* skip the words known to be full, then take the lowest set bit */
+    while (map->hint < map->numWords && map->words[map->hint] == 0) {
+        map->hint++;
+    }
+    if (map->hint == map->numWords) {
+        return ERR_DISK_OUT_OF_SPACE;
+    }
+    int block = map->hint * FREEMAP_WORD_BITS + __builtin_ctzll(map->words[map->hint]);
+    freeMapSetFree(map, block, false);
+    return block;
+}
+
+int freeMapFindRun(freeMap* map, int length, int* start) {
+    int best = 0;
+    int best_start = 0;
+    int from = map->hint * FREEMAP_WORD_BITS;
+    while (from < map->numBlocks) {
+        int run_start = _next_bit(map, from, true);
+        if (run_start == map->numBlocks) {
+            break;
+        }
+        int run_end = _next_bit(map, run_start, false);
+        if (run_end - run_start >= length) {
+            best = length;
+            best_start = run_start;
+            break;
+        }
+        if (run_end - run_start > best) {
+            best = run_end - run_start;
+            best_start = run_start;
+        }
+        from = run_end;
+    }
+
+    if (start != NULL) {
+        *start = best_start;
+    }
+    return best;
+}
+
+int freeMapRuns(freeMap* map, int* largest) {
+    int runs = 0;
+    int longest = 0;
+    int from = 0;
+    while ((from = _next_bit(map, from, true)) < map->numBlocks) {
+        int run_end = _next_bit(map, from, false);
+        if (run_end - from > longest) {
+            longest = run_end - from;
+        }
+        runs++;
+        from = run_end;
+    }
+
+    if (largest != NULL) {
+        *largest = longest;
+    }
+    return runs;
+}
+
+int freeMapCount(freeMap* map) {
+    return map->freeCount;
+}
+
+void freeMapExport(freeMap* map, int firstBlock, uint8_t* bytes, int numBytes) {
+    int first_byte = firstBlock / 8;
+    for (int i = 0; i < numBytes; i++) {
+        int b = first_byte + i;
+        int w = b / 8;
+        bytes[i] = w < map->numWords ? (uint8_t) (map->words[w] >> ((b % 8) * 8)) : 0;
+    }
+}
+
+int freeMapImport(freeMap* map, int firstBlock, const uint8_t* bytes, int numBytes) {
+    int first_byte = firstBlock / 8;
+    for (int i = 0; i < numBytes; i++) {
+        int b = first_byte + i;
+        int w = b / 8;
+        int shift = (b % 8) * 8;
+
+        /* a set bit past the last block can only come from a corrupted disk */
+        int past_end = (b + 1) * 8 - map->numBlocks;
+        uint8_t valid = past_end <= 0 ? 0xFF : (past_end >= 8 ? 0 : (uint8_t) (0xFF >> past_end));
+        if (bytes[i] & ~valid) {
+            return ERR_INVALID_INPUT;
+        }
+        if (w < map->numWords) {
+            /* keep the count current byte by byte, recounting the whole map
+                per call would make loading a large bitmap quadratic */
+            map->freeCount -= __builtin_popcount((map->words[w] >> shift) & 0xFF);
+            map->freeCount += __builtin_popcount(bytes[i]);
+            map->words[w] &= ~((uint64_t) 0xFF << shift);
+            map->words[w] |= (uint64_t) bytes[i] << shift;
+        }
+    }
+
+    map->hint = 0;
+    return TFS_SUCCESS;
+}
+
+bool freeMapDirty(freeMap* map, int firstBlock, int count) {
+    int last = firstBlock + count - 1;
+    if (last >= map->numBlocks) {
+        last = map->numBlocks - 1;
+    }
+    for (int w = firstBlock / FREEMAP_WORD_BITS; w <= last / FREEMAP_WORD_BITS; w++) {
+        if ((map->dirty[w / FREEMAP_WORD_BITS] >> (w % FREEMAP_WORD_BITS)) & 1) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void freeMapClean(freeMap* map) {
+    memset(map->dirty, 0, ((map->numWords + FREEMAP_WORD_BITS - 1) / FREEMAP_WORD_BITS) * sizeof(uint64_t));
+}
@@ -0,0 +1,70 @@
+#ifndef LIBBITMAP_H
+#define LIBBITMAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tinyFS_errno.h"
+
+/* how many blocks one word of a free map covers */
+#define FREEMAP_WORD_BITS 64
+
+/* in-memory free-space bitmap of a disk: bit b of word w is set when block
+w * FREEMAP_WORD_BITS + b is free, so free blocks are found a word at a
+time with count-trailing-zeros, and bits past the last block stay clear */
+typedef struct freeMap {
+    // How many blocks the map covers
+    int numBlocks;
+    int numWords;
+    uint64_t* words;
+    // Words changed since the last freeMapClean(), one bit per word
+    uint64_t* dirty;
+    // Number of set bits, kept up to date on every change
+    int freeCount;
+    // No word before this one has a free block, allocation scans start here
+    int hint;
+} freeMap;
+
+/* Creates a map of 'numBlocks' blocks, all of them in use. Returns NULL if
+numBlocks is not positive or memory runs out. */
+freeMap* freeMapCreate(int numBlocks);
+void freeMapDestroy(freeMap* map);
+
+/* Whether 'block' is free. Blocks outside the map are never free. */
+bool freeMapIsFree(freeMap* map, int block);
+
+/* Marks 'block' free or in use and records its word as dirty. Returns
+ERR_INVALID_INPUT if the block is outside the map. */
+int freeMapSetFree(freeMap* map, int block, bool isFree);
+
+/* Takes the lowest numbered free block, marking it in use. Returns the
+block, or ERR_DISK_OUT_OF_SPACE if none is free. */
+int freeMapAlloc(freeMap* map);
+
+/* Looks for a run of 'length' consecutive free blocks. Returns 'length'
+and the start of the first such run in 'start', or if there is none, the
+length and start of the longest free run (0 if no block is free). Nothing
+is marked in use. */
+int freeMapFindRun(freeMap* map, int length, int* start);
+
+/* Counts the runs of consecutive free blocks, and stores the length of the
+longest one in 'largest' (if given). */
+int freeMapRuns(freeMap* map, int* largest);
+
+/* Number of free blocks, without scanning. */
+int freeMapCount(freeMap* map);
+
+/* Copies the bits of blocks [firstBlock, firstBlock + 8 * numBytes) to or
+from a byte array, eight blocks per byte, lowest block in the lowest bit.
+firstBlock must be a multiple of 8. Import updates the free count and
+refuses (ERR_INVALID_INPUT) bits for blocks past the end of the map. */
+void freeMapExport(freeMap* map, int firstBlock, uint8_t* bytes, int numBytes);
+int freeMapImport(freeMap* map, int firstBlock, const uint8_t* bytes, int numBytes);
+
+/* Whether any word covering blocks [firstBlock, firstBlock + count) changed
+since the last freeMapClean(), which forgets every change. */
+bool freeMapDirty(freeMap* map, int firstBlock, int count);
+void freeMapClean(freeMap* map);
+
+#endif
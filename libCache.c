@@ -0,0 +1,353 @@
+#include "libCache.h"
+
+/* ~ HELPER FUNCTIONS ~ */
+
+/* _hash_block(): bucket index of the given block number */
+static int _hash_block(blockCache* cache, int bNum) {
+    return (int) (((unsigned int) bNum * 2654435761u) & (unsigned int) cache->hashMask);
+}
+
+/* _lookup(): find the entry holding bNum
+    > returns the entry index, or -1 if the block is not cached */
+static int _lookup(blockCache* cache, int bNum) {
+    int e = cache->buckets[_hash_block(cache, bNum)];
+    while (e != -1 && cache->entries[e].bNum != bNum) {
+        e = cache->entries[e].hashNext;
+    }
+    return e;
+}
+
+/* _hash_insert()/_hash_remove(): add or drop entry 'e' from its hash bucket */
+static void _hash_insert(blockCache* cache, int e) {
+    int bucket = _hash_block(cache, cache->entries[e].bNum);
+    cache->entries[e].hashNext = cache->buckets[bucket];
+    cache->buckets[bucket] = e;
+}
+
+static void _hash_remove(blockCache* cache, int e) {
+    int* link = &cache->buckets[_hash_block(cache, cache->entries[e].bNum)];
+    while (*link != e) {
+        link = &cache->entries[*link].hashNext;
+    }
+    *link = cache->entries[e].hashNext;
+}
+
+/* _lru_unlink()/_lru_push_front(): move entries around the LRU list,
+    the head is the most recently used entry and the tail the least */
+static void _lru_unlink(blockCache* cache, int e) {
+    cacheEntry* entry = &cache->entries[e];
+    if (entry->prev != -1) {
+        cache->entries[entry->prev].next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+    if (entry->next != -1) {
+        cache->entries[entry->next].prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+    entry->prev = entry->next = -1;
+}
+
+static void _lru_push_front(blockCache* cache, int e) {
+    cacheEntry* entry = &cache->entries[e];
+    entry->prev = -1;
+    entry->next = cache->head;
+    if (cache->head != -1) {
+        cache->entries[cache->head].prev = e;
+    }
+    cache->head = e;
+    if (cache->tail == -1) {
+        cache->tail = e;
+    }
+}
+
+/* _write_back(): write a dirty entry to the disk and mark it clean */
+static int _write_back(blockCache* cache, int e) {
+    cacheEntry* entry = &cache->entries[e];
+    int status = writeBlock(cache->disk, entry->bNum, entry->data);
+    if (status < 0) {
+        return status;
+    }
+    entry->dirty = false;
+    cache->stats.writebacks++;
+    return TFS_SUCCESS;
+}
+
+/* _grab_entry(): get an entry to hold block bNum
+    + uses an empty entry if there is one, otherwise evicts the least recently
+      used block, writing it back first if it is dirty
+    > returns the entry index (already hashed and at the front of the LRU list)
+    - errors if a dirty victim cannot be written back */
+static int _grab_entry(blockCache* cache, int bNum) {
+    int e;
+    if (cache->used < cache->capacity) {
+        e = cache->used++;
+    } else {
+        e = cache->tail;
+        if (cache->entries[e].dirty) {
+            int status = _write_back(cache, e);
+            if (status < 0) {
+                return status;
+            }
+        }
+        _hash_remove(cache, e);
+        _lru_unlink(cache, e);
+        cache->stats.evictions++;
+    }
+
+    cache->entries[e].bNum = bNum;
+    cache->entries[e].dirty = false;
+    _hash_insert(cache, e);
+    _lru_push_front(cache, e);
+    return e;
+}
+
+/* ^ HELPER FUNCTIONS ^ */
+
+blockCache* cacheCreate(int disk, int capacity) {
+    if (capacity <= 0) {
+        return NULL;
+    }
+
+    blockCache* cache = (blockCache*) malloc(sizeof(blockCache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    memset(cache, 0, sizeof(blockCache));
+    cache->disk = disk;
+    cache->capacity = capacity;
+    cache->head = cache->tail = -1;
+
+    /* twice as many buckets as entries, rounded up to a power of two */
+    int num_buckets = 1;
+    while (num_buckets < capacity * 2) {
+        num_buckets <<= 1;
+    }
+    cache->hashMask = num_buckets - 1;
+
+    cache->buckets = (int*) malloc(num_buckets * sizeof(int));
+    cache->entries = (cacheEntry*) malloc(capacity * sizeof(cacheEntry));
+    if (cache->buckets == NULL || cache->entries == NULL) {
+        free(cache->buckets);
+        free(cache->entries);
+        free(cache);
+        return NULL;
+    }
+    memset(cache->buckets, 0xFF, num_buckets * sizeof(int));
+    for (int i = 0; i < capacity; i++) {
+        cache->entries[i].bNum = -1;
+        cache->entries[i].prev = cache->entries[i].next = cache->entries[i].hashNext = -1;
+    }
+
+    return cache;
+}
+
+int cacheDestroy(blockCache* cache) {
+    if (cache == NULL) {
+        return ERR_INVALID_INPUT;
+    }
+
+    int status = cacheSync(cache);
+    free(cache->buckets);
+    free(cache->entries);
+    free(cache);
+    return status;
+}
+
+int cacheReadBlock(blockCache* cache, int bNum, void* block) {
+    if (cache == NULL || block == NULL) {
+        return ERR_INVALID_INPUT;
+    }
+
+    int e = _lookup(cache, bNum);
+    if (e != -1) {
+        cache->stats.hits++;
+        _lru_unlink(cache, e);
+        _lru_push_front(cache, e);
+        memcpy(block, cache->entries[e].data, BLOCKSIZE);
+        return TFS_SUCCESS;
+    }
+
+    /* read into the caller's buffer first, so a failed read caches nothing */
+    cache->stats.misses++;
+    int status = readBlock(cache->disk, bNum, block);
+    if (status < 0) {
+        return status;
+    }
+    if ((e = _grab_entry(cache, bNum)) < 0) {
+        return e;
+    }
+    memcpy(cache->entries[e].data, block, BLOCKSIZE);
+
+    return TFS_SUCCESS;
+}
+
+int cacheWriteBlock(blockCache* cache, int bNum, void* block) {
+    if (cache == NULL || block == NULL) {
+        return ERR_INVALID_INPUT;
+    }
+
+    /* refuse blocks outside the disk now, rather than when writing back */
+    int num_blocks = getDiskSize(cache->disk);
+    if (num_blocks < 0) {
+        return num_blocks;
+    }
+    if (bNum < 0 || bNum >= num_blocks) {
+        return ERR_INVALID_INPUT;
+    }
+
+    int e = _lookup(cache, bNum);
+    if (e != -1) {
+        cache->stats.hits++;
+        _lru_unlink(cache, e);
+        _lru_push_front(cache, e);
+    } else {
+        /* whole-block writes never need the old contents from the disk */
+        cache->stats.misses++;
+        if ((e = _grab_entry(cache, bNum)) < 0) {
+            return e;
+        }
+    }
+    memcpy(cache->entries[e].data, block, BLOCKSIZE);
+    cache->entries[e].dirty = true;
+
+    return TFS_SUCCESS;
+}
+
+int cacheReadBlocks(blockCache* cache, blockIO* ios, int count) {
+    if (cache == NULL || ios == NULL || count < 0) {
+        return ERR_INVALID_INPUT;
+    }
+
+    /* serve what is cached, collect the misses for one batched disk read */
+    blockIO* misses = (blockIO*) malloc((count + 1) * sizeof(blockIO));
+    int* owners = (int*) malloc((count + 1) * sizeof(int));
+    if (misses == NULL || owners == NULL) {
+        free(misses);
+        free(owners);
+        return SYS_ERR_MALLOC;
+    }
+    int num_misses = 0;
+    for (int i = 0; i < count; i++) {
+        int e;
+        if (ios[i].block == NULL) {
+            ios[i].status = ERR_INVALID_INPUT;
+        } else if ((e = _lookup(cache, ios[i].bNum)) != -1) {
+            cache->stats.hits++;
+            _lru_unlink(cache, e);
+            _lru_push_front(cache, e);
+            memcpy(ios[i].block, cache->entries[e].data, BLOCKSIZE);
+            ios[i].status = TFS_SUCCESS;
+        } else {
+            cache->stats.misses++;
+            misses[num_misses] = ios[i];
+            owners[num_misses++] = i;
+        }
+    }
+
+    /* read the misses straight into the caller's buffers, then cache them */
+    readBlocks(cache->disk, misses, num_misses);
+    for (int m = 0; m < num_misses; m++) {
+        blockIO* io = &ios[owners[m]];
+        io->status = misses[m].status;
+        if (io->status == TFS_SUCCESS && _lookup(cache, io->bNum) == -1) {
+            int e = _grab_entry(cache, io->bNum);
+            if (e < 0) {
+                io->status = e;
+            } else {
+                memcpy(cache->entries[e].data, io->block, BLOCKSIZE);
+            }
+        }
+    }
+    free(misses);
+    free(owners);
+
+    for (int i = 0; i < count; i++) {
+        if (ios[i].status < 0) {
+            return ios[i].status;
+        }
+    }
+    return TFS_SUCCESS;
+}
+
+int cacheWriteBlocks(blockCache* cache, blockIO* ios, int count) {
+    if (cache == NULL || ios == NULL || count < 0) {
+        return ERR_INVALID_INPUT;
+    }
+
+    /* small batches just become dirty cache entries */
+    if (count <= cache->capacity / 2) {
+        int status = TFS_SUCCESS;
+        for (int i = 0; i < count; i++) {
+            ios[i].status = cacheWriteBlock(cache, ios[i].bNum, ios[i].block);
+            if (ios[i].status < 0 && status == TFS_SUCCESS) {
+                status = ios[i].status;
+            }
+        }
+        return status;
+    }
+
+    /* large batches would only flush the cache, so they go straight to the disk
+        with vectored writes and any cached copies are refreshed (and clean) */
+    int status = writeBlocks(cache->disk, ios, count);
+    for (int i = 0; i < count; i++) {
+        int e;
+        if (ios[i].status == TFS_SUCCESS && (e = _lookup(cache, ios[i].bNum)) != -1) {
+            memcpy(cache->entries[e].data, ios[i].block, BLOCKSIZE);
+            cache->entries[e].dirty = false;
+        }
+    }
+    return status;
+}
+
+int cacheSync(blockCache* cache) {
+    if (cache == NULL) {
+        return ERR_INVALID_INPUT;
+    }
+
+    /* gather the dirty blocks, writeBlocks() sorts and coalesces them */
+    blockIO* dirty = (blockIO*) malloc((cache->capacity + 1) * sizeof(blockIO));
+    int* owners = (int*) malloc((cache->capacity + 1) * sizeof(int));
+    if (dirty == NULL || owners == NULL) {
+        free(dirty);
+        free(owners);
+        return SYS_ERR_MALLOC;
+    }
+    int num_dirty = 0;
+    for (int e = 0; e < cache->used; e++) {
+        if (cache->entries[e].dirty) {
+            dirty[num_dirty].bNum = cache->entries[e].bNum;
+            dirty[num_dirty].block = cache->entries[e].data;
+            owners[num_dirty++] = e;
+        }
+    }
+
+    int status = writeBlocks(cache->disk, dirty, num_dirty);
+    for (int i = 0; i < num_dirty; i++) {
+        if (dirty[i].status == TFS_SUCCESS) {
+            cache->entries[owners[i]].dirty = false;
+            cache->stats.writebacks++;
+        }
+    }
+
+    free(dirty);
+    free(owners);
+    return status;
+}
+
+int getCacheStats(blockCache* cache, cacheStats* stats) {
+    if (cache == NULL || stats == NULL) {
+        return ERR_INVALID_INPUT;
+    }
+    *stats = cache->stats;
+    return TFS_SUCCESS;
+}
+
+int resetCacheStats(blockCache* cache) {
+    if (cache == NULL) {
+        return ERR_INVALID_INPUT;
+    }
+    memset(&cache->stats, 0, sizeof(cacheStats));
+    return TFS_SUCCESS;
+}
@@ -0,0 +1,83 @@
+#ifndef LIBCACHE_H
+#define LIBCACHE_H
+
+#include "libDisk.h"
+#include "tinyFS_errno.h"
+
+/* running counters kept by every block cache */
+typedef struct cacheStats {
+    // Block lookups served from memory / that had to go to the disk
+    unsigned long hits;
+    unsigned long misses;
+    // Blocks pushed out of the cache to make room for another block
+    unsigned long evictions;
+    // Dirty blocks written back to the disk (on eviction or sync)
+    unsigned long writebacks;
+} cacheStats;
+
+/* one cached copy of a disk block */
+typedef struct cacheEntry {
+    // Block number held by this entry, -1 if the entry is empty
+    int bNum;
+    // Whether the cached copy is newer than the disk
+    bool dirty;
+    // LRU list links (indices into the entry array, -1 terminates)
+    int prev;
+    int next;
+    // Next entry in the same hash bucket (-1 terminates)
+    int hashNext;
+    uint8_t data[BLOCKSIZE];
+} cacheEntry;
+
+/* a write-back block cache sitting in front of one open disk */
+typedef struct blockCache {
+    // Disk number returned by openDisk()
+    int disk;
+    // How many blocks the cache can hold
+    int capacity;
+    // How many entries currently hold a block
+    int used;
+    // Most and least recently used entries
+    int head;
+    int tail;
+    // Hash index from block number to entry, hashMask + 1 buckets
+    int* buckets;
+    int hashMask;
+    cacheEntry* entries;
+    cacheStats stats;
+} blockCache;
+
+/* Creates a cache of 'capacity' blocks in front of the open disk 'disk'.
+Returns NULL if capacity is not positive or memory runs out. */
+blockCache* cacheCreate(int disk, int capacity);
+
+/* Writes back every dirty block and frees the cache. Returns the first
+error hit while writing back, the cache is freed either way. */
+int cacheDestroy(blockCache* cache);
+
+/* Same contract as readBlock()/writeBlock(), but served from the cache.
+A read miss loads the block from the disk, possibly evicting the least
+recently used block (and writing it back if it is dirty). A write only
+updates the cached copy and marks it dirty; it reaches the disk on
+eviction or on cacheSync(). */
+int cacheReadBlock(blockCache* cache, int bNum, void* block);
+int cacheWriteBlock(blockCache* cache, int bNum, void* block);
+
+/* Batched versions of cacheReadBlock()/cacheWriteBlock() with the same
+list contract as readBlocks()/writeBlocks(). Read misses are fetched with
+one readBlocks() call. A write batch larger than half the cache is written
+straight to the disk with writeBlocks() (refreshing any cached copies)
+instead of flushing the whole cache through eviction. */
+int cacheReadBlocks(blockCache* cache, blockIO* ios, int count);
+int cacheWriteBlocks(blockCache* cache, blockIO* ios, int count);
+
+/* Writes every dirty block back to the disk with one writeBlocks() call,
+so adjacent dirty blocks share a system call. The blocks stay cached (and
+clean). */
+int cacheSync(blockCache* cache);
+
+/* Copies the counters of the cache into 'stats'; resetCacheStats() zeroes them. */
+int getCacheStats(blockCache* cache, cacheStats* stats);
+int resetCacheStats(blockCache* cache);
+
+#endif
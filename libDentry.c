@@ -0,0 +1,179 @@
+#include "libDentry.h"
+
+/* ~ HELPER FUNCTIONS ~ */
+
+/* _hash_dentry(): bucket index of the given directory and name */
+static int _hash_dentry(dentryCache* cache, uint32_t parent, const char* name) {
+    uint32_t hash = parent * 2654435761u;
+    for (int i = 0; i < DENTRY_NAME_LENGTH && name[i] != '\0'; i++) {
+        hash = (hash ^ (uint8_t) name[i]) * 16777619u;
+    }
+    return (int) (hash & (uint32_t) cache->hashMask);
+}
+
+/* _lookup(): find the entry for 'name' in 'parent'
+    > returns the entry index, or -1 if the lookup is not cached */
+static int _lookup(dentryCache* cache, uint32_t parent, const char* name) {
+    int e = cache->buckets[_hash_dentry(cache, parent, name)];
+    while (e != -1 && (cache->entries[e].parent != parent || strncmp(cache->entries[e].name, name, DENTRY_NAME_LENGTH) != 0)) {
+        e = cache->entries[e].hashNext;
+    }
+    return e;
+}
+
+/* _hash_insert()/_hash_remove(): add or drop entry 'e' from its hash bucket */
+static void _hash_insert(dentryCache* cache, int e) {
+    int bucket = _hash_dentry(cache, cache->entries[e].parent, cache->entries[e].name);
+    cache->entries[e].hashNext = cache->buckets[bucket];
+    cache->buckets[bucket] = e;
+}
+
+static void _hash_remove(dentryCache* cache, int e) {
+    int* link = &cache->buckets[_hash_dentry(cache, cache->entries[e].parent, cache->entries[e].name)];
+    while (*link != e) {
+        link = &cache->entries[*link].hashNext;
+    }
+    *link = cache->entries[e].hashNext;
+}
+
+/* _lru_unlink()/_lru_push_front(): move entries around the LRU list,
+    the head is the most recently used entry and the tail the least */
+static void _lru_unlink(dentryCache* cache, int e) {
+    dentry* entry = &cache->entries[e];
+    if (entry->prev != -1) {
+        cache->entries[entry->prev].next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+    if (entry->next != -1) {
+        cache->entries[entry->next].prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+    entry->prev = entry->next = -1;
+}
+
+static void _lru_push_front(dentryCache* cache, int e) {
+    dentry* entry = &cache->entries[e];
+    entry->prev = -1;
+    entry->next = cache->head;
+    if (cache->head != -1) {
+        cache->entries[cache->head].prev = e;
+    }
+    cache->head = e;
+    if (cache->tail == -1) {
+        cache->tail = e;
+    }
+}
+
+/* _drop(): empty entry 'e' and put it on the free list */
+static void _drop(dentryCache* cache, int e) {
+    _hash_remove(cache, e);
+    _lru_unlink(cache, e);
+    cache->entries[e].valid = false;
+    cache->entries[e].next = cache->freeList;
+    cache->freeList = e;
+}
+
+/* ^ HELPER FUNCTIONS ^ */
+
+dentryCache* dcacheCreate(int capacity) {
+    if (capacity <= 0) {
+        return NULL;
+    }
+
+    dentryCache* cache = (dentryCache*) malloc(sizeof(dentryCache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    memset(cache, 0, sizeof(dentryCache));
+    cache->capacity = capacity;
+    cache->head = cache->tail = cache->freeList = -1;
+
+    /* a power of two of buckets, at least as many as entries */
+    int num_buckets = 1;
+    while (num_buckets < capacity) {
+        num_buckets <<= 1;
+    }
+    cache->hashMask = num_buckets - 1;
+    cache->buckets = (int*) malloc(num_buckets * sizeof(int));
+    cache->entries = (dentry*) calloc(capacity, sizeof(dentry));
+    if (cache->buckets == NULL || cache->entries == NULL) {
+        free(cache->buckets);
+        free(cache->entries);
+        free(cache);
+        return NULL;
+    }
+    memset(cache->buckets, -1, num_buckets * sizeof(int));
+    return cache;
+}
+
+void dcacheDestroy(dentryCache* cache) {
+    if (cache == NULL) {
+        return;
+    }
+    free(cache->buckets);
+    free(cache->entries);
+    free(cache);
+}
+
+bool dcacheLookup(dentryCache* cache, uint32_t parent, const char* name, uint32_t* child, int* type) {
+    int e = _lookup(cache, parent, name);
+    if (e == -1) {
+        cache->misses++;
+        return false;
+    }
+
+    cache->hits++;
+    _lru_unlink(cache, e);
+    _lru_push_front(cache, e);
+    *child = cache->entries[e].child;
+    *type = cache->entries[e].type;
+    return true;
+}
+
+void dcacheInsert(dentryCache* cache, uint32_t parent, const char* name, uint32_t child, int type) {
+    /* reuse the entry for the name, else an emptied one, a new one, or the least recently used */
+    int e = _lookup(cache, parent, name);
+    if (e != -1) {
+        _hash_remove(cache, e);
+        _lru_unlink(cache, e);
+    } else if (cache->freeList != -1) {
+        e = cache->freeList;
+        cache->freeList = cache->entries[e].next;
+    } else if (cache->used < cache->capacity) {
+        e = cache->used++;
+    } else {
+        e = cache->tail;
+        _hash_remove(cache, e);
+        _lru_unlink(cache, e);
+    }
+
+    dentry* entry = &cache->entries[e];
+    entry->valid = true;
+    entry->parent = parent;
+    strncpy(entry->name, name, DENTRY_NAME_LENGTH);
+    entry->name[DENTRY_NAME_LENGTH] = '\0';
+    entry->child = child;
+    entry->type = (uint8_t) type;
+    _hash_insert(cache, e);
+    _lru_push_front(cache, e);
+}
+
+void dcacheForget(dentryCache* cache, uint32_t inode) {
+    for (int e = 0; e < cache->used; e++) {
+        dentry* entry = &cache->entries[e];
+        if (entry->valid && (entry->child == inode || entry->parent == inode)) {
+            _drop(cache, e);
+        }
+    }
+}
+
+void dcacheForgetName(dentryCache* cache, const char* name) {
+    for (int e = 0; e < cache->used; e++) {
+        dentry* entry = &cache->entries[e];
+        if (entry->valid && strncmp(entry->name, name, DENTRY_NAME_LENGTH) == 0) {
+            _drop(cache, e);
+        }
+    }
+}
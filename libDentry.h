@@ -0,0 +1,75 @@
+#ifndef LIBDENTRY_H
+#define LIBDENTRY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tinyFS_errno.h"
+
+/* longest name a dentry holds, FILENAME_LENGTH of tinyFS.h */
+#define DENTRY_NAME_LENGTH 8
+
+/* one remembered directory lookup: 'name' in directory 'parent' is the
+inode 'child', or does not exist when child is 0 (a negative entry) */
+typedef struct dentry {
+    // Whether the entry holds a lookup
+    bool valid;
+    // Inode of the directory searched (the superblock for the root)
+    uint32_t parent;
+    char name[DENTRY_NAME_LENGTH + 1];
+    uint32_t child;
+    // FILE_TYPE_* flag of the child, unused for negative entries
+    uint8_t type;
+    // LRU list links (indices into the entry array, -1 terminates)
+    int prev;
+    int next;
+    // Next entry in the same hash bucket (-1 terminates)
+    int hashNext;
+} dentry;
+
+/* a cache of directory lookups, kept for as long as a disk is mounted.
+It only ever repeats what a directory scan found, so whoever changes a
+directory drops the entries the change makes wrong. */
+typedef struct dentryCache {
+    // How many entries the cache can hold, and how many are in use
+    int capacity;
+    int used;
+    // Most and least recently used entries
+    int head;
+    int tail;
+    // Entries emptied by a forget, linked through 'next' (-1 terminates)
+    int freeList;
+    // Hash index from (parent, name) to entry, hashMask + 1 buckets
+    int* buckets;
+    int hashMask;
+    dentry* entries;
+    // Lookups answered from the cache / that found nothing cached
+    unsigned long hits;
+    unsigned long misses;
+} dentryCache;
+
+/* Creates a cache of 'capacity' entries. Returns NULL if capacity is not
+positive or memory runs out. */
+dentryCache* dcacheCreate(int capacity);
+void dcacheDestroy(dentryCache* cache);
+
+/* Looks up 'name' in directory 'parent'. Returns false if the lookup is not
+cached, else fills in the child inode (0 if the name does not exist) and,
+for a found child, its type. */
+bool dcacheLookup(dentryCache* cache, uint32_t parent, const char* name, uint32_t* child, int* type);
+
+/* Remembers that 'name' in 'parent' is 'child' of 'type' (child 0: that it
+does not exist), replacing any entry for the same name and evicting the
+least recently used entry if the cache is full. */
+void dcacheInsert(dentryCache* cache, uint32_t parent, const char* name, uint32_t child, int type);
+
+/* Drops every entry that finds inode 'inode' or looks inside it, for when
+the inode is renamed or deleted. */
+void dcacheForget(dentryCache* cache, uint32_t inode);
+
+/* Drops every entry for 'name', in any directory, for when something new
+takes the name without its directory being known. */
+void dcacheForgetName(dentryCache* cache, const char* name);
+
+#endif
@@ -1,6 +1,103 @@
 #include "libDisk.h"
 
-int openDisk(char *filename, int nBytes) {
+/* 
+- disk_table: per-disk state for every disk opened through openDisk()
+    > keyed by the handle openDisk() returned (the unix fd of the disk file)
+    > geometry and flags are recorded once at open time, so block accesses
+      can be bounds-checked without asking the kernel
+    > slots are claimed by openDisk() and released by closeDisk(), which are
+      not meant to race each other; block I/O on open disks may be concurrent
+*/
+static diskState disk_table[MAX_OPEN_DISKS];
+
+/* backend used by the next openDisk(), -1 until chosen by setDiskBackend()
+    or the DISK_BACKEND_ENV environment variable */
+static int default_backend = -1;
+
+static int _ring_transfer(diskState* state, blockIO* ios, int count, bool writing, bool wait);
+static int _ring_drain(diskState* state);
+
+/* _find_disk(): look up the state table entry for the given disk handle
+    > returns NULL if the disk was not opened with openDisk() */
+static diskState* _find_disk(int disk) {
+    if (disk < 0) {
+        return NULL;
+    }
+    for (int i = 0; i < MAX_OPEN_DISKS; i++) {
+        if (disk_table[i].in_use && disk_table[i].fd == disk) {
+            return &disk_table[i];
+        }
+    }
+    return NULL;
+}
+
+/* _claim_disk(): grab a free state table entry for a newly opened disk
+    > returns NULL if every entry is in use */
+static diskState* _claim_disk() {
+    for (int i = 0; i < MAX_OPEN_DISKS; i++) {
+        if (!disk_table[i].in_use) {
+            memset(&disk_table[i], 0, sizeof(diskState));
+            disk_table[i].in_use = true;
+            return &disk_table[i];
+        }
+    }
+    return NULL;
+}
+
+/* _map_disk(): map the whole disk file into memory for the mmap backend
+    > returns false if the disk cannot be mapped, so the caller can fall back
+      to positional I/O */
+static bool _map_disk(diskState* state) {
+    if (state->numBlocks == 0) {
+        return false;
+    }
+    void* map = mmap(NULL, (size_t) state->numBlocks * BLOCKSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, state->fd, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    state->map = (uint8_t*) map;
+    return true;
+}
+
+/* _ring_disk(): set up the io_uring request queue for the uring backend
+    > returns false if the kernel offers no io_uring, so the caller can fall
+      back to positional I/O */
+static bool _ring_disk(diskState* state) {
+    diskQueue* queue = (diskQueue*) malloc(sizeof(diskQueue));
+    if (queue == NULL) {
+        return false;
+    }
+    if (ringCreate(&queue->ring, DISK_RING_ENTRIES) < 0) {
+        free(queue);
+        return false;
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    for (int i = 0; i < DISK_RING_ENTRIES; i++) {
+        queue->slots[i].nextFree = i + 1 < DISK_RING_ENTRIES ? i + 1 : -1;
+    }
+    queue->freeSlot = 0;
+    queue->inFlight = 0;
+    state->queue = queue;
+    return true;
+}
+
+int setDiskBackend(int backend) {
+    if (backend != DISK_BACKEND_PREAD && backend != DISK_BACKEND_MMAP && backend != DISK_BACKEND_URING) {
+        return ERR_INVALID_INPUT;
+    }
+    default_backend = backend;
+    return TFS_SUCCESS;
+}
+
+int getDiskBackend(int disk) {
+    diskState* state = _find_disk(disk);
+    if (state == NULL) {
+        return ERR_INVALID_DISK_FD;
+    }
+    return state->backend;
+}
+
+int openDisk(char *filename, off_t nBytes) {
     /* make sure filename is valid */
     if (filename == NULL) {
         return ERR_INVALID_INPUT;
@@ -13,7 +110,7 @@ int openDisk(char *filename, int nBytes) {
     if (nBytes == 0 && !file_exists) {
         return ERR_DISK_FILE_NOT_FOUND;
     }
-    if((nBytes < BLOCKSIZE && nBytes != 0)) {
+    if((nBytes < BLOCKSIZE && nBytes != 0) || nBytes / BLOCKSIZE > INT32_MAX) {
         return ERR_INVALID_INPUT;
     }
 
@@ -23,37 +120,76 @@ int openDisk(char *filename, int nBytes) {
     }
 
     int fd;
+    int flags;
 
     /* if the file does not exist, create the file */
     if (!file_exists) {
-        fd = open(filename, O_RDWR | O_CREAT, 0644);
+        flags = O_RDWR | O_CREAT;
 
     /* if nBytes is zero and file exists, open existing  file */
     } else if(nBytes == 0) {
-        fd = open(filename, O_RDWR, 0644);
+        flags = O_RDWR;
 
     /* if nBytes is not zero and file exists, open the file and overwrite its contents */
     } else {
-        fd = open(filename, O_RDWR | O_TRUNC, 0644);
+        flags = O_RDWR | O_TRUNC;
     }
+    fd = open(filename, flags, 0644);
 
     /* error checking open() system call */
     if(fd < 0) {
         return SYS_ERR_OPEN;
     }
 
-    /* if nBytes is not 0, write nByte 0's to the file */
+    /* if nBytes is not 0, size the (empty) file to nBytes: the kernel hands back
+        zeros for the hole, so no memory or writes are needed however large the disk */
     if(nBytes != 0) {
-        uint8_t* buffer = (uint8_t*) malloc(nBytes);
-        if(buffer == NULL) {
-            return SYS_ERR_MALLOC;
-        }
-        memset(buffer, 0, nBytes);
-        if(write(fd, buffer, nBytes) < 0) {
+        if(ftruncate(fd, nBytes) < 0) {
+            close(fd);
             return SYS_ERR_WRITE;
         }
-        free(buffer);
-    }  
+    /* if opening an existing disk, its size comes from the file itself */
+    } else {
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) == -1) {
+            close(fd);
+            return SYS_ERR_FSTAT;
+        }
+        nBytes = file_stat.st_size;
+
+        /* block numbers are ints, a larger file cannot be addressed */
+        if (nBytes / BLOCKSIZE > INT32_MAX) {
+            close(fd);
+            return ERR_INVALID_INPUT;
+        }
+    }
+
+    /* record the disk's geometry once, so block accesses never need to fstat */
+    diskState* state = _claim_disk();
+    if (state == NULL) {
+        close(fd);
+        return ERR_TOO_MANY_DISKS;
+    }
+    state->fd = fd;
+    state->flags = flags;
+    state->numBlocks = nBytes / BLOCKSIZE;
+
+    /* pick the backend, if not chosen yet the environment decides */
+    if (default_backend == -1) {
+        char* env = getenv(DISK_BACKEND_ENV);
+        default_backend = DISK_BACKEND_PREAD;
+        if (env != NULL && strcmp(env, "mmap") == 0) {
+            default_backend = DISK_BACKEND_MMAP;
+        } else if (env != NULL && strcmp(env, "uring") == 0) {
+            default_backend = DISK_BACKEND_URING;
+        }
+    }
+    state->backend = DISK_BACKEND_PREAD;
+    if (default_backend == DISK_BACKEND_MMAP && _map_disk(state)) {
+        state->backend = DISK_BACKEND_MMAP;
+    } else if (default_backend == DISK_BACKEND_URING && _ring_disk(state)) {
+        state->backend = DISK_BACKEND_URING;
+    }
     
     /* should always be > 3, since unix reserves fd 0, 1, & 2 */
     return fd;
@@ -61,9 +197,29 @@ int openDisk(char *filename, int nBytes) {
 
 int closeDisk(int disk) {
     /* make sure the given disk is valid */
-    if (disk < 3) {
+    diskState* state = _find_disk(disk);
+    if (state == NULL) {
         return ERR_INVALID_DISK_FD;
     }
+    state->in_use = false;
+
+    /* flush and drop the mapping before closing the file under it */
+    int status = TFS_SUCCESS;
+    if (state->queue != NULL) {
+        status = _ring_drain(state);
+        ringDestroy(&state->queue->ring);
+        pthread_mutex_destroy(&state->queue->lock);
+        free(state->queue);
+        state->queue = NULL;
+    }
+    if (state->map != NULL) {
+        size_t length = (size_t) state->numBlocks * BLOCKSIZE;
+        if (msync(state->map, length, MS_SYNC) < 0) {
+            status = SYS_ERR_SYNC;
+        }
+        munmap(state->map, length);
+        state->map = NULL;
+    }
 
     /* close the disk */
     if(close(disk) < 0) {
@@ -74,69 +230,574 @@ int closeDisk(int disk) {
         return SYS_ERR_CLOSE;
     }
 
+    return status;
+}
+
+int syncDisk(int disk) {
+    diskState* state = _find_disk(disk);
+    if (state == NULL) {
+        return ERR_INVALID_DISK_FD;
+    }
+
+    if (state->queue != NULL) {
+        int status = _ring_drain(state);
+        if (status < 0) {
+            return status;
+        }
+    }
+    if (state->map != NULL) {
+        if (msync(state->map, (size_t) state->numBlocks * BLOCKSIZE, MS_SYNC) < 0) {
+            return SYS_ERR_SYNC;
+        }
+    } else if (fsync(state->fd) < 0) {
+        return SYS_ERR_SYNC;
+    }
+    return TFS_SUCCESS;
+}
+
+int getDiskSize(int disk) {
+    diskState* state = _find_disk(disk);
+    if (state == NULL) {
+        return ERR_INVALID_DISK_FD;
+    }
+    return state->numBlocks;
+}
+
+int getDiskStats(int disk, diskStats* stats) {
+    diskState* state = _find_disk(disk);
+    if (state == NULL) {
+        return ERR_INVALID_DISK_FD;
+    }
+    if (stats == NULL) {
+        return ERR_INVALID_INPUT;
+    }
+
+    stats->blocksRead = __atomic_load_n(&state->stats.blocksRead, __ATOMIC_RELAXED);
+    stats->blocksWritten = __atomic_load_n(&state->stats.blocksWritten, __ATOMIC_RELAXED);
+    stats->readCalls = __atomic_load_n(&state->stats.readCalls, __ATOMIC_RELAXED);
+    stats->writeCalls = __atomic_load_n(&state->stats.writeCalls, __ATOMIC_RELAXED);
+    stats->ringCalls = __atomic_load_n(&state->stats.ringCalls, __ATOMIC_RELAXED);
+    return TFS_SUCCESS;
+}
+
+int resetDiskStats(int disk) {
+    diskState* state = _find_disk(disk);
+    if (state == NULL) {
+        return ERR_INVALID_DISK_FD;
+    }
+    memset(&state->stats, 0, sizeof(diskStats));
+    return TFS_SUCCESS;
+}
+
+/* _pread_full(): positional read of exactly 'count' bytes at 'offset'
+    + retries on short reads and EINTR so one block access is normally one syscall
+    + never touches the shared file offset, so the disk can be read from several threads
+    - errors if the read fails or hits the end of the disk file */
+static int _pread_full(diskState* state, void *buffer, size_t count, off_t offset) {
+    uint8_t *cursor = (uint8_t *) buffer;
+    while (count > 0) {
+        ssize_t got = pread(state->fd, cursor, count, offset);
+        __atomic_fetch_add(&state->stats.readCalls, 1, __ATOMIC_RELAXED);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            /* if errors with errno 9: bad file descriptor */
+            if (errno == EBADF) {
+                return ERR_INVALID_DISK_FD;
+            }
+            return SYS_ERR_READ;
+        }
+        /* end of file before the whole block was read */
+        if (got == 0) {
+            return SYS_ERR_READ;
+        }
+        cursor += got;
+        offset += got;
+        count -= got;
+    }
+    return TFS_SUCCESS;
+}
+
+/* _pwrite_full(): positional write of exactly 'count' bytes at 'offset'
+    + retries on short writes and EINTR
+    - errors if the write fails */
+static int _pwrite_full(diskState* state, const void *buffer, size_t count, off_t offset) {
+    const uint8_t *cursor = (const uint8_t *) buffer;
+    while (count > 0) {
+        ssize_t put = pwrite(state->fd, cursor, count, offset);
+        __atomic_fetch_add(&state->stats.writeCalls, 1, __ATOMIC_RELAXED);
+        if (put < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EBADF) {
+                return ERR_INVALID_DISK_FD;
+            }
+            return SYS_ERR_WRITE;
+        }
+        cursor += put;
+        offset += put;
+        count -= put;
+    }
     return TFS_SUCCESS;
 }
 
 /* block needs to be of 256 bytes or else there will be undefined behavior */
 int readBlock(int disk, int bNum, void *block) {
-    int byteOffset = bNum * BLOCKSIZE;
-
 	/* make sure the given disk is valid */
-    if (disk < 3) {
+    diskState* state = _find_disk(disk);
+    if (state == NULL) {
         return ERR_INVALID_DISK_FD;
     }
 
-	/* navigate to the correct block in the given disk */
-	if (lseek(disk, byteOffset, SEEK_SET) == -1) {
-        /* if errors with errno 9: bad file descriptor */
-        if (errno == EBADF) {
-            return ERR_INVALID_DISK_FD;
-        }
-		return SYS_ERR_SEEK;
-	}
-    
-    /* reading from the file */
-    if (read(disk, block, BLOCKSIZE) != BLOCKSIZE) {
-        return SYS_ERR_READ;
+    /* make sure the given block is valid and inside the disk */
+    if (block == NULL || bNum < 0 || bNum >= state->numBlocks) {
+        return ERR_INVALID_INPUT;
+    }
+
+    /* uring disks queue the block and wait for it */
+    if (state->queue != NULL) {
+        blockIO io = {bNum, block, TFS_SUCCESS};
+        return _ring_transfer(state, &io, 1, false, true);
+    }
+
+    /* mapped disks are read straight out of memory */
+    if (state->map != NULL) {
+        memcpy(block, state->map + (size_t) bNum * BLOCKSIZE, BLOCKSIZE);
+        __atomic_fetch_add(&state->stats.blocksRead, 1, __ATOMIC_RELAXED);
+        return TFS_SUCCESS;
+    }
+
+    /* read the whole block straight from its offset in the disk */
+    int status = _pread_full(state, block, BLOCKSIZE, (off_t) bNum * BLOCKSIZE);
+    if (status < 0) {
+        return status;
     }
+    __atomic_fetch_add(&state->stats.blocksRead, 1, __ATOMIC_RELAXED);
 
-    return TFS_SUCCESS;  
+    return TFS_SUCCESS;
 }
 
 int writeBlock(int disk, int bNum, void* block) {
-    int byteOffset = bNum * BLOCKSIZE;
-
     /* make sure the given disk is valid */
-    if (disk < 3) {
+    diskState* state = _find_disk(disk);
+    if (state == NULL) {
         return ERR_INVALID_DISK_FD;
     }
 
-    /* make sure the given block is valid */
-    if (block == NULL) {
+    /* make sure the given block is valid and inside the disk */
+    if (block == NULL || bNum < 0 || bNum >= state->numBlocks) {
         return ERR_INVALID_INPUT;
     }
 
-    struct stat file_stat;
-    if (fstat(disk, &file_stat) == -1) {
-        return SYS_ERR_FSTAT;
-    }  
-    if (byteOffset >= file_stat.st_size) {
+    /* uring disks queue the block and wait for it */
+    if (state->queue != NULL) {
+        blockIO io = {bNum, block, TFS_SUCCESS};
+        return _ring_transfer(state, &io, 1, true, true);
+    }
+
+    /* mapped disks are written straight into memory, msync() flushes them */
+    if (state->map != NULL) {
+        memcpy(state->map + (size_t) bNum * BLOCKSIZE, block, BLOCKSIZE);
+        __atomic_fetch_add(&state->stats.blocksWritten, 1, __ATOMIC_RELAXED);
+        return TFS_SUCCESS;
+    }
+
+	/* write the given block straight to its offset in the disk */
+	int status = _pwrite_full(state, block, BLOCKSIZE, (off_t) bNum * BLOCKSIZE);
+    if (status < 0) {
+        return status;
+    }
+    __atomic_fetch_add(&state->stats.blocksWritten, 1, __ATOMIC_RELAXED);
+
+	return TFS_SUCCESS;
+}
+
+/* _vector_full(): positional vectored transfer of every byte described by 'iov'
+    + retries on short transfers and EINTR, advancing through 'iov' in place
+    - errors if a transfer fails or a read hits the end of the disk file */
+static int _vector_full(diskState* state, struct iovec* iov, int iovcnt, off_t offset, bool writing) {
+    while (iovcnt > 0) {
+        ssize_t moved;
+        if (writing) {
+            moved = pwritev(state->fd, iov, iovcnt, offset);
+            __atomic_fetch_add(&state->stats.writeCalls, 1, __ATOMIC_RELAXED);
+        } else {
+            moved = preadv(state->fd, iov, iovcnt, offset);
+            __atomic_fetch_add(&state->stats.readCalls, 1, __ATOMIC_RELAXED);
+        }
+        if (moved < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EBADF) {
+                return ERR_INVALID_DISK_FD;
+            }
+            return writing ? SYS_ERR_WRITE : SYS_ERR_READ;
+        }
+        if (moved == 0) {
+            return writing ? SYS_ERR_WRITE : SYS_ERR_READ;
+        }
+
+        /* skip over everything that was transferred */
+        offset += moved;
+        while (iovcnt > 0 && (size_t) moved >= iov->iov_len) {
+            moved -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t*) iov->iov_base + moved;
+            iov->iov_len -= moved;
+        }
+    }
+    return TFS_SUCCESS;
+}
+
+/* a blockIO request's block number and its index in the caller's list */
+typedef struct ioKey {
+    int bNum;
+    int index;
+} ioKey;
+
+/* orders requests by block number for _transfer_blocks(), ties keep list order */
+static int _compare_keys(const void* a, const void* b) {
+    const ioKey* x = (const ioKey*) a;
+    const ioKey* y = (const ioKey*) b;
+    if (x->bNum != y->bNum) {
+        return x->bNum < y->bNum ? -1 : 1;
+    }
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+/* _ring_reap(): finish every request of a uring disk the kernel has completed
+    + a short transfer is finished with ordinary positional I/O
+    = the queue lock must be held */
+static void _ring_reap(diskState* state) {
+    diskQueue* queue = state->queue;
+    uint64_t slot;
+    int result;
+    while (ringReap(&queue->ring, &slot, &result)) {
+        ringSlot* entry = &queue->slots[slot];
+        blockIO* io = entry->io;
+        int status = TFS_SUCCESS;
+        if (result < 0) {
+            if (result == -EBADF) {
+                status = ERR_INVALID_DISK_FD;
+            } else {
+                status = entry->writing ? SYS_ERR_WRITE : SYS_ERR_READ;
+            }
+        } else if (result < BLOCKSIZE) {
+            uint8_t* rest = (uint8_t*) io->block + result;
+            off_t where = (off_t) io->bNum * BLOCKSIZE + result;
+            status = entry->writing ? _pwrite_full(state, rest, BLOCKSIZE - result, where)
+                                    : _pread_full(state, rest, BLOCKSIZE - result, where);
+        }
+        if (status == TFS_SUCCESS) {
+            __atomic_fetch_add(entry->writing ? &state->stats.blocksWritten : &state->stats.blocksRead, 1, __ATOMIC_RELAXED);
+        }
+
+        entry->nextFree = queue->freeSlot;
+        queue->freeSlot = (int) slot;
+        queue->inFlight--;
+        __atomic_store_n(&io->status, status, __ATOMIC_RELEASE);
+    }
+}
+
+/* _ring_wait(): hand every queued request to the kernel, wait for at least one
+    completion if 'wait' is set (and anything is in flight), then reap
+    = the queue lock must be held
+    - errors if io_uring_enter() fails */
+static int _ring_wait(diskState* state, bool wait) {
+    diskQueue* queue = state->queue;
+    int status = ringEnter(&queue->ring, wait && queue->inFlight > 0 ? 1 : 0);
+    __atomic_fetch_add(&state->stats.ringCalls, 1, __ATOMIC_RELAXED);
+    if (status < 0) {
+        return status;
+    }
+    _ring_reap(state);
+    return TFS_SUCCESS;
+}
+
+/* _ring_queue(): queue one valid request on a uring disk
+    + waits for a request to finish first if every slot is in flight
+    = the queue lock must be held */
+static int _ring_queue(diskState* state, blockIO* io, bool writing) {
+    diskQueue* queue = state->queue;
+    while (queue->freeSlot == -1) {
+        int status = _ring_wait(state, true);
+        if (status < 0) {
+            return status;
+        }
+    }
+
+    int slot = queue->freeSlot;
+    ringSlot* entry = &queue->slots[slot];
+    queue->freeSlot = entry->nextFree;
+    entry->io = io;
+    entry->writing = writing;
+    entry->iov.iov_base = io->block;
+    entry->iov.iov_len = BLOCKSIZE;
+    io->status = DISK_IO_PENDING;
+
+    /* never more in flight than slots, so the submission queue has room */
+    ringQueue(&queue->ring, state->fd, writing, &entry->iov, (off_t) io->bNum * BLOCKSIZE, (uint64_t) slot);
+    queue->inFlight++;
+    return TFS_SUCCESS;
+}
+
+/* _ring_settle(): after an error, wait until no request of a list is queued or in
+    flight, so nothing completes into the list's memory once it is handed back
+    + while io_uring_enter() fails, the requests the kernel never got are taken back
+      with the error and the ones it has are polled for until they complete
+    = the queue lock must be held */
+static void _ring_settle(diskState* state, blockIO* ios, int count, int error) {
+    diskQueue* queue = state->queue;
+    for (int i = 0; i < count; i++) {
+        while (__atomic_load_n(&ios[i].status, __ATOMIC_ACQUIRE) == DISK_IO_PENDING) {
+            if (_ring_wait(state, true) == TFS_SUCCESS) {
+                continue;
+            }
+            uint64_t slot;
+            while (ringUnqueue(&queue->ring, &slot)) {
+                ringSlot* entry = &queue->slots[slot];
+                entry->nextFree = queue->freeSlot;
+                queue->freeSlot = (int) slot;
+                queue->inFlight--;
+                __atomic_store_n(&entry->io->status, error, __ATOMIC_RELEASE);
+            }
+            sched_yield();
+            _ring_reap(state);
+        }
+    }
+}
+
+/* _ring_transfer(): queue a list of requests on a uring disk
+    + a write that a later write of the same block in the list supersedes is
+      skipped, since requests in flight may complete in any order
+    + with 'wait' set, returns only once every request of the list is done
+    > returns the first error in list order, or TFS_SUCCESS */
+static int _ring_transfer(diskState* state, blockIO* ios, int count, bool writing, bool wait) {
+    bool* superseded = NULL;
+    if (writing && count > 1) {
+        ioKey* order = (ioKey*) malloc(count * sizeof(ioKey));
+        superseded = (bool*) calloc(count, sizeof(bool));
+        if (order == NULL || superseded == NULL) {
+            free(order);
+            free(superseded);
+            return SYS_ERR_MALLOC;
+        }
+        for (int i = 0; i < count; i++) {
+            order[i].bNum = ios[i].bNum;
+            order[i].index = i;
+        }
+        qsort(order, count, sizeof(ioKey), _compare_keys);
+        for (int i = 0; i + 1 < count; i++) {
+            if (order[i].bNum == order[i + 1].bNum) {
+                superseded[order[i].index] = true;
+            }
+        }
+        free(order);
+    }
+
+    diskQueue* queue = state->queue;
+    pthread_mutex_lock(&queue->lock);
+    int status = TFS_SUCCESS;
+    for (int i = 0; i < count; i++) {
+        if (ios[i].block == NULL || ios[i].bNum < 0 || ios[i].bNum >= state->numBlocks) {
+            ios[i].status = ERR_INVALID_INPUT;
+        } else if (superseded != NULL && superseded[i]) {
+            ios[i].status = TFS_SUCCESS;
+        } else if ((status = _ring_queue(state, &ios[i], writing)) < 0) {
+            /* this request and the ones after it never reach the ring */
+            for (int j = i; j < count; j++) {
+                ios[j].status = status;
+            }
+            break;
+        }
+    }
+    free(superseded);
+
+    /* submit, then keep reaping until the whole list has completed (the first
+        wait submits as well, so a single block costs one system call) */
+    if (status == TFS_SUCCESS && !wait) {
+        status = _ring_wait(state, false);
+    }
+    for (int i = 0; wait && status == TFS_SUCCESS && i < count; i++) {
+        while (status == TFS_SUCCESS && __atomic_load_n(&ios[i].status, __ATOMIC_ACQUIRE) == DISK_IO_PENDING) {
+            status = _ring_wait(state, true);
+        }
+    }
+    if (status < 0) {
+        _ring_settle(state, ios, count, status);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    if (status < 0) {
+        return status;
+    }
+    for (int i = 0; i < count; i++) {
+        int io_status = __atomic_load_n(&ios[i].status, __ATOMIC_ACQUIRE);
+        if (io_status < 0) {
+            return io_status;
+        }
+    }
+    return TFS_SUCCESS;
+}
+
+/* _ring_drain(): wait for every request a uring disk has in flight */
+static int _ring_drain(diskState* state) {
+    diskQueue* queue = state->queue;
+    int status = TFS_SUCCESS;
+    pthread_mutex_lock(&queue->lock);
+    while (status == TFS_SUCCESS && queue->inFlight > 0) {
+        status = _ring_wait(state, true);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return status;
+}
+
+/* _transfer_blocks(): shared body of readBlocks()/writeBlocks()
+    + sorts the requests by block number and moves every run of consecutive
+      blocks with one preadv()/pwritev() (up to MAX_RUN_BLOCKS blocks per call)
+    + if a run fails, its blocks are retried one by one so each request gets
+      its own status */
+static int _transfer_blocks(int disk, blockIO* ios, int count, bool writing) {
+    diskState* state = _find_disk(disk);
+    if (state == NULL) {
+        return ERR_INVALID_DISK_FD;
+    }
+    if (ios == NULL || count < 0) {
         return ERR_INVALID_INPUT;
     }
+    if (state->queue != NULL) {
+        return _ring_transfer(state, ios, count, writing, true);
+    }
 
-	/* navigate to the correct block in the given disk */
-	if (lseek(disk, byteOffset, SEEK_SET) == -1) {
-        /* if errors with errno 9: bad file descriptor */
-        if (errno == EBADF) {
-            return ERR_INVALID_DISK_FD;
+    /* validate every request up front, only valid ones take part in runs */
+    ioKey* order = (ioKey*) malloc((count + 1) * sizeof(ioKey));
+    struct iovec* iov = (struct iovec*) malloc((count + 1) * sizeof(struct iovec));
+    if (order == NULL || iov == NULL) {
+        free(order);
+        free(iov);
+        return SYS_ERR_MALLOC;
+    }
+    int num_valid = 0;
+    for (int i = 0; i < count; i++) {
+        if (ios[i].block == NULL || ios[i].bNum < 0 || ios[i].bNum >= state->numBlocks) {
+            ios[i].status = ERR_INVALID_INPUT;
+        } else {
+            ios[i].status = TFS_SUCCESS;
+            order[num_valid].bNum = ios[i].bNum;
+            order[num_valid++].index = i;
         }
-		return SYS_ERR_SEEK;
-	}
+    }
+    qsort(order, num_valid, sizeof(ioKey), _compare_keys);
 
-	/* write the given block to the disk block */
-	if (write(disk, block, BLOCKSIZE) == -1) {
-		return SYS_ERR_WRITE;
-	}
+    int start = 0;
+    while (start < num_valid) {
+        /* extend the run while the block numbers stay consecutive */
+        int end = start + 1;
+        while (end < num_valid && end - start < MAX_RUN_BLOCKS && order[end].bNum == order[end - 1].bNum + 1) {
+            end++;
+        }
+        int run = end - start;
+        off_t offset = (off_t) order[start].bNum * BLOCKSIZE;
 
-	return TFS_SUCCESS;
-}
\ No newline at end of file
+        if (state->map != NULL) {
+            for (int i = start; i < end; i++) {
+                uint8_t* where = state->map + (size_t) ios[order[i].index].bNum * BLOCKSIZE;
+                if (writing) {
+                    memcpy(where, ios[order[i].index].block, BLOCKSIZE);
+                } else {
+                    memcpy(ios[order[i].index].block, where, BLOCKSIZE);
+                }
+            }
+        } else {
+            for (int i = start; i < end; i++) {
+                iov[i - start].iov_base = ios[order[i].index].block;
+                iov[i - start].iov_len = BLOCKSIZE;
+            }
+            if (_vector_full(state, iov, run, offset, writing) < 0) {
+                /* find out exactly which blocks of the run failed */
+                run = 0;
+                for (int i = start; i < end; i++) {
+                    blockIO* io = &ios[order[i].index];
+                    off_t where = (off_t) io->bNum * BLOCKSIZE;
+                    io->status = writing ? _pwrite_full(state, io->block, BLOCKSIZE, where)
+                                         : _pread_full(state, io->block, BLOCKSIZE, where);
+                    if (io->status == TFS_SUCCESS) {
+                        run++;
+                    }
+                }
+            }
+        }
+
+        if (writing) {
+            __atomic_fetch_add(&state->stats.blocksWritten, run, __ATOMIC_RELAXED);
+        } else {
+            __atomic_fetch_add(&state->stats.blocksRead, run, __ATOMIC_RELAXED);
+        }
+        start = end;
+    }
+
+    free(order);
+    free(iov);
+
+    /* report the first failure in list order, if any */
+    for (int i = 0; i < count; i++) {
+        if (ios[i].status < 0) {
+            return ios[i].status;
+        }
+    }
+    return TFS_SUCCESS;
+}
+
+int readBlocks(int disk, blockIO* ios, int count) {
+    return _transfer_blocks(disk, ios, count, false);
+}
+
+int writeBlocks(int disk, blockIO* ios, int count) {
+    return _transfer_blocks(disk, ios, count, true);
+}
+
+int submitBlocks(int disk, blockIO* ios, int count, bool writing) {
+    diskState* state = _find_disk(disk);
+    if (state == NULL) {
+        return ERR_INVALID_DISK_FD;
+    }
+    if (ios == NULL || count < 0) {
+        return ERR_INVALID_INPUT;
+    }
+
+    /* only uring disks can leave requests in flight, the rest finish them now */
+    if (state->queue == NULL) {
+        return _transfer_blocks(disk, ios, count, writing);
+    }
+    return _ring_transfer(state, ios, count, writing, false);
+}
+
+int pollBlocks(int disk, bool wait) {
+    diskState* state = _find_disk(disk);
+    if (state == NULL) {
+        return ERR_INVALID_DISK_FD;
+    }
+    if (state->queue == NULL) {
+        return 0;
+    }
+
+    diskQueue* queue = state->queue;
+    pthread_mutex_lock(&queue->lock);
+    int status = TFS_SUCCESS;
+    if (wait || queue->ring.toSubmit > 0) {
+        status = _ring_wait(state, wait);
+    } else {
+        /* completions can be reaped without a system call */
+        _ring_reap(state);
+    }
+    int in_flight = queue->inFlight;
+    pthread_mutex_unlock(&queue->lock);
+
+    return status < 0 ? status : in_flight;
+}
@@ -11,12 +11,101 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include "tinyFS_errno.h"
+#include "libDiskRing.h"
 
 #define BLOCKSIZE 256
 
+/* how many disks may be open through openDisk() at the same time */
+#define MAX_OPEN_DISKS 64
+
+/* most blocks moved by one preadv()/pwritev() call (Linux's IOV_MAX) */
+#define MAX_RUN_BLOCKS 1024
+
+/* disk backends: how readBlock()/writeBlock() reach the disk file */
+#define DISK_BACKEND_PREAD  0   // one pread()/pwrite() per block
+#define DISK_BACKEND_MMAP   1   // the whole disk is mmap()ed, blocks are memcpy()ed
+#define DISK_BACKEND_URING  2   // blocks are queued on an io_uring, many can be in flight
+
+/* environment variable that picks the backend ("mmap", "uring" or "pread")
+when setDiskBackend() has not been called */
+#define DISK_BACKEND_ENV "TINYFS_DISK_BACKEND"
+
+/* most block requests one io_uring disk keeps in flight */
+#define DISK_RING_ENTRIES 64
+
+/* blockIO status of a request submitBlocks() queued that has not completed yet */
+#define DISK_IO_PENDING 1
+
+/* running I/O counters kept for every open disk */
+typedef struct diskStats {
+    // Blocks transferred by readBlock() / writeBlock()
+    unsigned long blocksRead;
+    unsigned long blocksWritten;
+    // System calls issued against the disk file to move those blocks
+    unsigned long readCalls;
+    unsigned long writeCalls;
+    // io_uring_enter() calls made for a uring disk (they move reads and writes alike)
+    unsigned long ringCalls;
+} diskStats;
+
+/* one block of a readBlocks()/writeBlocks() request list */
+typedef struct blockIO {
+    // Logical block number to transfer
+    int bNum;
+    // BLOCKSIZE buffer to read into / write from
+    void* block;
+    // Filled in by the call: TFS_SUCCESS or the error for this block
+    int status;
+} blockIO;
+
+/* one request slot of an io_uring disk */
+typedef struct ringSlot {
+    // The caller's request, its status is filled in on completion
+    blockIO* io;
+    // Single buffer vector handed to the kernel, must outlive the request
+    struct iovec iov;
+    bool writing;
+    // Next free slot (-1 terminates)
+    int nextFree;
+} ringSlot;
+
+/* the io_uring of a uring disk and the requests it has in flight */
+typedef struct diskQueue {
+    diskRing ring;
+    // Serialises everyone queueing on / reaping from the ring
+    pthread_mutex_t lock;
+    ringSlot slots[DISK_RING_ENTRIES];
+    int freeSlot;
+    // Requests queued or submitted that have not been reaped yet
+    int inFlight;
+} diskQueue;
+
+/* per-disk state recorded once by openDisk() */
+typedef struct diskState {
+    // Whether this table entry belongs to an open disk
+    bool in_use;
+    // Unix file descriptor of the disk file, also the disk number handed out
+    int fd;
+    // Flags the disk file was opened with
+    int flags;
+    // Size of the disk in blocks
+    int numBlocks;
+    // DISK_BACKEND_* the disk is accessed through
+    int backend;
+    // Start of the mapped disk file for the mmap backend, NULL otherwise
+    uint8_t* map;
+    // Request queue for the uring backend, NULL otherwise
+    diskQueue* queue;
+    diskStats stats;
+} diskState;
+
 /* This functions opens a regular UNIX file and designates the first
 nBytes of it as space for the emulated disk. If nBytes is not exactly a
 multiple of BLOCKSIZE then the disk size will be the closest multiple
@@ -25,13 +114,41 @@ less than BLOCKSIZE failure should be returned. If nBytes > BLOCKSIZE
 and there is already a file by the given filename, that file’s content
 may be overwritten. If nBytes is 0, an existing disk is opened, and the
 content must not be overwritten in this function. There is no requirement
-to maintain integrity of any file content beyond nBytes. The return value
-is negative on failure or a disk number on success. */
-int openDisk(char *filename, int nBytes);
+to maintain integrity of any file content beyond nBytes. A new disk is
+created as a sparse file of zeros with ftruncate(), so creating it costs
+neither memory nor writes. The return value is negative on failure or a
+disk number on success. nBytes is an off_t so disks may exceed 2 GiB,
+up to INT32_MAX blocks. */
+int openDisk(char *filename, off_t nBytes);
 
-/* Closes the disk */
+/* Closes the disk. A mapped disk is flushed with msync() first, a uring
+disk waits for its requests in flight. */
 int closeDisk(int disk);
 
+/* Selects the backend (DISK_BACKEND_PREAD, DISK_BACKEND_MMAP or
+DISK_BACKEND_URING) used by disks opened from now on. All behave
+identically to callers. A disk that cannot be mapped (e.g. it is empty or
+does not fit in memory), or that is opened on a kernel without io_uring,
+silently uses DISK_BACKEND_PREAD. getDiskBackend() reports what an open
+disk uses. */
+int setDiskBackend(int backend);
+int getDiskBackend(int disk);
+
+/* Flushes everything written to the disk down to the disk file's storage:
+msync() for a mapped disk, fsync() otherwise (after waiting for every
+request a uring disk has in flight). */
+int syncDisk(int disk);
+
+/* Returns the size of an open disk in blocks, or a negative error if the
+disk is not open. The size is recorded by openDisk(), so no system call is
+made. */
+int getDiskSize(int disk);
+
+/* Copies the I/O counters of an open disk into 'stats'. resetDiskStats()
+zeroes them. Both return a negative error if the disk is not open. */
+int getDiskStats(int disk, diskStats* stats);
+int resetDiskStats(int disk);
+
 /* readBlock() reads an entire block of BLOCKSIZE bytes from the open
 disk (identified by 'disk') and copies the result into a local buffer
 (must be at least of BLOCKSIZE bytes). The bNum is a logical block
@@ -40,7 +157,8 @@ translation from logical to physical block is straightforward: bNum=0
 is the very first byte of the file. bNum=1 is BLOCKSIZE bytes into the
 disk, bNum=n is n*BLOCKSIZE bytes into the disk. On success, it returns
 0. -1 or smaller is returned if disk is not available (hasn't been 
-opened) or any other failures. */
+opened), bNum is outside the disk, or any other failures. Blocks are read with positional I/O, so
+one open disk may be read and written from several threads at once. */
 int readBlock(int disk, int bNum, void *block);
 
 /* writeBlock() takes disk number ‘disk’ and logical block number ‘bNum’
@@ -48,7 +166,42 @@ and writes the content of the buffer ‘block’ to that location. ‘block’
 must be integral with BLOCKSIZE. Just as in readBlock(), writeBlock()
 must translate the logical block bNum to the correct byte position in
 the file. On success, it returns 0. -1 or smaller is returned if disk
-is not available (i.e. hasn’t been opened) or any other failures. */
+is not available (i.e. hasn’t been opened), bNum is outside the disk, or
+any other failures. */
 int writeBlock(int disk, int bNum, void *block);
 
-#endif
\ No newline at end of file
+/* readBlocks()/writeBlocks() transfer a whole list of (block number,
+buffer) pairs. Requests are sorted by block number and every run of
+consecutive blocks moves with a single vectored system call (preadv()/
+pwritev(), up to MAX_RUN_BLOCKS blocks each), so callers may pass blocks in any order. If the same block is
+written more than once, the last entry in the list wins. Each entry's
+'status' reports its own result; the return value is TFS_SUCCESS if every
+entry succeeded, otherwise the first failing entry's error. On a uring
+disk every block is instead its own request, with up to DISK_RING_ENTRIES
+of them in flight at once. */
+int readBlocks(int disk, blockIO* ios, int count);
+int writeBlocks(int disk, blockIO* ios, int count);
+
+/* Asynchronous block I/O. submitBlocks() queues every request of the list
+and returns without waiting: each valid entry's status becomes
+DISK_IO_PENDING until the request completes, when it is set like
+readBlocks()/writeBlocks() would set it. The list and its buffers must
+stay untouched until then. Invalid entries fail at once and the return
+value is the first of those errors, or TFS_SUCCESS. Up to
+DISK_RING_ENTRIES requests are in flight per disk, submitting more waits
+for earlier ones to finish. Requests in flight together may complete in
+any order, so do not keep two writes of one block in flight (within one
+list the later write wins, as with writeBlocks()).
+
+pollBlocks() completes whatever the kernel has finished, waiting for at
+least one request if 'wait' is set and any are in flight. It returns how
+many requests the disk still has in flight.
+
+Backends other than DISK_BACKEND_URING complete every request inside
+submitBlocks(), and pollBlocks() always returns 0. readBlock(),
+writeBlock(), readBlocks() and writeBlocks() are synchronous wrappers that
+submit and then wait for their own requests. */
+int submitBlocks(int disk, blockIO* ios, int count, bool writing);
+int pollBlocks(int disk, bool wait);
+
+#endif
@@ -0,0 +1,153 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "libDiskRing.h"
+
+/* ~ HELPER FUNCTIONS ~ */
+
+/* _ring_setup()/_ring_enter(): the raw io_uring system calls
+    > both fail with ENOSYS when the headers predate io_uring */
+static int _ring_setup(unsigned entries, struct io_uring_params* params) {
+#ifdef __NR_io_uring_setup
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int _ring_enter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+#ifdef __NR_io_uring_enter
+    return (int) syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, NULL, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* ^ HELPER FUNCTIONS ^ */
+
+int ringCreate(diskRing* ring, unsigned entries) {
+    memset(ring, 0, sizeof(diskRing));
+    ring->ringFd = -1;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ringFd = _ring_setup(entries, &params);
+    if (ringFd < 0) {
+        return SYS_ERR_OPEN;
+    }
+
+    /* map the submission ring, the completion ring and the submission entries */
+    ring->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqMap = mmap(NULL, ring->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    ring->cqMap = mmap(NULL, ring->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    void* sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (ring->sqMap == MAP_FAILED || ring->cqMap == MAP_FAILED || sqes == MAP_FAILED) {
+        if (ring->sqMap != MAP_FAILED) {
+            munmap(ring->sqMap, ring->sqMapSize);
+        }
+        if (ring->cqMap != MAP_FAILED) {
+            munmap(ring->cqMap, ring->cqMapSize);
+        }
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, ring->sqesSize);
+        }
+        close(ringFd);
+        return SYS_ERR_OPEN;
+    }
+
+    uint8_t* sq = (uint8_t*) ring->sqMap;
+    uint8_t* cq = (uint8_t*) ring->cqMap;
+    ring->ringFd = ringFd;
+    ring->entries = params.sq_entries;
+    ring->sqHead = (unsigned*) (sq + params.sq_off.head);
+    ring->sqTail = (unsigned*) (sq + params.sq_off.tail);
+    ring->sqMask = (unsigned*) (sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned*) (sq + params.sq_off.array);
+    ring->sqes = (struct io_uring_sqe*) sqes;
+    ring->cqHead = (unsigned*) (cq + params.cq_off.head);
+    ring->cqTail = (unsigned*) (cq + params.cq_off.tail);
+    ring->cqMask = (unsigned*) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+    return TFS_SUCCESS;
+}
+
+void ringDestroy(diskRing* ring) {
+    if (ring->ringFd < 0) {
+        return;
+    }
+    munmap(ring->sqes, ring->sqesSize);
+    munmap(ring->cqMap, ring->cqMapSize);
+    munmap(ring->sqMap, ring->sqMapSize);
+    close(ring->ringFd);
+    ring->ringFd = -1;
+}
+
+bool ringQueue(diskRing* ring, int fd, bool writing, struct iovec* iov, off_t offset, uint64_t userData) {
+    unsigned tail = *ring->sqTail;
+    if (tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) >= ring->entries) {
+        return false;
+    }
+
+    unsigned index = tail & *ring->sqMask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = writing ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) iov;
+    sqe->len = 1;
+    sqe->off = (uint64_t) offset;
+    sqe->user_data = userData;
+    ring->sqArray[index] = index;
+
+    /* publish the entry only once it is completely filled in */
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ring->toSubmit++;
+    return true;
+}
+
+bool ringUnqueue(diskRing* ring, uint64_t* userData) {
+    if (ring->toSubmit == 0) {
+        return false;
+    }
+
+    /* the kernel only reads the submission ring inside io_uring_enter(), so an
+        entry it has not been told about can still be withdrawn */
+    unsigned tail = *ring->sqTail - 1;
+    *userData = ring->sqes[ring->sqArray[tail & *ring->sqMask]].user_data;
+    __atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE);
+    ring->toSubmit--;
+    return true;
+}
+
+int ringEnter(diskRing* ring, unsigned minComplete) {
+    unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    while (true) {
+        int submitted = _ring_enter(ring->ringFd, ring->toSubmit, minComplete, flags);
+        if (submitted >= 0) {
+            ring->toSubmit -= (unsigned) submitted;
+            return TFS_SUCCESS;
+        }
+        if (errno != EINTR) {
+            return SYS_ERR_READ;
+        }
+    }
+}
+
+bool ringReap(diskRing* ring, uint64_t* userData, int* result) {
+    unsigned head = *ring->cqHead;
+    if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cqMask];
+    *userData = cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
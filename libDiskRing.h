@@ -0,0 +1,67 @@
+#ifndef LIBDISKRING_H
+#define LIBDISKRING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "tinyFS_errno.h"
+
+/* a minimal io_uring instance, driven with the raw system calls so no
+library is needed. Only what libDisk needs is wrapped: queueing vectored
+reads/writes, handing them to the kernel and reaping their completions. */
+typedef struct diskRing {
+    // File descriptor returned by io_uring_setup(), -1 if not set up
+    int ringFd;
+    // Number of submission queue entries
+    unsigned entries;
+    // Submission queue ring, shared with the kernel
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    struct io_uring_sqe* sqes;
+    // Completion queue ring, shared with the kernel
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+    // Queued entries the kernel has not been told about yet
+    unsigned toSubmit;
+    // The three mappings backing the rings
+    void* sqMap;
+    size_t sqMapSize;
+    void* cqMap;
+    size_t cqMapSize;
+    size_t sqesSize;
+} diskRing;
+
+/* Sets up a ring with room for 'entries' submissions. Returns TFS_SUCCESS,
+or SYS_ERR_OPEN if the kernel has no (usable) io_uring, in which case the
+caller is expected to fall back to ordinary system calls. */
+int ringCreate(diskRing* ring, unsigned entries);
+
+/* Tears the ring down. Requests still in flight are abandoned, so callers
+drain the ring first. */
+void ringDestroy(diskRing* ring);
+
+/* Queues a readv/writev of 'iov' at 'offset' of 'fd'. 'iov' must stay valid
+until the request completes. Nothing reaches the kernel until ringEnter().
+Returns false if the submission queue is full. */
+bool ringQueue(diskRing* ring, int fd, bool writing, struct iovec* iov, off_t offset, uint64_t userData);
+
+/* Takes back the most recently queued request the kernel has not been told
+about yet. Returns false if there is none, else fills in its userData. */
+bool ringUnqueue(diskRing* ring, uint64_t* userData);
+
+/* Hands every queued request to the kernel and, if minComplete > 0, waits
+until at least that many completions are available. One system call.
+Returns TFS_SUCCESS or SYS_ERR_READ if io_uring_enter() fails. */
+int ringEnter(diskRing* ring, unsigned minComplete);
+
+/* Takes one completion off the ring. Returns false if there is none, else
+fills in the request's userData and result (bytes moved or -errno). */
+bool ringReap(diskRing* ring, uint64_t* userData, int* result);
+
+#endif
@@ -4,42 +4,431 @@
 #include <fcntl.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "libDisk.h"
 
+#define TEST_DISK "testFiles/libDiskTest.dsk"
+#define TEST_DISK_BLOCKS 64
+#define NUM_THREADS 4
+
 void testReadBlock();
+void testPositionalIO();
+void testSharedDiskThreads();
+void testDiskTable();
+void testBlockLists();
+void testAsyncIO();
+void testMappedDisk();
+void testSparseCreate();
 
 int main(int argc, char *argv[]) {
-    // Testing libDisk
-    testReadBlock();
+    // Testing libDisk, once through each backend
+    int backends[3] = {DISK_BACKEND_PREAD, DISK_BACKEND_MMAP, DISK_BACKEND_URING};
+    for (int i = 0; i < 3; i++) {
+        assert(setDiskBackend(backends[i]) == 0);
+        testReadBlock();
+        testPositionalIO();
+        testSharedDiskThreads();
+        testDiskTable();
+        testBlockLists();
+        testAsyncIO();
+    }
+    testMappedDisk();
+    testSparseCreate();
 
+    remove(TEST_DISK);
     printf("> libDisk Tests passed.\n");
     return 0;
 }
 
 void testReadBlock()
 {
-    int testFile = open("testFiles/test.dsk", O_RDWR);
-    int compFile = open("testFiles/test.dsk", O_RDWR);
+    // Setting up a disk with a recognisable pattern in the first two blocks
+    int disk = openDisk(TEST_DISK, BLOCKSIZE * TEST_DISK_BLOCKS);
+    assert(disk >= 0);
+    char *pattern = (char *) malloc(sizeof(char) * BLOCKSIZE);
+    memset(pattern, 'a', BLOCKSIZE - 1);
+    pattern[BLOCKSIZE - 1] = '\0';
+    assert(writeBlock(disk, 0, pattern) == 0);
+    memset(pattern, 'b', BLOCKSIZE - 1);
+    assert(writeBlock(disk, 1, pattern) == 0);
+    assert(closeDisk(disk) == 0);
+
+    int testFile = openDisk(TEST_DISK, 0);
+    int compFile = open(TEST_DISK, O_RDWR);
     char *buff = (char *) malloc(sizeof(char) * BLOCKSIZE);
     char *buff2 = (char *) malloc(sizeof(char) * BLOCKSIZE);
 
     read(compFile, buff2, BLOCKSIZE);
     assert(readBlock(testFile, 0, (void *)buff) == 0);
+    assert(strcmp(buff, buff2) == 0);
 
     read(compFile, buff2, BLOCKSIZE);
     assert(readBlock(testFile, 1, (void *)buff) == 0);
 
-    
+
     assert(strcmp(buff, buff2) == 0);
 
     // Checking for bad file number reads
+    assert(readBlock(1, 0, buff) < 0);
+    assert(writeBlock(1, 0, buff) < 0);
 
     // Search reads that are too long or too short
+    assert(readBlock(testFile, TEST_DISK_BLOCKS, buff) < 0);
+    assert(readBlock(testFile, -1, buff) < 0);
+    assert(writeBlock(testFile, TEST_DISK_BLOCKS, buff) < 0);
 
     // Bad pointers
+    assert(readBlock(testFile, 0, NULL) < 0);
+    assert(writeBlock(testFile, 0, NULL) < 0);
+
+    close(compFile);
+    assert(closeDisk(testFile) == 0);
+    free(buff);
+    free(buff2);
+    free(pattern);
+}
+
+void testPositionalIO()
+{
+    int disk = openDisk(TEST_DISK, 0);
+    assert(disk >= 0);
+    char block[BLOCKSIZE];
+    char check[BLOCKSIZE];
+
+    // Blocks written out of order land at their own offsets
+    for (int i = TEST_DISK_BLOCKS - 1; i >= 0; i -= 3) {
+        memset(block, i, BLOCKSIZE);
+        assert(writeBlock(disk, i, block) == 0);
+    }
+    for (int i = TEST_DISK_BLOCKS - 1; i >= 0; i -= 3) {
+        memset(check, i, BLOCKSIZE);
+        assert(readBlock(disk, i, block) == 0);
+        assert(memcmp(block, check, BLOCKSIZE) == 0);
+    }
+
+    // Block I/O must not move the file offset of the handle
+    assert(lseek(disk, 17, SEEK_SET) == 17);
+    assert(readBlock(disk, 5, block) == 0);
+    assert(writeBlock(disk, 5, block) == 0);
+    assert(lseek(disk, 0, SEEK_CUR) == 17);
+
+    assert(closeDisk(disk) == 0);
+}
+
+typedef struct diskWorker {
+    int disk;
+    int id;
+    int failures;
+} diskWorker;
+
+/* each worker owns every NUM_THREADS'th block and hammers it through the shared handle */
+void* diskWorkerRun(void *arg)
+{
+    diskWorker *worker = (diskWorker *) arg;
+    char block[BLOCKSIZE];
+    char check[BLOCKSIZE];
+    for (int round = 0; round < 50; round++) {
+        for (int b = worker->id; b < TEST_DISK_BLOCKS; b += NUM_THREADS) {
+            memset(block, (b + round) & 0xFF, BLOCKSIZE);
+            if (writeBlock(worker->disk, b, block) != 0) {
+                worker->failures++;
+            }
+        }
+        for (int b = worker->id; b < TEST_DISK_BLOCKS; b += NUM_THREADS) {
+            memset(check, (b + round) & 0xFF, BLOCKSIZE);
+            if (readBlock(worker->disk, b, block) != 0 || memcmp(block, check, BLOCKSIZE) != 0) {
+                worker->failures++;
+            }
+        }
+    }
+    return NULL;
+}
+
+void testSharedDiskThreads()
+{
+    int disk = openDisk(TEST_DISK, 0);
+    assert(disk >= 0);
+
+    pthread_t threads[NUM_THREADS];
+    diskWorker workers[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+        workers[i].disk = disk;
+        workers[i].id = i;
+        workers[i].failures = 0;
+        assert(pthread_create(&threads[i], NULL, diskWorkerRun, &workers[i]) == 0);
+    }
+    for (int i = 0; i < NUM_THREADS; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+        assert(workers[i].failures == 0);
+    }
+
+    assert(closeDisk(disk) == 0);
+}
+
+void testDiskTable()
+{
+    // Geometry is recorded at open time, both for new and existing disks
+    int disk = openDisk(TEST_DISK, BLOCKSIZE * TEST_DISK_BLOCKS + 100);
+    assert(disk >= 0);
+    assert(getDiskSize(disk) == TEST_DISK_BLOCKS);
+    assert(closeDisk(disk) == 0);
+    assert(getDiskSize(disk) == ERR_INVALID_DISK_FD);
+
+    disk = openDisk(TEST_DISK, 0);
+    assert(disk >= 0);
+    assert(getDiskSize(disk) == TEST_DISK_BLOCKS);
+
+    // Statistics count blocks and system calls
+    char block[BLOCKSIZE];
+    diskStats stats;
+    memset(block, 'z', BLOCKSIZE);
+    assert(resetDiskStats(disk) == 0);
+    for (int i = 0; i < 10; i++) {
+        assert(writeBlock(disk, i, block) == 0);
+    }
+    for (int i = 0; i < 5; i++) {
+        assert(readBlock(disk, i, block) == 0);
+    }
+    assert(getDiskStats(disk, &stats) == 0);
+    assert(stats.blocksWritten == 10);
+    assert(stats.blocksRead == 5);
+    // mapped disks move blocks without any system calls, uring disks with one io_uring_enter() each
+    int calls = getDiskBackend(disk) == DISK_BACKEND_PREAD ? 1 : 0;
+    int ringCalls = getDiskBackend(disk) == DISK_BACKEND_URING ? 1 : 0;
+    assert(stats.writeCalls == 10 * calls);
+    assert(stats.readCalls == 5 * calls);
+    assert(stats.ringCalls == 15 * ringCalls);
+    assert(getDiskStats(disk, NULL) < 0);
+
+    // Out of range blocks are refused without touching the disk file
+    assert(readBlock(disk, TEST_DISK_BLOCKS, block) == ERR_INVALID_INPUT);
+    assert(writeBlock(disk, TEST_DISK_BLOCKS, block) == ERR_INVALID_INPUT);
+    assert(getDiskStats(disk, &stats) == 0);
+    assert(stats.readCalls == 5 * calls && stats.writeCalls == 10 * calls);
+
+    // A raw descriptor that did not come from openDisk() is not a disk
+    int raw = open(TEST_DISK, O_RDWR);
+    assert(readBlock(raw, 0, block) == ERR_INVALID_DISK_FD);
+    assert(writeBlock(raw, 0, block) == ERR_INVALID_DISK_FD);
+    assert(closeDisk(raw) == ERR_INVALID_DISK_FD);
+    close(raw);
+
+    assert(closeDisk(disk) == 0);
+    assert(closeDisk(disk) == ERR_INVALID_DISK_FD);
+}
+
+void testBlockLists()
+{
+    int disk = openDisk(TEST_DISK, 0);
+    assert(disk >= 0);
+    int calls = getDiskBackend(disk) == DISK_BACKEND_PREAD ? 1 : 0;
+    char blocks[8][BLOCKSIZE];
+    char check[BLOCKSIZE];
+    blockIO ios[8];
+    diskStats stats;
+
+    // An unordered list of two runs (10-13 and 20-23) takes one call per run
+    int order[8] = {12, 21, 10, 23, 13, 20, 11, 22};
+    for (int i = 0; i < 8; i++) {
+        memset(blocks[i], 'A' + i, BLOCKSIZE);
+        ios[i].bNum = order[i];
+        ios[i].block = blocks[i];
+    }
+    assert(resetDiskStats(disk) == 0);
+    assert(writeBlocks(disk, ios, 8) == 0);
+    assert(getDiskStats(disk, &stats) == 0);
+    assert(stats.blocksWritten == 8 && stats.writeCalls == 2 * calls);
+    for (int i = 0; i < 8; i++) {
+        assert(ios[i].status == 0);
+        memset(check, 'A' + i, BLOCKSIZE);
+        assert(readBlock(disk, order[i], blocks[0]) == 0);
+        assert(memcmp(blocks[0], check, BLOCKSIZE) == 0);
+    }
+
+    // Reading them back fills each buffer of the list in place
+    for (int i = 0; i < 8; i++) {
+        ios[i].bNum = order[7 - i];
+        ios[i].block = blocks[i];
+    }
+    assert(resetDiskStats(disk) == 0);
+    assert(readBlocks(disk, ios, 8) == 0);
+    assert(getDiskStats(disk, &stats) == 0);
+    assert(stats.blocksRead == 8 && stats.readCalls == 2 * calls);
+    for (int i = 0; i < 8; i++) {
+        memset(check, 'A' + (7 - i), BLOCKSIZE);
+        assert(memcmp(blocks[i], check, BLOCKSIZE) == 0);
+    }
+
+    // Bad entries fail on their own, the rest of the list still goes through
+    memset(blocks[0], 'x', BLOCKSIZE);
+    memset(blocks[1], 'y', BLOCKSIZE);
+    ios[0].bNum = 30;               ios[0].block = blocks[0];
+    ios[1].bNum = TEST_DISK_BLOCKS; ios[1].block = blocks[1];
+    ios[2].bNum = 31;               ios[2].block = NULL;
+    assert(writeBlocks(disk, ios, 3) == ERR_INVALID_INPUT);
+    assert(ios[0].status == 0);
+    assert(ios[1].status == ERR_INVALID_INPUT && ios[2].status == ERR_INVALID_INPUT);
+    assert(readBlock(disk, 30, check) == 0);
+    assert(memcmp(blocks[0], check, BLOCKSIZE) == 0);
+
+    // When a block is listed twice the later entry wins
+    ios[0].bNum = 32; ios[0].block = blocks[0];
+    ios[1].bNum = 32; ios[1].block = blocks[1];
+    assert(writeBlocks(disk, ios, 2) == 0);
+    assert(readBlock(disk, 32, check) == 0);
+    assert(memcmp(blocks[1], check, BLOCKSIZE) == 0);
+
+    // Empty lists are fine, missing lists are not
+    assert(readBlocks(disk, ios, 0) == 0);
+    assert(writeBlocks(disk, NULL, 1) == ERR_INVALID_INPUT);
+    assert(readBlocks(1, ios, 1) == ERR_INVALID_DISK_FD);
+
+    assert(closeDisk(disk) == 0);
+}
+
+void testAsyncIO()
+{
+    int disk = openDisk(TEST_DISK, 0);
+    assert(disk >= 0);
+    char (*blocks)[BLOCKSIZE] = malloc(TEST_DISK_BLOCKS * BLOCKSIZE);
+    char check[BLOCKSIZE];
+    blockIO ios[TEST_DISK_BLOCKS + 1];
+
+    // Every block of the disk goes in flight at once, plus one bad request
+    for (int i = 0; i < TEST_DISK_BLOCKS; i++) {
+        memset(blocks[i], 0x80 + i, BLOCKSIZE);
+        ios[i].bNum = i;
+        ios[i].block = blocks[i];
+    }
+    ios[TEST_DISK_BLOCKS].bNum = -3;
+    ios[TEST_DISK_BLOCKS].block = blocks[0];
+    assert(submitBlocks(disk, ios, TEST_DISK_BLOCKS + 1, true) == ERR_INVALID_INPUT);
+    assert(ios[TEST_DISK_BLOCKS].status == ERR_INVALID_INPUT);
+    int in_flight;
+    while ((in_flight = pollBlocks(disk, true)) > 0) {
+        assert(in_flight <= DISK_RING_ENTRIES);
+    }
+    assert(in_flight == 0);
+    for (int i = 0; i < TEST_DISK_BLOCKS; i++) {
+        assert(ios[i].status == 0);
+    }
+
+    // Reading them back asynchronously, in reverse order
+    for (int i = 0; i < TEST_DISK_BLOCKS; i++) {
+        ios[i].bNum = TEST_DISK_BLOCKS - 1 - i;
+        memset(blocks[i], 0, BLOCKSIZE);
+    }
+    assert(submitBlocks(disk, ios, TEST_DISK_BLOCKS, false) == 0);
+    while (pollBlocks(disk, true) > 0);
+    for (int i = 0; i < TEST_DISK_BLOCKS; i++) {
+        assert(ios[i].status == 0);
+        memset(check, 0x80 + (TEST_DISK_BLOCKS - 1 - i), BLOCKSIZE);
+        assert(memcmp(blocks[i], check, BLOCKSIZE) == 0);
+    }
 
-    // Bad lseek
+    // Closing the disk waits for whatever is still in flight
+    memset(blocks[0], 'q', BLOCKSIZE);
+    ios[0].bNum = 3;
+    assert(submitBlocks(disk, ios, 1, true) == 0);
+    assert(closeDisk(disk) == 0);
+    disk = openDisk(TEST_DISK, 0);
+    assert(readBlock(disk, 3, check) == 0);
+    assert(memcmp(blocks[0], check, BLOCKSIZE) == 0);
 
-    // Bad read
-}
\ No newline at end of file
+    assert(pollBlocks(disk, false) == 0);
+    assert(submitBlocks(disk, NULL, 1, false) == ERR_INVALID_INPUT);
+    assert(pollBlocks(1, true) == ERR_INVALID_DISK_FD);
+
+    // A request the kernel was never handed can be taken back, and then never runs
+    diskRing ring;
+    if (ringCreate(&ring, 4) == 0) {
+        uint64_t slot;
+        int result;
+        struct iovec iov = { blocks[0], BLOCKSIZE };
+        memset(blocks[0], 'u', BLOCKSIZE);
+        memset(check, 'u', BLOCKSIZE);
+        assert(ringQueue(&ring, disk, false, &iov, 3 * BLOCKSIZE, 7));
+        assert(ringUnqueue(&ring, &slot) && slot == 7);
+        assert(!ringUnqueue(&ring, &slot));
+        assert(ringEnter(&ring, 0) == 0);
+        assert(!ringReap(&ring, &slot, &result));
+        assert(memcmp(blocks[0], check, BLOCKSIZE) == 0);
+        ringDestroy(&ring);
+    }
+    assert(closeDisk(disk) == 0);
+    free(blocks);
+}
+
+void testMappedDisk()
+{
+    assert(setDiskBackend(42) == ERR_INVALID_INPUT);
+    assert(setDiskBackend(-1) == ERR_INVALID_INPUT);
+    assert(setDiskBackend(DISK_BACKEND_MMAP) == 0);
+
+    int disk = openDisk(TEST_DISK, BLOCKSIZE * TEST_DISK_BLOCKS);
+    assert(disk >= 0);
+    assert(getDiskBackend(disk) == DISK_BACKEND_MMAP);
+
+    // Writes through the mapping are visible to ordinary reads of the file
+    char block[BLOCKSIZE];
+    char check[BLOCKSIZE];
+    memset(block, 'm', BLOCKSIZE);
+    assert(writeBlock(disk, 7, block) == 0);
+    assert(syncDisk(disk) == 0);
+    int raw = open(TEST_DISK, O_RDONLY);
+    assert(pread(raw, check, BLOCKSIZE, 7 * BLOCKSIZE) == BLOCKSIZE);
+    assert(memcmp(block, check, BLOCKSIZE) == 0);
+
+    // And ordinary writes to the file are visible through the mapping
+    memset(check, 'w', BLOCKSIZE);
+    int rawWrite = open(TEST_DISK, O_WRONLY);
+    assert(pwrite(rawWrite, check, BLOCKSIZE, 9 * BLOCKSIZE) == BLOCKSIZE);
+    close(rawWrite);
+    assert(readBlock(disk, 9, block) == 0);
+    assert(memcmp(block, check, BLOCKSIZE) == 0);
+    assert(closeDisk(disk) == 0);
+
+    // The data survives closing and reopening with the other backend
+    assert(setDiskBackend(DISK_BACKEND_PREAD) == 0);
+    disk = openDisk(TEST_DISK, 0);
+    assert(getDiskBackend(disk) == DISK_BACKEND_PREAD);
+    memset(check, 'm', BLOCKSIZE);
+    assert(readBlock(disk, 7, block) == 0);
+    assert(memcmp(block, check, BLOCKSIZE) == 0);
+    assert(syncDisk(disk) == 0);
+    assert(closeDisk(disk) == 0);
+    assert(syncDisk(disk) == ERR_INVALID_DISK_FD);
+    close(raw);
+}
+
+void testSparseCreate()
+{
+    // A big new disk is a hole: nothing is written and reads see zeros
+    int size = BLOCKSIZE * 65536;
+    int disk = openDisk(TEST_DISK, size);
+    assert(disk >= 0);
+    struct stat file_stat;
+    assert(stat(TEST_DISK, &file_stat) == 0);
+    assert(file_stat.st_size == size);
+    assert(file_stat.st_blocks * 512 < size / 2);
+
+    char block[BLOCKSIZE];
+    char zeros[BLOCKSIZE];
+    memset(zeros, 0, BLOCKSIZE);
+    assert(readBlock(disk, 65535, block) == 0);
+    assert(memcmp(block, zeros, BLOCKSIZE) == 0);
+    assert(closeDisk(disk) == 0);
+
+    // Recreating a disk over an old one still hands back zeros
+    disk = openDisk(TEST_DISK, BLOCKSIZE * TEST_DISK_BLOCKS);
+    assert(disk >= 0);
+    memset(block, 'd', BLOCKSIZE);
+    assert(writeBlock(disk, 1, block) == 0);
+    assert(closeDisk(disk) == 0);
+    disk = openDisk(TEST_DISK, BLOCKSIZE * TEST_DISK_BLOCKS);
+    assert(getDiskSize(disk) == TEST_DISK_BLOCKS);
+    assert(readBlock(disk, 1, block) == 0);
+    assert(memcmp(block, zeros, BLOCKSIZE) == 0);
+    assert(closeDisk(disk) == 0);
+}
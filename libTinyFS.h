@@ -10,6 +10,11 @@
 typedef int fileDescriptor;
 #endif
 
+#ifndef DD_H_TD
+#define DD_H_TD
+typedef int dirDescriptor;
+#endif
+
 /* Makes a blank TinyFS file system of size nBytes on the unix file
 specified by ‘filename’. This function should use the emulated disk
 library to open the specified unix file, and upon success, format the
@@ -18,6 +23,48 @@ setting magic numbers, initializing and writing the superblock and
 inodes, etc. Must return a specified success/error code. */
 int tfs_mkfs(char *filename, int nBytes);
 
+/* Same as tfs_mkfs(), with TFS_FEAT_* flags choosing format options.
+TFS_FEAT_BITMAP tracks free space in bitmap blocks after the superblock
+instead of a list threaded through the free blocks: only the superblock
+and the bitmap are written, allocation and freeing work on an in-memory
+copy loaded at mount, and changed bitmap blocks are written back lazily
+(on tfs_sync() and tfs_unmount()). TFS_FEAT_ADDR32 (only together with
+TFS_FEAT_BITMAP) makes every block pointer 4 bytes instead of 1, lifting
+the MAX_BLOCKS (64 KiB) limit up to MAX_BLOCKS_ADDR32 blocks, at the cost
+of a quarter as many pointers per superblock, directory and file inode.
+TFS_FEAT_INDIRECT turns the last INDIRECT_LEVELS pointers of every file
+inode into single, double and triple indirect pointers, so a file is no
+longer limited to the direct pointers of its inode (with 4 byte pointers
+it may reach about 64 MB). TFS_FEAT_EXTENTS (not together with
+TFS_FEAT_INDIRECT) maps file data as extents instead, (first file block,
+first disk block, length) for every run of consecutive blocks: a file
+written into unfragmented space takes one extent in its inode however
+large it is, and a file split into more runs than the inode holds moves
+them out to EXTENT blocks, the inode keeping one extent per EXTENT block.
+Looking up a block is a binary search of at most two tables. Data is
+always allocated as TFS_ALLOC_EXTENT, and a write that still needs more
+extents than an inode can reach fails with ERR_DISK_OUT_OF_SPACE, leaving
+the file as it was on a bitmap disk. TFS_FEAT_INLINE keeps a file of
+1 to MAX_INLINE_DATA bytes in its inode, in place of its pointer table,
+so it takes no data block and reading it touches only the inode; a write
+past that size moves it to data blocks (and a smaller one back).
+TFS_FEAT_DIRENTS stores each directory entry as (inode, type, name) rather
+than the bare inode pointer, so looking up a path or listing a directory
+reads the directory blocks only, never the inodes of the entries passed
+over; an entry takes 10 (13 with TFS_FEAT_ADDR32) bytes instead of 1 (4),
+so fewer fit in the superblock and each directory inode.
+TFS_FEAT_DIRINDEX (which needs TFS_FEAT_DIRENTS) lets a directory that
+fills its inode move its entries to leaf blocks indexed by name hash, so it
+grows past one inode and a lookup in it reads one block per index level
+plus a leaf rather than every entry.
+TFS_FEAT_ROOTDIR moves the root directory out of the superblock, which
+then only points at it, into a directory inode of its own. With
+TFS_FEAT_DIRINDEX that lets the root grow past the superblock's entries
+like any other directory; without it the root is one flat inode.
+Disks of any format mount. tfs_mkfs() is tfs_mkfsFormat() with no
+flags. */
+int tfs_mkfsFormat(char *filename, off_t nBytes, int features);
+
 /* tfs_mount(char *diskname) “mounts” a TinyFS file system located within
 ‘diskname’. tfs_unmount(void) “unmounts” the currently mounted file
 system. As part of the mount operation, tfs_mount should verify the file
@@ -30,10 +77,15 @@ int tfs_unmount(void);
 /* Creates or Opens a file for reading and writing on the currently
 mounted file system. Creates a dynamic resource table entry for the file,
 and returns a file descriptor (integer) that can be used to reference
-this entry while the filesystem is mounted. */
+this entry while the filesystem is mounted. The entry keeps a copy of
+the file's inode and its own file pointer (starting at 0), so opening the
+same file twice gives two independent pointers. Creating a file in a
+directory with no room left fails with ERR_DIR_FULL. */
 fileDescriptor tfs_openFile(char *name);
 
-/* Closes the file, de-allocates all system resources, and removes table entry */
+/* Closes the file, writing back the changes the descriptor made to its
+inode copy (access time), de-allocates all system resources, and removes
+table entry */
 int tfs_closeFile(fileDescriptor FD);
 
 /* Writes buffer ‘buffer’ of size ‘size’ BYTES, which represents an entire
@@ -42,6 +94,33 @@ completely lost. Sets the file pointer to 0 (the start of file) when
 done. Returns success/error codes. */
 int tfs_writeFile(fileDescriptor FD,char *buffer, int size);
 
+/* writes size bytes of buffer into the file at offset, which may be at
+most the file's size (files have no holes). Only the data blocks the
+bytes land in are written, new blocks are only taken when the file
+grows, and the size and modified time are updated once. Returns size,
+or an error with the file left as it was. The file pointer stays where
+it is. */
+int tfs_pwrite(fileDescriptor FD, char *buffer, int size, int offset);
+
+/* tfs_pwrite() at the end of the file */
+int tfs_append(fileDescriptor FD, char *buffer, int size);
+
+/* A write stream replaces a file's contents without the caller holding them
+all at once. tfs_openStream() starts one on FD, tfs_writeStream() pushes
+the next size bytes (any size, returns size) and tfs_commitStream() makes
+them the file's contents, with the size and block map published in one
+inode write and the old blocks given back; the file pointer goes to 0.
+Data blocks are written as they fill, so only one partly filled block is
+held in memory, but the old contents stay until the commit, so the disk
+needs room for both. tfs_abortStream(), tfs_closeFile(), deleting the
+file and tfs_unmount() drop an uncommitted stream and its blocks. Errors
+are ERR_STREAM_OPEN for a second stream on one FD, ERR_NO_STREAM when
+there is none. */
+int tfs_openStream(fileDescriptor FD);
+int tfs_writeStream(fileDescriptor FD, char *buffer, int size);
+int tfs_commitStream(fileDescriptor FD);
+int tfs_abortStream(fileDescriptor FD);
+
 /* deletes a file and marks its blocks as free on disk. */
 int tfs_deleteFile(fileDescriptor FD);
 
@@ -52,9 +131,21 @@ tfs_readByte() should return an error and not increment the file pointer. */
 int tfs_readByte(fileDescriptor FD, char *buffer);
 
 /* change the file pointer location to offset (absolute). Returns
-success/error codes.*/
+success/error codes. The pointer lives in the descriptor, not on the disk.*/
 int tfs_seek(fileDescriptor FD, int offset);
 
+/* reads up to size bytes from the current file pointer into buffer and
+moves the pointer past them. Returns how many bytes were read, fewer than
+size (0 at the end) when the file ends first. Whole blocks are copied at
+a time and consecutive blocks are read from the disk together, so this is
+far cheaper than size calls to tfs_readByte(). */
+int tfs_read(fileDescriptor FD, char *buffer, int size);
+
+/* same as tfs_read(), but reads from offset and leaves the file pointer
+where it is. Errors (ERR_FILE_PNTR_OUT_OF_BOUNDS) if offset is past the
+end of the file. */
+int tfs_pread(fileDescriptor FD, char *buffer, int size, int offset);
+
 
 /* EXTRA FEATURES */
 
@@ -66,9 +157,28 @@ int tfs_rename(fileDescriptor FD, char* newName);
 /* lists all the files and directories on the disk, print the list to stdout */
 int tfs_readdir();
 
+/* opens the directory dirName (“/” for the root) for reading its entries, and
+returns a directory descriptor. The entries are listed here, reading each block
+of the directory once; later changes to the directory are not seen until it is
+opened again. (ERR_DIR_NOT_FOUND, ERR_NOT_A_DIR, ERR_OUT_OF_DDS) */
+dirDescriptor tfs_opendir(char* dirName);
+
+/* copies the next entry of an open directory (name, type, inode and size) to
+entry. Returns 1, or 0 once every entry was read. */
+int tfs_readdirEntry(dirDescriptor DD, dirEntry* entry);
+
+/* copies up to max of the next entries of an open directory to entries, reading
+the inodes of the files among them in batches for their sizes. Returns how many
+were copied, 0 once every entry was read. */
+int tfs_readdirEntries(dirDescriptor DD, dirEntry* entries, int max);
+
+/* closes an open directory, freeing its descriptor (ERR_INVALID_DD if it is not open) */
+int tfs_closedir(dirDescriptor DD);
+
 /* (C) hierarchical directories */
 
-/* creates a directory, name could contain a “/”-delimited path) */
+/* creates a directory, name could contain a “/”-delimited path)
+(ERR_DIR_FULL if its parent has no room left) */
 int tfs_createDir(char* dirName);
 
 /* deletes empty directory */
@@ -84,4 +194,52 @@ int tfs_removeAll(char* dirName);
 // tfs_readFileInfo(fileDescriptor FD) returens the file's timestamps
 int tfs_readFileInfo(fileDescriptor FD);
 
+/* block cache */
+
+/* Every block the mounted file system reads or writes goes through a
+write-back cache of DEFAULT_CACHE_BLOCKS blocks. Changes reach the disk
+when the cache evicts them, on tfs_sync(), and on tfs_unmount(). */
+
+/* writes every changed block in the cache back to the disk, then flushes
+the disk file (msync() or fsync(), depending on the libDisk backend) */
+int tfs_sync();
+
+/* sets the cache capacity in blocks, taking effect at the next tfs_mount() */
+int tfs_setCacheSize(int blocks);
+
+/* copies the cache's hit/miss/eviction/write-back counters into 'stats' */
+int tfs_getCacheStats(cacheStats* stats);
+
+/* free space */
+
+/* returns how many blocks of the mounted tfs are free, without reading any
+block. Bitmap disks count their bitmap, free-list disks answer from a count
+taken when the disk was mounted and kept up to date since. */
+int tfs_freeBlocks();
+
+/* chooses how tfs_writeFile() picks the blocks for a file's data.
+TFS_ALLOC_FIRST_FREE (the default) takes the next free blocks one by one.
+TFS_ALLOC_EXTENT reserves all of them at once as the fewest runs of
+consecutive blocks, ideally one, so the file reads back sequentially;
+free-list disks cannot search for runs and keep taking the next free
+blocks. Either way a write that cannot fit fails with
+ERR_DISK_OUT_OF_SPACE before any block changes. */
+int tfs_setAllocPolicy(int policy);
+
+/* chooses when opening or reading a file updates its access time, taking
+effect at the next tfs_mount(). TFS_ATIME_STRICT (the default) stamps
+every open and read, so each one ends in an inode write.
+TFS_ATIME_RELATIME only stamps an access time that is not newer than the
+modified time or is a day old. TFS_ATIME_NOATIME never does, and
+TFS_ATIME_LAZY stamps the open file in memory only, so the time reaches
+the disk if the inode is written for another reason (a write, a rename)
+and is lost otherwise. With the last three, reading files that do not
+change writes no metadata. */
+int tfs_setAtimePolicy(int policy);
+
+/* fills 'stats' with how many extents (runs of consecutive blocks) the
+files of the mounted tfs are split into, and how many runs its free space
+is split into. extents == files means no file is fragmented. */
+int tfs_getFragStats(fragStats* stats);
+
 #endif
\ No newline at end of file
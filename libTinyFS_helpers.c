@@ -1,51 +1,1398 @@
 #include "libTinyFS_helpers.h"
 
-int ERR;
-tinyFS* mounted;
-uint8_t fd_table[FD_TABLESIZE];
-int fd_table_index; 
-
 /* ~ HELPER FUNCTIONS ~ */
 
+/* _get_ptr()/_set_ptr(): read or write the index'th block pointer of the table at 'table'
+    + pointers are ptr_size bytes (PTR_SIZE()), wider ones big-endian like the file size */
+uint32_t _get_ptr(const uint8_t* table, int index, int ptr_size) {
+    const uint8_t* p = table + index * ptr_size;
+    if (ptr_size == 1) {
+        return p[0];
+    }
+    return ((uint32_t) p[0] << 24) + ((uint32_t) p[1] << 16) + ((uint32_t) p[2] << 8) + p[3];
+}
+
+void _set_ptr(uint8_t* table, int index, int ptr_size, uint32_t value) {
+    uint8_t* p = table + index * ptr_size;
+    if (ptr_size == 1) {
+        p[0] = value & 0xFF;
+        return;
+    }
+    p[0] = (value >> 24) & 0xFF;
+    p[1] = (value >> 16) & 0xFF;
+    p[2] = (value >> 8) & 0xFF;
+    p[3] = value & 0xFF;
+}
+
+/* _dir_slots(): where the entries of the given directory block start
+    (the superblock for the root) in 'loc', and how many entries it holds */
+int _dir_slots(int block, int* loc) {
+    *loc = block == SUPERBLOCK_DISKLOC ? FIRST_SUPBLOCK_INODE_LOC : DIR_DATA_LOC;
+    return (block == SUPERBLOCK_DISKLOC ? MAX_SUPBLOCK_INODES : MAX_DIR_INODES) / DIRENT_SIZE(mounted->features);
+}
+
+/* _dirent_inode(): the inode of the index'th entry of a directory's entries, 0 if it is empty */
+uint32_t _dirent_inode(const uint8_t* table, int index, int features) {
+    return _get_ptr(table + index * DIRENT_SIZE(features) + DIRENT_INODE, 0, PTR_SIZE(features));
+}
+
+/* _dirent_read(): the name (FILENAME_LENGTH + 1 bytes) and type of the index'th entry
+    + TFS_FEAT_DIRENTS disks hold them in the entry, others in the child's inode
+    > returns the child's inode, 0 (and nothing filled in) for an empty entry */
+int _dirent_read(const uint8_t* table, int index, char* name, int* type) {
+    int features = mounted->features;
+    uint32_t inode_num = _dirent_inode(table, index, features);
+    if (inode_num == 0) {
+        return 0;
+    }
+
+    if (features & TFS_FEAT_DIRENTS) {
+        const uint8_t* entry = table + index * DIRENT_SIZE(features);
+        memcpy(name, entry + DIRENT_NAME(features), FILENAME_LENGTH);
+        name[FILENAME_LENGTH] = '\0';
+        *type = entry[DIRENT_TYPE(features)];
+        return inode_num;
+    }
+    uint8_t inode[BLOCKSIZE];
+    if ((ERR = cacheReadBlock(mounted->cache, inode_num, inode)) < 0) {
+        return ERR;
+    }
+    memcpy(name, inode + FILE_NAME_LOC, FILENAME_LENGTH + 1);
+    *type = inode[FILE_TYPE_FLAG_LOC];
+    return inode_num;
+}
+
+/* _set_dirent(): point the index'th entry of a directory's entries at an inode, 0 to empty it
+    + the type and name are only kept on TFS_FEAT_DIRENTS disks */
+void _set_dirent(uint8_t* table, int index, uint32_t inode_num, int type, const char* name) {
+    int features = mounted->features;
+    uint8_t* entry = table + index * DIRENT_SIZE(features);
+    memset(entry, 0, DIRENT_SIZE(features));
+    _set_ptr(entry + DIRENT_INODE, 0, PTR_SIZE(features), inode_num);
+    if ((features & TFS_FEAT_DIRENTS) && inode_num != 0) {
+        entry[DIRENT_TYPE(features)] = type;
+        strncpy((char*) entry + DIRENT_NAME(features), name, FILENAME_LENGTH);
+    }
+}
+
+/* _dir_hash(): the hash a TFS_FEAT_DIRINDEX directory files a name under (FNV-1a) */
+static uint32_t _dir_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < FILENAME_LENGTH && name[i] != '\0'; i++) {
+        hash = (hash ^ (uint8_t) name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* _dir_indexed(): whether the given directory block (the superblock for the root) holds an index */
+static bool _dir_indexed(int dir, const uint8_t* block) {
+    return dir != SUPERBLOCK_DISKLOC && (mounted->features & TFS_FEAT_DIRINDEX) && block[FILE_MAP_LOC] == DIR_MAP_INDEX;
+}
+
+/* _index_table(): where the (hash, block) pairs of a directory inode (node 0 of a path)
+    or of a DIRINDEX block start, and how many fit there */
+static uint8_t* _index_table(uint8_t* node, bool is_inode, int* capacity, int features) {
+    *capacity = (is_inode ? MAX_DIR_INDEX : MAX_DIRINDEX_BYTES) / DIRINDEX_ENTRY_SIZE(features);
+    return node + (is_inode ? DIR_INDEX_LOC : FIRST_DIRINDEX_LOC);
+}
+
+/* _index_hash()/_index_ptr()/_set_index(): one pair of a table of index pairs */
+static uint32_t _index_hash(const uint8_t* table, int index, int features) {
+    return _get_ptr(table + index * DIRINDEX_ENTRY_SIZE(features) + DIRINDEX_HASH, 0, 4);
+}
+
+static uint32_t _index_ptr(const uint8_t* table, int index, int features) {
+    return _get_ptr(table + index * DIRINDEX_ENTRY_SIZE(features) + DIRINDEX_PTR, 0, PTR_SIZE(features));
+}
+
+static void _set_index(uint8_t* table, int index, uint32_t hash, uint32_t block, int features) {
+    _set_ptr(table + index * DIRINDEX_ENTRY_SIZE(features) + DIRINDEX_HASH, 0, 4, hash);
+    _set_ptr(table + index * DIRINDEX_ENTRY_SIZE(features) + DIRINDEX_PTR, 0, PTR_SIZE(features), block);
+}
+
+/* _index_count(): how many pairs a table holds, they are packed from the start */
+static int _index_count(const uint8_t* table, int capacity, int features) {
+    int count = 0;
+    while (count < capacity && _index_ptr(table, count, features) != 0) {
+        count++;
+    }
+    return count;
+}
+
+/* _index_find(): binary search a table of 'count' pairs for the last one whose hash is at most 'hash'
+    (the first pair's hash is 0, so there always is one) */
+static int _index_find(const uint8_t* table, int count, uint32_t hash, int features) {
+    int low = 0;
+    int high = count - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (_index_hash(table, mid, features) <= hash) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+/* _init_dir_block(): start a DIRINDEX or DIRLEAF block, without any pairs or entries */
+static void _init_dir_block(uint8_t* block, int block_type, int level) {
+    memset(block, 0, BLOCKSIZE);
+    block[BLOCK_TYPE_LOC] = block_type;
+    block[SAFETY_BYTE_LOC] = SAFETY_HEX;
+    block[DIRINDEX_LEVEL_LOC] = block_type == DIRINDEX ? level : EMPTY_TABLEVAL;
+}
+
+/* one block on the way from a directory inode down to a leaf of its index */
+typedef struct dirNode {
+    uint32_t block;
+    uint8_t data[BLOCKSIZE];
+    // Which pair of the node was followed down (unused for the leaf)
+    int slot;
+} dirNode;
+
+/* _dir_descend(): follow the index of the directory inode in path[0] down to the leaf for 'hash'
+    + path[1] to path[levels] are the DIRINDEX blocks passed, reading one block per level
+    > returns where in the path the leaf is (levels + 1)
+    - errors if the index leads anywhere but a block of the expected type and level */
+static int _dir_descend(dirNode* path, uint32_t hash) {
+    int features = mounted->features;
+    int levels = path[0].data[DIR_INDEX_LEVELS_LOC];
+    if (levels > DIR_INDEX_MAX_LEVELS) {
+        return ERR_BAD_DISK;
+    }
+    for (int k = 0; k <= levels; k++) {
+        int capacity;
+        uint8_t* table = _index_table(path[k].data, k == 0, &capacity, features);
+        int count = _index_count(table, capacity, features);
+        if (count == 0) {
+            return ERR_BAD_DISK;
+        }
+        path[k].slot = _index_find(table, count, hash, features);
+        path[k + 1].block = _index_ptr(table, path[k].slot, features);
+        if ((ERR = cacheReadBlock(mounted->cache, path[k + 1].block, path[k + 1].data)) < 0) {
+            return ERR;
+        }
+        uint8_t* next = path[k + 1].data;
+        int expected = k < levels ? DIRINDEX : DIRLEAF;
+        if (next[BLOCK_TYPE_LOC] != expected || (expected == DIRINDEX && next[DIRINDEX_LEVEL_LOC] != levels - k - 1)) {
+            return ERR_BAD_DISK;
+        }
+    }
+    return levels + 1;
+}
+
+/* _dir_entries(): where the entries of the directory block (the superblock for the root,
+    a flat directory inode, or a leaf) at path[depth] start, and how many it holds */
+static uint8_t* _dir_entries(dirNode* path, int depth, int* range) {
+    if (depth > 0) {
+        *range = MAX_DIRLEAF_BYTES / DIRENT_SIZE(mounted->features);
+        return path[depth].data + FIRST_DIRLEAF_LOC;
+    }
+    int start_bound;
+    *range = _dir_slots(path[0].block, &start_bound);
+    return path[0].data + start_bound;
+}
+
+/* _dir_find(): read the directory and the block its entry for 'name' belongs in into 'path'
+    > returns where in the path that block is (0 for a flat directory) */
+static int _dir_find(int dir, const char* name, dirNode* path) {
+    path[0].block = dir;
+    if ((ERR = cacheReadBlock(mounted->cache, dir, path[0].data)) < 0) {
+        return ERR;
+    }
+    return _dir_indexed(dir, path[0].data) ? _dir_descend(path, _dir_hash(name)) : 0;
+}
+
+/* _dir_lookup(): look up 'name' in the given directory (the superblock for the root),
+    filling in its type if found
+    + a flat directory is scanned, an indexed one only has the leaf for the name's hash scanned
+    > returns the child's inode, 0 if there is no such entry */
+int _dir_lookup(int dir, const char* name, int* type) {
+    dirNode path[DIR_INDEX_MAX_LEVELS + 2];
+    int depth = _dir_find(dir, name, path);
+    if (depth < 0) {
+        return depth;
+    }
+
+    char entry_name[FILENAME_LENGTH + 1];
+    int entry_type;
+    int range;
+    uint8_t* entries = _dir_entries(path, depth, &range);
+    for (int i = 0; i < range; i++) {
+        /* grab the name of the entry, skipping over empty ones */
+        int inode_num = _dirent_read(entries, i, entry_name, &entry_type);
+        if (inode_num < 0) {
+            return inode_num;
+        }
+        if (inode_num && strncmp(name, entry_name, FILENAME_LENGTH) == 0) {
+            *type = entry_type;
+            return inode_num;
+        }
+    }
+    return 0;
+}
+
+/* _dir_convert(): move the entries of a full flat directory inode to a leaf, indexing the
+    directory, and add the new entry there (a leaf holds more entries than an inode)
+    - errors without changing anything if no block is free */
+static int _dir_convert(dirNode* path, const char* name, int type, uint32_t child) {
+    int features = mounted->features;
+    uint32_t leaf_num;
+    if ((ERR = _alloc_blocks(1, &leaf_num, TFS_ALLOC_FIRST_FREE)) < 0) {
+        return ERR;
+    }
+
+    uint8_t leaf[BLOCKSIZE];
+    _init_dir_block(leaf, DIRLEAF, 0);
+    int range;
+    uint8_t* entries = _dir_entries(path, 0, &range);
+    memcpy(leaf + FIRST_DIRLEAF_LOC, entries, range * DIRENT_SIZE(features));
+    _set_dirent(leaf + FIRST_DIRLEAF_LOC, range, child, type, name);
+
+    uint8_t* inode = path[0].data;
+    memset(inode + DIR_DATA_LOC, 0, MAX_DIR_INODES);
+    inode[FILE_MAP_LOC] = DIR_MAP_INDEX;
+    inode[DIR_INDEX_LEVELS_LOC] = 0;
+    _set_index(inode + DIR_INDEX_LOC, 0, 0, leaf_num, features);
+
+    /* the leaf is in place before the inode points at it, and goes back if either fails */
+    int status = cacheWriteBlock(mounted->cache, leaf_num, leaf);
+    if (status >= 0) {
+        status = cacheWriteBlock(mounted->cache, path[0].block, inode);
+    }
+    if (status < 0) {
+        _free_block(leaf_num);
+        return ERR = status;
+    }
+    return TFS_SUCCESS;
+}
+
+/* a directory entry with its name's hash, for sorting the entries of a leaf being split */
+typedef struct hashedDirent {
+    uint32_t hash;
+    uint8_t entry[4 + 1 + FILENAME_LENGTH];
+} hashedDirent;
+
+static int _compare_hashed(const void* a, const void* b) {
+    uint32_t x = ((const hashedDirent*) a)->hash;
+    uint32_t y = ((const hashedDirent*) b)->hash;
+    return x < y ? -1 : x > y;
+}
+
+/* _dir_split(): add an entry to the full leaf at path[depth], splitting it in two
+    + the leaf splits at the hash boundary nearest its middle and the new leaf is filed in the
+      leaf's parent under its first hash; a full DIRINDEX parent splits in half the same way,
+      up to the inode, which when full moves its pairs to a new DIRINDEX block and becomes the
+      parent of that block, growing the index a level
+    + every block needed is taken before anything changes; then the new blocks are written,
+      the changed ones, and the inode last
+    - errors with ERR_DIR_FULL if every entry of the leaf has the same hash, or the index
+      already has DIR_INDEX_MAX_LEVELS levels and needs another */
+static int _dir_split(dirNode* path, int depth, const char* name, int type, uint32_t child) {
+    int features = mounted->features;
+    int dirent_size = DIRENT_SIZE(features);
+    int pair_size = DIRINDEX_ENTRY_SIZE(features);
+    int levels = path[0].data[DIR_INDEX_LEVELS_LOC];
+
+    /* sort the leaf's entries with the new one by hash and find where to cut them */
+    int range;
+    uint8_t* entries = _dir_entries(path, depth, &range);
+    hashedDirent sorted[MAX_DIRLEAF_BYTES / DIRENT_SIZE(TFS_FEAT_DIRENTS) + 1];
+    char entry_name[FILENAME_LENGTH + 1];
+    int entry_type;
+    for (int i = 0; i < range; i++) {
+        _dirent_read(entries, i, entry_name, &entry_type);
+        sorted[i].hash = _dir_hash(entry_name);
+        memcpy(sorted[i].entry, entries + i * dirent_size, dirent_size);
+    }
+    _set_dirent(sorted[range].entry, 0, child, type, name);
+    sorted[range].hash = _dir_hash(name);
+    int count = range + 1;
+    qsort(sorted, count, sizeof(hashedDirent), _compare_hashed);
+
+    int cut = 0;
+    for (int d = 0; d < count && cut == 0; d++) {
+        int below = count / 2 - d;
+        int above = count / 2 + d;
+        if (below > 0 && sorted[below - 1].hash != sorted[below].hash) {
+            cut = below;
+        } else if (above < count && sorted[above - 1].hash != sorted[above].hash) {
+            cut = above;
+        }
+    }
+    if (cut == 0) {
+        return ERR_DIR_FULL;
+    }
+
+    /* count the blocks the split takes: the new leaf, one per full DIRINDEX block above
+        it, and one more if the inode is full too */
+    int needed = 1;
+    int k = depth - 1;
+    int capacity;
+    uint8_t* table = _index_table(path[k].data, k == 0, &capacity, features);
+    while (k > 0 && _index_count(table, capacity, features) == capacity) {
+        needed++;
+        k--;
+        table = _index_table(path[k].data, k == 0, &capacity, features);
+    }
+    bool grow = k == 0 && _index_count(table, capacity, features) == capacity;
+    if (grow && levels == DIR_INDEX_MAX_LEVELS) {
+        return ERR_DIR_FULL;
+    }
+    needed += grow;
+
+    uint32_t new_blocks[DIR_INDEX_MAX_LEVELS + 2];
+    if ((ERR = _alloc_blocks(needed, new_blocks, TFS_ALLOC_FIRST_FREE)) < 0) {
+        return ERR;
+    }
+    uint8_t new_data[DIR_INDEX_MAX_LEVELS + 2][BLOCKSIZE];
+    int used = 0;
+
+    /* the leaf keeps the entries below the cut, the new leaf takes the rest */
+    _init_dir_block(path[depth].data, DIRLEAF, 0);
+    _init_dir_block(new_data[used], DIRLEAF, 0);
+    for (int i = 0; i < count; i++) {
+        uint8_t* to = i < cut ? path[depth].data + FIRST_DIRLEAF_LOC + i * dirent_size
+                              : new_data[used] + FIRST_DIRLEAF_LOC + (i - cut) * dirent_size;
+        memcpy(to, sorted[i].entry, dirent_size);
+    }
+    uint32_t carry_hash = sorted[cut].hash;
+    uint32_t carry_block = new_blocks[used++];
+
+    /* file the new block in the parent, splitting full parents on the way up */
+    uint8_t pairs[MAX_DIRINDEX_BYTES + DIRINDEX_ENTRY_SIZE(TFS_FEAT_ADDR32)];
+    for (k = depth - 1; carry_block != 0; k--) {
+        table = _index_table(path[k].data, k == 0, &capacity, features);
+        int num_pairs = _index_count(table, capacity, features);
+        int slot = path[k].slot + 1;
+        memcpy(pairs, table, slot * pair_size);
+        _set_index(pairs, slot, carry_hash, carry_block, features);
+        memcpy(pairs + (slot + 1) * pair_size, table + slot * pair_size, (num_pairs - slot) * pair_size);
+        num_pairs++;
+        memset(table, 0, capacity * pair_size);
+
+        if (num_pairs <= capacity) {
+            memcpy(table, pairs, num_pairs * pair_size);
+            carry_block = 0;
+        } else if (k > 0) {
+            /* a full DIRINDEX block keeps the lower half, a new one at its level takes the rest */
+            int half = num_pairs / 2;
+            memcpy(table, pairs, half * pair_size);
+            _init_dir_block(new_data[used], DIRINDEX, path[k].data[DIRINDEX_LEVEL_LOC]);
+            uint8_t* new_table = _index_table(new_data[used], false, &capacity, features);
+            memcpy(new_table, pairs + half * pair_size, (num_pairs - half) * pair_size);
+            carry_hash = _index_hash(pairs, half, features);
+            carry_block = new_blocks[used++];
+        } else {
+            /* a full inode hands all its pairs to a new DIRINDEX block (which holds more)
+                and keeps only the pair leading there */
+            _init_dir_block(new_data[used], DIRINDEX, levels);
+            uint8_t* new_table = _index_table(new_data[used], false, &capacity, features);
+            memcpy(new_table, pairs, num_pairs * pair_size);
+            _set_index(table, 0, 0, new_blocks[used++], features);
+            path[0].data[DIR_INDEX_LEVELS_LOC] = levels + 1;
+            carry_block = 0;
+        }
+    }
+
+    /* new blocks first, so nothing written points at a block not yet in place */
+    for (int i = 0; i < used; i++) {
+        if ((ERR = cacheWriteBlock(mounted->cache, new_blocks[i], new_data[i])) < 0) {
+            return ERR;
+        }
+    }
+    for (int i = depth; i > k; i--) {
+        if ((ERR = cacheWriteBlock(mounted->cache, path[i].block, path[i].data)) < 0) {
+            return ERR;
+        }
+    }
+    return TFS_SUCCESS;
+}
+
+/* _dir_add(): add an entry for 'child' to the given directory (the superblock for the root)
+    + a full flat directory inode on a TFS_FEAT_DIRINDEX disk is indexed, and a full leaf split
+    - errors with ERR_DIR_FULL if there is no room for the entry, nothing is changed then */
+int _dir_add(int dir, const char* name, int type, uint32_t child) {
+    dirNode path[DIR_INDEX_MAX_LEVELS + 2];
+    int depth = _dir_find(dir, name, path);
+    if (depth < 0) {
+        return depth;
+    }
+
+    /* take the first empty entry of the block */
+    int range;
+    uint8_t* entries = _dir_entries(path, depth, &range);
+    for (int i = 0; i < range; i++) {
+        if (!_dirent_inode(entries, i, mounted->features)) {
+            _set_dirent(entries, i, child, type, name);
+            return cacheWriteBlock(mounted->cache, path[depth].block, path[depth].data);
+        }
+    }
+
+    if (depth > 0) {
+        return _dir_split(path, depth, name, type, child);
+    }
+    if (dir == SUPERBLOCK_DISKLOC || !(mounted->features & TFS_FEAT_DIRINDEX)) {
+        return ERR_DIR_FULL;
+    }
+    return _dir_convert(path, name, type, child);
+}
+
+/* _dir_remove(): empty the entry for 'child' (named 'name') in the given directory
+    + leaves emptied this way stay in the index, later entries refill them
+    - errors if the directory has no such entry */
+int _dir_remove(int dir, uint32_t child, const char* name) {
+    dirNode path[DIR_INDEX_MAX_LEVELS + 2];
+    int depth = _dir_find(dir, name, path);
+    if (depth < 0) {
+        return depth;
+    }
+
+    int range;
+    uint8_t* entries = _dir_entries(path, depth, &range);
+    char entry_name[FILENAME_LENGTH + 1];
+    int entry_type;
+    for (int i = 0; i < range; i++) {
+        /* a leaf briefly holds the old and the new name of a child being renamed */
+        if (_dirent_inode(entries, i, mounted->features) != child) {
+            continue;
+        }
+        if (depth > 0 && (_dirent_read(entries, i, entry_name, &entry_type) < 0 || strncmp(name, entry_name, FILENAME_LENGTH) != 0)) {
+            continue;
+        }
+        _set_dirent(entries, i, EMPTY_TABLEVAL, 0, NULL);
+        return cacheWriteBlock(mounted->cache, path[depth].block, path[depth].data);
+    }
+    return ERR_BAD_DISK;
+}
+
+/* _dir_rename(): rename the entry for 'child' in the given directory from oldName to newName
+    + a flat directory renames the entry where it is, an indexed one files the new name
+      (where its hash says) before dropping the old one */
+int _dir_rename(int dir, uint32_t child, int type, const char* oldName, const char* newName) {
+    dirNode path[DIR_INDEX_MAX_LEVELS + 2];
+    int depth = _dir_find(dir, oldName, path);
+    if (depth < 0) {
+        return depth;
+    }
+    if (depth > 0) {
+        if ((ERR = _dir_add(dir, newName, type, child)) < 0) {
+            return ERR;
+        }
+        return _dir_remove(dir, child, oldName);
+    }
+
+    int range;
+    uint8_t* entries = _dir_entries(path, 0, &range);
+    for (int i = 0; i < range; i++) {
+        if (_dirent_inode(entries, i, mounted->features) == child) {
+            _set_dirent(entries, i, child, type, newName);
+            return cacheWriteBlock(mounted->cache, dir, path[0].data);
+        }
+    }
+    return ERR_BAD_DISK;
+}
+
+/* what _dir_list() collects while it walks a directory */
+typedef struct dirListing {
+    dirEntry* entries;
+    int numEntries;
+    int entryCapacity;
+    // DIRINDEX and DIRLEAF blocks passed, only kept if wantBlocks
+    bool wantBlocks;
+    uint32_t* blocks;
+    int numBlocks;
+    int blockCapacity;
+} dirListing;
+
+/* _list_entries(): add the used entries of a directory block to a listing */
+static int _list_entries(uint8_t* entries, int range, dirListing* listing) {
+    for (int i = 0; i < range; i++) {
+        if (listing->numEntries == listing->entryCapacity) {
+            int capacity = listing->entryCapacity ? listing->entryCapacity * 2 : 16;
+            dirEntry* grown = (dirEntry*) realloc(listing->entries, capacity * sizeof(dirEntry));
+            if (grown == NULL) {
+                return SYS_ERR_MALLOC;
+            }
+            listing->entries = grown;
+            listing->entryCapacity = capacity;
+        }
+        dirEntry* entry = &listing->entries[listing->numEntries];
+        int inode_num = _dirent_read(entries, i, entry->name, &entry->type);
+        if (inode_num < 0) {
+            return inode_num;
+        }
+        if (inode_num) {
+            entry->inode = inode_num;
+            entry->size = 0;
+            listing->numEntries++;
+        }
+    }
+    return TFS_SUCCESS;
+}
+
+/* _list_index(): add everything under a table of 'count' index pairs 'level' levels
+    above the leaves to a listing, reading the blocks of each table as one batch */
+static int _list_index(uint8_t* table, int count, int level, dirListing* listing) {
+    int features = mounted->features;
+    if ((ERR = _prefetch_blocks(mounted->cache, table + DIRINDEX_PTR, count, PTR_SIZE(features), DIRINDEX_ENTRY_SIZE(features))) < 0) {
+        return ERR;
+    }
+
+    uint8_t block[BLOCKSIZE];
+    for (int i = 0; i < count; i++) {
+        uint32_t block_num = _index_ptr(table, i, features);
+        if ((ERR = cacheReadBlock(mounted->cache, block_num, block)) < 0) {
+            return ERR;
+        }
+        if (listing->wantBlocks) {
+            if (listing->numBlocks == listing->blockCapacity) {
+                int capacity = listing->blockCapacity ? listing->blockCapacity * 2 : 16;
+                uint32_t* grown = (uint32_t*) realloc(listing->blocks, capacity * sizeof(uint32_t));
+                if (grown == NULL) {
+                    return SYS_ERR_MALLOC;
+                }
+                listing->blocks = grown;
+                listing->blockCapacity = capacity;
+            }
+            listing->blocks[listing->numBlocks++] = block_num;
+        }
+
+        if (level == 0) {
+            ERR = _list_entries(block + FIRST_DIRLEAF_LOC, MAX_DIRLEAF_BYTES / DIRENT_SIZE(features), listing);
+        } else {
+            int capacity;
+            uint8_t* child = _index_table(block, false, &capacity, features);
+            ERR = _list_index(child, _index_count(child, capacity, features), level - 1, listing);
+        }
+        if (ERR < 0) {
+            return ERR;
+        }
+    }
+    return TFS_SUCCESS;
+}
+
+/* _dir_list(): every entry of the given directory (the superblock for the root)
+    + fills 'entries' with a malloc()ed array of them, and 'blocks' (if given) with one
+      of the DIRINDEX and DIRLEAF blocks of an indexed directory, their count in num_blocks
+    > returns how many entries there are */
+int _dir_list(int dir, dirEntry** entries, uint32_t** blocks, int* num_blocks) {
+    dirNode path[1];
+    path[0].block = dir;
+    if ((ERR = cacheReadBlock(mounted->cache, dir, path[0].data)) < 0) {
+        return ERR;
+    }
+
+    dirListing listing;
+    memset(&listing, 0, sizeof(listing));
+    listing.wantBlocks = blocks != NULL;
+    if (_dir_indexed(dir, path[0].data)) {
+        int capacity;
+        uint8_t* table = _index_table(path[0].data, true, &capacity, mounted->features);
+        ERR = _list_index(table, _index_count(table, capacity, mounted->features), path[0].data[DIR_INDEX_LEVELS_LOC], &listing);
+    } else {
+        int range;
+        uint8_t* flat = _dir_entries(path, 0, &range);
+        ERR = _list_entries(flat, range, &listing);
+    }
+    if (ERR < 0) {
+        free(listing.entries);
+        free(listing.blocks);
+        return ERR;
+    }
+
+    *entries = listing.entries;
+    if (blocks != NULL) {
+        *blocks = listing.blocks;
+        *num_blocks = listing.numBlocks;
+    }
+    return listing.numEntries;
+}
+
+/* _dir_release(): give back the index blocks of an empty directory, leaving it a flat
+    directory inode again (nothing to do for a flat one)
+    - errors with ERR_DIR_NOT_EMPTY if the directory still has entries */
+int _dir_release(int dir) {
+    dirEntry* entries;
+    uint32_t* blocks;
+    int num_blocks;
+    int count = _dir_list(dir, &entries, &blocks, &num_blocks);
+    if (count < 0) {
+        return count;
+    }
+    free(entries);
+    if (count > 0 || num_blocks == 0) {
+        free(blocks);
+        return count > 0 ? ERR_DIR_NOT_EMPTY : TFS_SUCCESS;
+    }
+
+    /* the inode stops pointing at the index before its blocks are freed */
+    uint8_t inode[BLOCKSIZE];
+    if ((ERR = cacheReadBlock(mounted->cache, dir, inode)) >= 0) {
+        inode[FILE_MAP_LOC] = EMPTY_TABLEVAL;
+        memset(inode + DIR_DATA_LOC, 0, MAX_DIR_INODES);
+        if ((ERR = cacheWriteBlock(mounted->cache, dir, inode)) >= 0) {
+            ERR = _free_blocks(blocks, num_blocks);
+        }
+    }
+    free(blocks);
+    return ERR < 0 ? ERR : TFS_SUCCESS;
+}
+
+/* _open_dir(): the entry of directory descriptor DD, NULL if it is not open */
+openDir* _open_dir(int DD) {
+    if (DD < 0 || DD >= DIR_TABLESIZE || !dir_table[DD].inUse) {
+        return NULL;
+    }
+    return &dir_table[DD];
+}
+
+/* _dir_snapshot(): open a directory descriptor on the given directory (the superblock
+    for the root), listing all of its entries now with one pass over its blocks */
+int _dir_snapshot(int dir, openDir* handle) {
+    dirEntry* entries;
+    int count = _dir_list(dir, &entries, NULL, NULL);
+    if (count < 0) {
+        return count;
+    }
+    handle->inUse = true;
+    handle->entries = entries;
+    handle->numEntries = count;
+    handle->next = 0;
+    return TFS_SUCCESS;
+}
+
+/* _dir_next(): copy up to 'max' of the entries an open directory has left to 'out'
+    + with 'sizes' the inodes of the files among them are read for their sizes, as
+      batches of FETCH_PARENT_CHUNK blocks with cacheReadBlocks()
+    > returns how many entries were copied, 0 once every entry was handed out */
+int _dir_next(openDir* handle, dirEntry* out, int max, bool sizes) {
+    int count = handle->numEntries - handle->next;
+    if (count > max) {
+        count = max;
+    }
+    memcpy(out, handle->entries + handle->next, count * sizeof(dirEntry));
+
+    if (sizes) {
+        uint8_t chunk[FETCH_PARENT_CHUNK][BLOCKSIZE];
+        blockIO ios[FETCH_PARENT_CHUNK];
+        int owners[FETCH_PARENT_CHUNK];
+        int i = 0;
+        while (i < count) {
+            int num_ios = 0;
+            for (; i < count && num_ios < FETCH_PARENT_CHUNK; i++) {
+                if (out[i].type == FILE_TYPE_FILE) {
+                    ios[num_ios].bNum = out[i].inode;
+                    ios[num_ios].block = chunk[num_ios];
+                    owners[num_ios++] = i;
+                }
+            }
+            if ((ERR = cacheReadBlocks(mounted->cache, ios, num_ios)) < 0) {
+                return ERR;
+            }
+            for (int k = 0; k < num_ios; k++) {
+                uint8_t* s = chunk[k] + FILE_SIZE_LOC;
+                out[owners[k]].size = (s[0] << 24) + (s[1] << 16) + (s[2] << 8) + s[3];
+            }
+        }
+    }
+
+    handle->next += count;
+    return count;
+}
+
+/* _dir_close(): free what an open directory descriptor holds and mark it unused */
+void _dir_close(openDir* handle) {
+    free(handle->entries);
+    memset(handle, 0, sizeof(openDir));
+}
+
+/* _direct_slots(): how many pointers of a file inode lead straight to data blocks */
+int _direct_slots(int features) {
+    int slots = MAX_FILE_DATA / PTR_SIZE(features);
+    return features & TFS_FEAT_INDIRECT ? slots - INDIRECT_LEVELS : slots;
+}
+
+/* _indirect_span(): how many data blocks an indirect block heading 'level' levels maps
+    + level 0 is a data block itself */
+int _indirect_span(int features, int level) {
+    int span = 1;
+    for (int i = 0; i < level; i++) {
+        span *= MAX_INDIRECT_PTRS / PTR_SIZE(features);
+    }
+    return span;
+}
+
+/* _inode_extents()/_block_extents(): how many extents fit in a file inode / an EXTENT block */
+static int _inode_extents(int features) {
+    return MAX_FILE_DATA / EXTENT_SIZE(features);
+}
+
+static int _block_extents(int features) {
+    return MAX_EXTENT_BYTES / EXTENT_SIZE(features);
+}
+
+/* _get_extent()/_set_extent(): one field (EXTENT_*) of the slot'th extent of a table, or all three */
+static uint32_t _get_extent(const uint8_t* table, int slot, int field, int features) {
+    return _get_ptr(table, slot * 3 + field, PTR_SIZE(features));
+}
+
+static void _set_extent(uint8_t* table, int slot, uint32_t logical, uint32_t start, uint32_t length) {
+    _set_ptr(table, slot * 3 + EXTENT_LOGICAL, mounted->ptrSize, logical);
+    _set_ptr(table, slot * 3 + EXTENT_START, mounted->ptrSize, start);
+    _set_ptr(table, slot * 3 + EXTENT_LENGTH, mounted->ptrSize, length);
+}
+
+/* _find_extent(): binary search a table of 'slots' extents for the one holding file block 'index'
+    + the used extents are sorted by first file block and the empty ones come last,
+      so "used and starting at or before index" holds for a prefix of the table
+    > returns the extent's slot, or -1 if no extent holds the block */
+static int _find_extent(const uint8_t* table, int slots, uint32_t index, int features) {
+    int low = 0;
+    int high = slots;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (_get_extent(table, mid, EXTENT_LENGTH, features) != 0 && _get_extent(table, mid, EXTENT_LOGICAL, features) <= index) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low == 0) {
+        return -1;
+    }
+    uint32_t first = _get_extent(table, low - 1, EXTENT_LOGICAL, features);
+    return index < first + _get_extent(table, low - 1, EXTENT_LENGTH, features) ? low - 1 : -1;
+}
+
+/* _count_runs(): how many runs of consecutive block numbers a list of blocks makes */
+static int _count_runs(uint32_t* blocks, int count) {
+    int runs = 0;
+    for (int i = 0; i < count; i++) {
+        if (i == 0 || blocks[i] != blocks[i - 1] + 1) {
+            runs++;
+        }
+    }
+    return runs;
+}
+
+/* _max_file_blocks(): the most data blocks one file inode can map */
+int _max_file_blocks(int features) {
+    /* extents are only limited by how far their fields count */
+    if (features & TFS_FEAT_EXTENTS) {
+        return PTR_SIZE(features) == 1 ? 0xFF : INT32_MAX;
+    }
+    int max = _direct_slots(features);
+    for (int level = 1; level <= INDIRECT_LEVELS && (features & TFS_FEAT_INDIRECT); level++) {
+        max += _indirect_span(features, level);
+    }
+    return max;
+}
+
+/* _map_blocks(): how many indirect blocks it takes to map 'count' data blocks
+    + each indirect tree is filled from the left, so a tree of 'level' levels holding
+      n data blocks has ceil(n / span) blocks at every height
+    + extents depend on how the blocks fall, this is the most EXTENT blocks it can take
+      (every block a run of its own); _map_size() has the real number */
+int _map_blocks(int features, int count) {
+    if (features & TFS_FEAT_EXTENTS) {
+        if (count <= _inode_extents(features)) {
+            return 0;
+        }
+        int blocks = (count + _block_extents(features) - 1) / _block_extents(features);
+        return blocks < _inode_extents(features) ? blocks : _inode_extents(features);
+    }
+    int rest = count - _direct_slots(features);
+    int total = 0;
+    for (int level = 1; level <= INDIRECT_LEVELS && rest > 0 && (features & TFS_FEAT_INDIRECT); level++) {
+        int take = rest < _indirect_span(features, level) ? rest : _indirect_span(features, level);
+        for (int height = 1; height <= level; height++) {
+            int span = _indirect_span(features, height);
+            total += (take + span - 1) / span;
+        }
+        rest -= take;
+    }
+    return total;
+}
+
+/* _map_size(): how many map blocks (indirect or EXTENT) the mounted tfs needs for a file
+    made of the given data blocks, in file order
+    - errors with ERR_DISK_OUT_OF_SPACE if the blocks fall in more runs than an inode can map */
+int _map_size(uint32_t* data, int count) {
+    int features = mounted->features;
+    if (!(features & TFS_FEAT_EXTENTS)) {
+        return _map_blocks(features, count);
+    }
+
+    int runs = _count_runs(data, count);
+    if (runs <= _inode_extents(features)) {
+        return 0;
+    }
+    int blocks = (runs + _block_extents(features) - 1) / _block_extents(features);
+    return blocks <= _inode_extents(features) ? blocks : ERR_DISK_OUT_OF_SPACE;
+}
+
+/* _file_block(): the block holding data block 'index' of the mounted tfs file with the given inode
+    + reads at most one indirect block per level, all through the cache
+    + extents are binary searched, in the inode and then (if it spilled) in one EXTENT block
+    > returns 0 if the file has no such block */
+int _file_block(uint8_t* inode, int index) {
+    int direct = _direct_slots(mounted->features);
+    if (index < 0) {
+        return 0;
+    }
+    if (mounted->features & TFS_FEAT_EXTENTS) {
+        uint8_t buffer[BLOCKSIZE];
+        uint8_t* table = inode + FILE_DATA_LOC;
+        int slots = _inode_extents(mounted->features);
+        if (inode[FILE_MAP_LOC] & FILE_MAP_EXTENT_TREE) {
+            int slot = _find_extent(table, slots, index, mounted->features);
+            if (slot < 0) {
+                return 0;
+            }
+            if ((ERR = cacheReadBlock(mounted->cache, _get_extent(table, slot, EXTENT_START, mounted->features), buffer)) < 0) {
+                return ERR;
+            }
+            table = buffer + FIRST_EXTENT_LOC;
+            slots = _block_extents(mounted->features);
+        }
+        int slot = _find_extent(table, slots, index, mounted->features);
+        if (slot < 0) {
+            return 0;
+        }
+        return _get_extent(table, slot, EXTENT_START, mounted->features) + index - _get_extent(table, slot, EXTENT_LOGICAL, mounted->features);
+    }
+    if (index < direct) {
+        return _get_ptr(inode + FILE_DATA_LOC, index, mounted->ptrSize);
+    }
+    if (!(mounted->features & TFS_FEAT_INDIRECT)) {
+        return 0;
+    }
+
+    /* find the tree holding the block, then walk down it */
+    index -= direct;
+    for (int level = 1; level <= INDIRECT_LEVELS; level++) {
+        if (index >= _indirect_span(mounted->features, level)) {
+            index -= _indirect_span(mounted->features, level);
+            continue;
+        }
+        uint32_t block = _get_ptr(inode + FILE_DATA_LOC, direct + level - 1, mounted->ptrSize);
+        uint8_t buffer[BLOCKSIZE];
+        for (int height = level; height > 0 && block != 0; height--) {
+            if ((ERR = cacheReadBlock(mounted->cache, block, buffer)) < 0) {
+                return ERR;
+            }
+            int span = _indirect_span(mounted->features, height - 1);
+            block = _get_ptr(buffer + FIRST_INDIRECT_LOC, index / span, mounted->ptrSize);
+            index %= span;
+        }
+        return block;
+    }
+    return 0;
+}
+
+/* _walk_indirect(): add the data blocks under an indirect block to 'data' and the
+    indirect blocks themselves to 'meta', both bounded by their capacity */
+static int _walk_indirect(uint32_t block, int level, uint32_t* data, int* num_data, int max_data,
+                          uint32_t* meta, int* num_meta, int max_meta) {
+    if (*num_meta == max_meta) {
+        return ERR_BAD_DISK;
+    }
+    meta[(*num_meta)++] = block;
+
+    uint8_t buffer[BLOCKSIZE];
+    if ((ERR = cacheReadBlock(mounted->cache, block, buffer)) < 0) {
+        return ERR;
+    }
+    for (int i = 0; i < MAX_INDIRECT_PTRS / mounted->ptrSize; i++) {
+        uint32_t ptr = _get_ptr(buffer + FIRST_INDIRECT_LOC, i, mounted->ptrSize);
+        if (ptr == 0) {
+            break;
+        }
+        if (level > 1) {
+            if ((ERR = _walk_indirect(ptr, level - 1, data, num_data, max_data, meta, num_meta, max_meta)) < 0) {
+                return ERR;
+            }
+        } else if (*num_data == max_data) {
+            return ERR_BAD_DISK;
+        } else {
+            data[(*num_data)++] = ptr;
+        }
+    }
+    return TFS_SUCCESS;
+}
+
+/* _walk_extents(): add the blocks of a table of extents to 'data', bounded by its capacity */
+static int _walk_extents(uint8_t* table, int slots, uint32_t* data, int* num_data, int max_data) {
+    for (int i = 0; i < slots; i++) {
+        uint32_t start = _get_extent(table, i, EXTENT_START, mounted->features);
+        uint32_t length = _get_extent(table, i, EXTENT_LENGTH, mounted->features);
+        if (length == 0) {
+            break;
+        }
+        if (length > max_data - *num_data) {
+            return ERR_BAD_DISK;
+        }
+        for (uint32_t j = 0; j < length; j++) {
+            data[(*num_data)++] = start + j;
+        }
+    }
+    return TFS_SUCCESS;
+}
+
+/* _file_blocks(): list every block a file inode of the mounted tfs owns
+    + its data blocks in file order come first in '*blocks', the indirect blocks
+      mapping them follow; the caller frees the list, which has room for one more entry
+    > returns the number of data blocks, and the number of indirect blocks in num_meta
+    - errors if the inode maps more blocks than its size needs */
+int _file_blocks(uint8_t* inode, uint32_t** blocks, int* num_meta) {
+    uint8_t* s = inode + FILE_SIZE_LOC;
+    int size = (s[0] << 24) + (s[1] << 16) + (s[2] << 8) + s[3];
+    int max_data = ((size - 1) / MAX_DATA_SPACE) + 1;
+    int max_meta = _map_blocks(mounted->features, max_data);
+    uint32_t* list = (uint32_t*) malloc((max_data + max_meta + 1) * sizeof(uint32_t));
+    if (list == NULL) {
+        return SYS_ERR_MALLOC;
+    }
+
+    int num_data = 0;
+    int direct = _direct_slots(mounted->features);
+    *num_meta = 0;
+    /* inline data lives in the inode itself, the file owns no other block */
+    if (inode[FILE_MAP_LOC] & FILE_MAP_INLINE) {
+        *blocks = list;
+        return 0;
+    }
+    if (mounted->features & TFS_FEAT_EXTENTS) {
+        uint8_t* table = inode + FILE_DATA_LOC;
+        int slots = _inode_extents(mounted->features);
+        if (!(inode[FILE_MAP_LOC] & FILE_MAP_EXTENT_TREE)) {
+            ERR = _walk_extents(table, slots, list, &num_data, max_data);
+        }
+        uint8_t buffer[BLOCKSIZE];
+        for (int i = 0; i < slots && (inode[FILE_MAP_LOC] & FILE_MAP_EXTENT_TREE); i++) {
+            uint32_t block = _get_extent(table, i, EXTENT_START, mounted->features);
+            if (_get_extent(table, i, EXTENT_LENGTH, mounted->features) == 0) {
+                break;
+            }
+            if (*num_meta == max_meta) {
+                ERR = ERR_BAD_DISK;
+            } else {
+                list[max_data + (*num_meta)++] = block;
+                ERR = cacheReadBlock(mounted->cache, block, buffer);
+            }
+            if (ERR >= 0) {
+                ERR = _walk_extents(buffer + FIRST_EXTENT_LOC, _block_extents(mounted->features), list, &num_data, max_data);
+            }
+            if (ERR < 0) {
+                break;
+            }
+        }
+        if (ERR < 0) {
+            free(list);
+            return ERR;
+        }
+    }
+    for (int i = 0; i < MAX_FILE_DATA / mounted->ptrSize && !(mounted->features & TFS_FEAT_EXTENTS); i++) {
+        uint32_t ptr = _get_ptr(inode + FILE_DATA_LOC, i, mounted->ptrSize);
+        if (ptr == 0) {
+            break;
+        }
+        if (i >= direct) {
+            ERR = _walk_indirect(ptr, i - direct + 1, list, &num_data, max_data, list + max_data, num_meta, max_meta);
+        } else {
+            ERR = num_data == max_data ? ERR_BAD_DISK : TFS_SUCCESS;
+            list[num_data++] = ptr;
+        }
+        if (ERR < 0) {
+            free(list);
+            return ERR;
+        }
+    }
+
+    /* close the gap between the data and indirect blocks */
+    memmove(list + num_data, list + max_data, *num_meta * sizeof(uint32_t));
+    *blocks = list;
+    return num_data;
+}
+
+/* _build_indirect(): fill the next indirect block of 'meta_blocks' to map 'count' data blocks
+    > returns the block number the indirect block goes to */
+static uint32_t _build_indirect(int level, uint32_t* data, int count, uint32_t* meta, uint8_t* meta_blocks, int* used) {
+    int index = (*used)++;
+    uint8_t* block = meta_blocks + index * BLOCKSIZE;
+    memset(block, 0, BLOCKSIZE);
+    block[BLOCK_TYPE_LOC] = INDIRECT;
+    block[SAFETY_BYTE_LOC] = SAFETY_HEX;
+    block[INDIRECT_LEVEL_LOC] = level;
+
+    int span = _indirect_span(mounted->features, level - 1);
+    for (int i = 0; i * span < count; i++) {
+        int left = count - i * span < span ? count - i * span : span;
+        uint32_t child = level == 1 ? data[i] : _build_indirect(level - 1, data + i * span, left, meta, meta_blocks, used);
+        _set_ptr(block + FIRST_INDIRECT_LOC, i, mounted->ptrSize, child);
+    }
+    return meta[index];
+}
+
+/* _build_extents(): _build_map() for TFS_FEAT_EXTENTS disks
+    + one extent per run of blocks, in the inode if they fit, otherwise spread over the
+      EXTENT blocks in order with one inode extent per EXTENT block */
+static void _build_extents(uint8_t* inode, uint32_t* data, int count, uint32_t* meta, uint8_t* meta_blocks) {
+    int per_block = _block_extents(mounted->features);
+    bool tree = _count_runs(data, count) > _inode_extents(mounted->features);
+    inode[FILE_MAP_LOC] = tree ? FILE_MAP_EXTENT_TREE : 0;
+
+    int run = 0;
+    for (int first = 0; first < count; run++) {
+        int length = 1;
+        while (first + length < count && data[first + length] == data[first + length - 1] + 1) {
+            length++;
+        }
+
+        uint8_t* table = inode + FILE_DATA_LOC;
+        int slot = run;
+        if (tree) {
+            int b = run / per_block;
+            slot = run % per_block;
+            table = meta_blocks + b * BLOCKSIZE;
+            if (slot == 0) {
+                memset(table, 0, BLOCKSIZE);
+                table[BLOCK_TYPE_LOC] = EXTENT;
+                table[SAFETY_BYTE_LOC] = SAFETY_HEX;
+                _set_extent(inode + FILE_DATA_LOC, b, first, meta[b], 0);
+            }
+            uint32_t covered = _get_extent(inode + FILE_DATA_LOC, b, EXTENT_LENGTH, mounted->features);
+            _set_ptr(inode + FILE_DATA_LOC, b * 3 + EXTENT_LENGTH, mounted->ptrSize, covered + length);
+            table += FIRST_EXTENT_LOC;
+        }
+        _set_extent(table, slot, first, data[first], length);
+        first += length;
+    }
+}
+
+/* _build_map(): point a file inode of the mounted tfs at 'count' data blocks
+    + fills the inode's pointer table, and lays out the _map_size() indirect (or EXTENT)
+      blocks it needs in 'meta_blocks' (BLOCKSIZE each), to be written to the blocks in 'meta' */
+void _build_map(uint8_t* inode, uint32_t* data, int count, uint32_t* meta, uint8_t* meta_blocks) {
+    memset(inode + FILE_DATA_LOC, 0, MAX_FILE_DATA);
+    inode[FILE_MAP_LOC] = 0;
+    if (mounted->features & TFS_FEAT_EXTENTS) {
+        _build_extents(inode, data, count, meta, meta_blocks);
+        return;
+    }
+    int direct = _direct_slots(mounted->features);
+    int used = 0;
+    for (int i = 0; i < count && i < direct; i++) {
+        _set_ptr(inode + FILE_DATA_LOC, i, mounted->ptrSize, data[i]);
+    }
+
+    int done = direct;
+    for (int level = 1; level <= INDIRECT_LEVELS && done < count; level++) {
+        int span = _indirect_span(mounted->features, level);
+        int take = count - done < span ? count - done : span;
+        uint32_t block = _build_indirect(level, data + done, take, meta, meta_blocks, &used);
+        _set_ptr(inode + FILE_DATA_LOC, direct + level - 1, mounted->ptrSize, block);
+        done += take;
+    }
+}
+
+/* _prefetch_blocks(): pulls the non-zero block pointers in the table into the cache
+    + reads them in batches of at most half the cache, so that a batch does not
+      evict its own blocks before they are used
+    - errors if any of the pointed to blocks cannot be read */
+int _prefetch_blocks(blockCache* cache, uint8_t* table, int count, int ptr_size, int stride) {
+    int window = cache->capacity / 2 > 0 ? cache->capacity / 2 : 1;
+    uint8_t* scratch = (uint8_t*) malloc(window * BLOCKSIZE);
+    blockIO* ios = (blockIO*) malloc(window * sizeof(blockIO));
+    if (scratch == NULL || ios == NULL) {
+        free(scratch);
+        free(ios);
+        return SYS_ERR_MALLOC;
+    }
+
+    int status = TFS_SUCCESS;
+    int num_ios = 0;
+    for (int i = 0; i <= count && status == TFS_SUCCESS; i++) {
+        uint32_t ptr = i < count ? _get_ptr(table + i * stride, 0, ptr_size) : 0;
+        if (ptr != 0) {
+            ios[num_ios].bNum = ptr;
+            ios[num_ios].block = scratch + num_ios * BLOCKSIZE;
+            num_ios++;
+        }
+        if (num_ios == window || (i == count && num_ios > 0)) {
+            status = cacheReadBlocks(cache, ios, num_ios);
+            num_ios = 0;
+        }
+    }
+
+    free(scratch);
+    free(ios);
+    return status;
+}
+
+/* _indirect_level(): how many levels the given indirect block says it heads (0 if unreadable) */
+static int _indirect_level(blockCache* cache, int block) {
+    uint8_t buffer[BLOCKSIZE];
+    return cacheReadBlock(cache, block, buffer) < 0 ? 0 : buffer[INDIRECT_LEVEL_LOC];
+}
+
+/* _check_extents(): check a table of 'slots' extents that maps the file from block 'logical' on
+    + each used extent has to pick up where the last one ended, and nothing may follow the first empty one
+    + block_type is FILEEX for extents of data blocks (checked a cache window at a time),
+      or EXTENT for the inode extents of a spilled map, which point at one EXTENT block each
+    > returns how many data blocks the table maps */
+static int _check_extents(blockCache* cache, uint8_t* table, int slots, uint32_t logical, int block_type, char* blocks_checked, int features) {
+    int window = cache->capacity / 2 > 0 ? cache->capacity / 2 : 1;
+    uint8_t* scratch = (uint8_t*) malloc(window * BLOCKSIZE);
+    blockIO* ios = (blockIO*) malloc(window * sizeof(blockIO));
+    if (scratch == NULL || ios == NULL) {
+        free(scratch);
+        free(ios);
+        return SYS_ERR_MALLOC;
+    }
+
+    int status = TFS_SUCCESS;
+    uint32_t next = logical;
+    bool ended = false;
+    for (int i = 0; i < slots && status >= 0; i++) {
+        uint32_t first = _get_extent(table, i, EXTENT_LOGICAL, features);
+        uint32_t start = _get_extent(table, i, EXTENT_START, features);
+        uint32_t length = _get_extent(table, i, EXTENT_LENGTH, features);
+        if (ended || length == 0) {
+            ended = true;
+            status = (first | start | length) != 0 ? ERR_BAD_DISK : status;
+            continue;
+        }
+        /* the length of an inode extent of a spilled map counts the data blocks under
+            its EXTENT block, only a run of data blocks has to end inside the disk */
+        uint32_t disk_size = (uint32_t) getDiskSize(cache->disk);
+        if (first != next || start == 0 || start >= disk_size || (block_type == FILEEX && length > disk_size - start)) {
+            status = ERR_BAD_DISK;
+            continue;
+        }
+
+        if (block_type == EXTENT) {
+            /* the EXTENT block has to start at this extent and cover exactly its blocks */
+            if ((status = cacheReadBlock(cache, start, scratch)) >= 0) {
+                first = _get_extent(scratch + FIRST_EXTENT_LOC, 0, EXTENT_LOGICAL, features);
+                status = _check_block_con(cache, start, EXTENT, blocks_checked, features);
+            }
+            if (status >= 0 && (first != next || (uint32_t) status != length)) {
+                status = ERR_BAD_DISK;
+            }
+            next += length;
+            continue;
+        }
+
+        for (uint32_t done = 0; done < length && status >= 0; ) {
+            int batch = length - done < (uint32_t) window ? (int) (length - done) : window;
+            for (int j = 0; j < batch; j++) {
+                ios[j].bNum = start + done + j;
+                ios[j].block = scratch + j * BLOCKSIZE;
+            }
+            status = cacheReadBlocks(cache, ios, batch);
+            for (int j = 0; j < batch && status >= 0; j++) {
+                status = _check_block_con(cache, start + done + j, FILEEX, blocks_checked, features);
+            }
+            done += batch;
+        }
+        next += length;
+    }
+
+    free(scratch);
+    free(ios);
+    return status < 0 ? status : (int) (next - logical);
+}
+
+/* _check_dirents(): check the 'count' entries of directory 'dir' (the superblock for the root
+    of a disk without TFS_FEAT_ROOTDIR)
+    + every used entry leads to an inode block pointing back at 'dir' (or holding 0, from before
+      inodes kept their parent), and on TFS_FEAT_DIRENTS disks it has to carry that inode's type
+      and name; an empty entry is all zeroes */
+static int _check_dirents(blockCache* cache, int dir, uint8_t* table, int count, char* blocks_checked, int features) {
+    uint8_t inode[BLOCKSIZE];
+    for (int i = 0; i < count; i++) {
+        uint8_t* entry = table + i * DIRENT_SIZE(features);
+        uint32_t ptr = _dirent_inode(table, i, features);
+        if (ptr == 0) {
+            for (int j = 0; j < DIRENT_SIZE(features); j++) {
+                if (entry[j] != 0) {
+                    return ERR_BAD_DISK;
+                }
+            }
+            continue;
+        }
+        if ((ERR = _check_block_con(cache, ptr, INODE, blocks_checked, features)) < 0) {
+            return ERR;
+        }
+        if ((ERR = cacheReadBlock(cache, ptr, inode)) < 0) {
+            return ERR;
+        }
+        uint32_t parent = _get_ptr(inode + INODE_PARENT_LOC, 0, PTR_SIZE(features));
+        if (parent != 0 && parent != (uint32_t) dir) {
+            return ERR_BAD_DISK;
+        }
+        if ((features & TFS_FEAT_DIRENTS) && (entry[DIRENT_TYPE(features)] != inode[FILE_TYPE_FLAG_LOC]
+                || memcmp(entry + DIRENT_NAME(features), inode + FILE_NAME_LOC, FILENAME_LENGTH) != 0)) {
+            return ERR_BAD_DISK;
+        }
+    }
+    return TFS_SUCCESS;
+}
+
+/* _check_dir_index(): check a table of index pairs of directory 'dir', 'level' levels above
+    the leaves, which holds the names hashing from 'low' up to (not including) 'high'
+    + the pairs are packed and sorted, the first one filed under 'low', and each leads to a
+      DIRINDEX block one level down (or a DIRLEAF at level 0) holding only the names of its range
+    + marks the blocks of the index in blocks_checked, the entries of the leaves are checked
+      like those of a flat directory */
+static int _check_dir_index(blockCache* cache, int dir, uint8_t* table, int capacity, int level, uint64_t low, uint64_t high, char* blocks_checked, int features) {
+    int count = _index_count(table, capacity, features);
+    int pair_size = DIRINDEX_ENTRY_SIZE(features);
+    if (count == 0 || _index_hash(table, 0, features) != low) {
+        return ERR_BAD_DISK;
+    }
+    for (int j = count * pair_size; j < capacity * pair_size; j++) {
+        if (table[j] != 0) {
+            return ERR_BAD_DISK;
+        }
+    }
+    if ((ERR = _prefetch_blocks(cache, table + DIRINDEX_PTR, count, PTR_SIZE(features), pair_size)) < 0) {
+        return ERR;
+    }
+
+    uint8_t block[BLOCKSIZE];
+    char name[FILENAME_LENGTH + 1];
+    for (int i = 0; i < count; i++) {
+        uint64_t from = _index_hash(table, i, features);
+        uint64_t to = i + 1 < count ? _index_hash(table, i + 1, features) : high;
+        uint32_t ptr = _index_ptr(table, i, features);
+        if (from >= to || ptr >= (uint32_t) getDiskSize(cache->disk)) {
+            return ERR_BAD_DISK;
+        }
+        blocks_checked[ptr] = 1;
+        if ((ERR = cacheReadBlock(cache, ptr, block)) < 0) {
+            return ERR;
+        }
+        if (block[SAFETY_BYTE_LOC] != SAFETY_HEX || block[EMPTY_BYTE_LOC] != EMPTY_TABLEVAL) {
+            return ERR_BAD_DISK;
+        }
+
+        if (level > 0) {
+            if (block[BLOCK_TYPE_LOC] != DIRINDEX || block[DIRINDEX_LEVEL_LOC] != level - 1) {
+                return ERR_BAD_DISK;
+            }
+            int child_capacity;
+            uint8_t* child = _index_table(block, false, &child_capacity, features);
+            if ((ERR = _check_dir_index(cache, dir, child, child_capacity, level - 1, from, to, blocks_checked, features)) < 0) {
+                return ERR;
+            }
+            continue;
+        }
+
+        if (block[BLOCK_TYPE_LOC] != DIRLEAF || block[DIRINDEX_LEVEL_LOC] != EMPTY_TABLEVAL) {
+            return ERR_BAD_DISK;
+        }
+        int range = MAX_DIRLEAF_BYTES / DIRENT_SIZE(features);
+        uint8_t* entries = block + FIRST_DIRLEAF_LOC;
+        if ((ERR = _prefetch_blocks(cache, entries, range, PTR_SIZE(features), DIRENT_SIZE(features))) < 0) {
+            return ERR;
+        }
+        if ((ERR = _check_dirents(cache, dir, entries, range, blocks_checked, features)) < 0) {
+            return ERR;
+        }
+        for (int j = 0; j < range; j++) {
+            if (_dirent_inode(entries, j, features) == 0) {
+                continue;
+            }
+            memcpy(name, entries + j * DIRENT_SIZE(features) + DIRENT_NAME(features), FILENAME_LENGTH);
+            name[FILENAME_LENGTH] = '\0';
+            uint64_t hash = _dir_hash(name);
+            if (hash < from || hash >= to) {
+                return ERR_BAD_DISK;
+            }
+        }
+    }
+    return TFS_SUCCESS;
+}
+
 /* _check_block_con(): checks that the given block is of the given block_type 
     + fills out the blocks_checked flag array for each block it checks
     - errors if the block is not formatted as the type specified */
 /* if given the superblock, it will check each block in the tfs (if the tfs is correct) */
-int _check_block_con(int diskNum, int block, int block_type, char* blocks_checked) {
+/* features are the TFS_FEAT_* flags of the disk, they decide how its pointers look */
+/* an INDIRECT or EXTENT block is checked with everything below it, returning how many data blocks that is */
+int _check_block_con(blockCache* cache, int block, int block_type, char* blocks_checked, int features) {
+    int ptr_size = PTR_SIZE(features);
+    /* a pointer outside the disk can only come from a corrupted block */
+    if (block < 0 || block >= getDiskSize(cache->disk)) {
+        return ERR_BAD_DISK;
+    }
     blocks_checked[block] = 1;
 
-    char buffer[BLOCKSIZE];
-    if ((ERR = readBlock(diskNum, block, buffer)) < 0) {
+    uint8_t buffer[BLOCKSIZE];
+    if ((ERR = cacheReadBlock(cache, block, buffer)) < 0) {
         return ERR;
     }
 
-    char byte0 = buffer[BLOCK_TYPE_LOC];
-    char byte1 = buffer[SAFETY_BYTE_LOC];
-    char byte2 = buffer[FREE_PTR_LOC];
-    char byte3 = buffer[EMPTY_BYTE_LOC];
+    uint8_t byte0 = buffer[BLOCK_TYPE_LOC];
+    uint8_t byte1 = buffer[SAFETY_BYTE_LOC];
+    uint8_t byte2 = buffer[FREE_PTR_LOC];
+    uint8_t byte3 = buffer[EMPTY_BYTE_LOC];
     blocks_checked[block] = 1;
     if (block_type == SUPERBLOCK) {
         /* check the first four bytes */
-        if (byte0 != SUPERBLOCK || byte1 != SAFETY_HEX || byte3 != EMPTY_TABLEVAL) {
+        if (byte0 != SUPERBLOCK || byte1 != SAFETY_HEX || (byte3 & ~TFS_FEAT_KNOWN)) {
+            return ERR_BAD_DISK;
+        }
+        if (features != byte3 || ((byte3 & TFS_FEAT_ADDR32) && !(byte3 & TFS_FEAT_BITMAP))) {
+            return ERR_BAD_DISK;
+        }
+        if ((byte3 & TFS_FEAT_INDIRECT) && (byte3 & TFS_FEAT_EXTENTS)) {
+            return ERR_BAD_DISK;
+        }
+        if ((byte3 & TFS_FEAT_DIRINDEX) && !(byte3 & TFS_FEAT_DIRENTS)) {
             return ERR_BAD_DISK;
         }
 
+        /* a bitmap disk has no free list to follow, the caller checks its bitmap */
+        if (byte2 != 0 && (byte3 & TFS_FEAT_BITMAP)) {
+            return ERR_BAD_DISK;
+        }
         if (byte2 != 0) {
-            if ((ERR = _check_block_con(diskNum, byte2, FREE, blocks_checked)) < 0) {
+            if ((ERR = _check_block_con(cache, byte2, FREE, blocks_checked, features)) < 0) {
                 return ERR;
             }
         }
 
-        // check that everything in the inode is a data block / inode block (for dirs)
-        for (int i = FIRST_SUPBLOCK_INODE_LOC; i < MAX_SUPBLOCK_INODES + FIRST_SUPBLOCK_INODE_LOC; i++) {
-            if ((buffer[i] != 0) && ((ERR = _check_block_con(diskNum, buffer[i], INODE, blocks_checked)) < 0)) {
-                return ERR;
+        /* the root may be a directory inode of its own, the superblock only pointing at it */
+        if (byte3 & TFS_FEAT_ROOTDIR) {
+            uint32_t root = _get_ptr(buffer + ROOT_INODE_LOC, 0, ptr_size);
+            for (int i = ROOT_INODE_LOC + ptr_size; i < BLOCKSIZE; i++) {
+                if (buffer[i] != 0) {
+                    return ERR_BAD_DISK;
+                }
+            }
+            if (root == SUPERBLOCK_DISKLOC || (ERR = _check_block_con(cache, root, INODE, blocks_checked, features)) < 0) {
+                return ERR_BAD_DISK;
             }
+            return cacheReadBlock(cache, root, buffer) < 0 || buffer[FILE_TYPE_FLAG_LOC] != FILE_TYPE_DIR ? ERR_BAD_DISK : TFS_SUCCESS;
+        }
+
+        // check that everything in the inode is a data block / inode block (for dirs)
+        int range = MAX_SUPBLOCK_INODES / DIRENT_SIZE(features);
+        if ((ERR = _prefetch_blocks(cache, buffer + FIRST_SUPBLOCK_INODE_LOC, range, ptr_size, DIRENT_SIZE(features))) < 0) {
+            return ERR;
+        }
+        if ((ERR = _check_dirents(cache, SUPERBLOCK_DISKLOC, buffer + FIRST_SUPBLOCK_INODE_LOC, range, blocks_checked, features)) < 0) {
+            return ERR;
         }
     }
     else if (block_type == INODE) {
         /* check the first four bytes */
-        if (byte0 != INODE || byte1 != SAFETY_HEX || byte2 != EMPTY_TABLEVAL || byte3 != EMPTY_TABLEVAL) {
+        if (byte0 != INODE || byte1 != SAFETY_HEX || byte2 != EMPTY_TABLEVAL) {
             return ERR_BAD_DISK;
         }
         /* check that the file type flag is valid */
@@ -53,9 +1400,18 @@ int _check_block_con(int diskNum, int block, int block_type, char* blocks_checke
         if (file_type != FILE_TYPE_DIR && file_type != FILE_TYPE_FILE) {
             return ERR_BAD_DISK;
         }
+        /* only the file inodes of an extent disk may say that their map spilled,
+            only those of an inline disk that they hold their data, and only the
+            directory inodes of a directory index disk that they hold an index */
+        bool extents = file_type == FILE_TYPE_FILE && (features & TFS_FEAT_EXTENTS);
+        bool inline_data = file_type == FILE_TYPE_FILE && (features & TFS_FEAT_INLINE) && byte3 == FILE_MAP_INLINE;
+        bool dir_index = file_type == FILE_TYPE_DIR && (features & TFS_FEAT_DIRINDEX) && byte3 == DIR_MAP_INDEX;
+        if (byte3 != EMPTY_TABLEVAL && !(extents && byte3 == FILE_MAP_EXTENT_TREE) && !inline_data && !dir_index) {
+            return ERR_BAD_DISK;
+        }
      
         /* check that the name is valid */
-        char* filename = buffer + FILE_NAME_LOC;
+        char* filename = (char*) buffer + FILE_NAME_LOC;
         if (buffer[FILE_NAME_LOC + FILENAME_LENGTH] != 0 || strlen(filename) <= 0) {
             return ERR_BAD_DISK;
         }
@@ -64,35 +1420,124 @@ int _check_block_con(int diskNum, int block, int block_type, char* blocks_checke
         int num_data = 0;
         int size = 0;
         int start_bound = file_type == FILE_TYPE_FILE ? FILE_DATA_LOC : DIR_DATA_LOC;
-        int range = file_type == FILE_TYPE_FILE ? MAX_FILE_DATA : MAX_DIR_INODES;
-        for (int i = start_bound; i < range; i++) {
-            if (buffer[i] != 0) {
+        int range = file_type == FILE_TYPE_FILE ? MAX_FILE_DATA / ptr_size : MAX_DIR_INODES / DIRENT_SIZE(features);
+        /* inline data takes no blocks, the table is the data, and has to fit there */
+        if (inline_data) {
+            uint8_t* s = buffer + FILE_SIZE_LOC;
+            size = (s[0] << 24) + (s[1] << 16) + (s[2] << 8) + s[3];
+            if (size <= 0 || size > MAX_INLINE_DATA) {
+                return ERR_BAD_DISK;
+            }
+            range = 0;
+        } else if (extents) {
+            int slots = MAX_FILE_DATA / EXTENT_SIZE(features);
+            num_data = _check_extents(cache, buffer + FILE_DATA_LOC, slots, 0, byte3 == FILE_MAP_EXTENT_TREE ? EXTENT : FILEEX, blocks_checked, features);
+            if (num_data < 0) {
+                return num_data;
+            }
+            uint8_t* s = buffer + FILE_SIZE_LOC;
+            size = (s[0] << 24) + (s[1] << 16) + (s[2] << 8) + s[3];
+            range = 0;
+        }
+        /* an indexed directory's entries are in the leaves of its index */
+        if (dir_index) {
+            int levels = buffer[DIR_INDEX_LEVELS_LOC];
+            int capacity;
+            uint8_t* table = _index_table(buffer, true, &capacity, features);
+            if (levels > DIR_INDEX_MAX_LEVELS) {
+                return ERR_BAD_DISK;
+            }
+            return _check_dir_index(cache, block, table, capacity, levels, 0, (uint64_t) UINT32_MAX + 1, blocks_checked, features);
+        }
+        int stride = file_type == FILE_TYPE_FILE ? ptr_size : DIRENT_SIZE(features);
+        if ((ERR = _prefetch_blocks(cache, buffer + start_bound, range, ptr_size, stride)) < 0) {
+            return ERR;
+        }
+
+        /* directories hold inode blocks only */
+        if (file_type == FILE_TYPE_DIR) {
+            return _check_dirents(cache, block, buffer + start_bound, range, blocks_checked, features);
+        }
+        int direct = _direct_slots(features);
+        for (int i = 0; i < range; i++) {
+            uint32_t ptr = _get_ptr(buffer + start_bound, i, ptr_size);
+            if (ptr != 0) {
                 /* make sure file inodes only have data blocks, and count how many*/
-                if (file_type == FILE_TYPE_FILE) {
+                if (file_type == FILE_TYPE_FILE && i < direct) {
                     num_data++;
-                    if ((ERR = _check_block_con(diskNum, buffer[i], FILEEX, blocks_checked)) < 0) {
+                    if ((ERR = _check_block_con(cache, ptr, FILEEX, blocks_checked, features)) < 0) {
+                        return ERR;
+                    }
+                }
+                /* past the direct pointers come the indirect trees, one level deeper each */
+                if (file_type == FILE_TYPE_FILE && i >= direct) {
+                    if ((ERR = _check_block_con(cache, ptr, INDIRECT, blocks_checked, features)) < 0) {
                         return ERR;
                     }
+                    num_data += ERR;
+                    if (_indirect_level(cache, ptr) != i - direct + 1) {
+                        return ERR_BAD_DISK;
+                    }
+                }
+                if (file_type == FILE_TYPE_FILE) {
 
                     /* grab the size, to check if the number of data blocks correlates */
-                    int s = FILE_SIZE_LOC;
-                    size = (buffer[s] << 24) + (buffer[s + 1] << 16) + (buffer[s + 2] << 8) + buffer[s + 3];
-
-                /* make sure directory inodes only contain inode blocks*/
-                } else if (file_type == FILE_TYPE_DIR  && (_check_block_con(diskNum, buffer[i], INODE, blocks_checked) != 0)) {
-                    return ERR_BAD_DISK;
+                    uint8_t* s = buffer + FILE_SIZE_LOC;
+                    size = (s[0] << 24) + (s[1] << 16) + (s[2] << 8) + s[3];
                 }
             }
         }
 
         /* if a file, make sure the amount of data blocks correlates to the amount of data blocks it has*/
-        if (file_type == FILE_TYPE_FILE && (((size-1) / MAX_DATA_SPACE + 1 != num_data))) {
+        if (file_type == FILE_TYPE_FILE && !inline_data && (((size-1) / MAX_DATA_SPACE + 1 != num_data))) {
             if(!(size == 0 && num_data == 0)) {
                 return ERR_BAD_DISK;
             }
         }
     }
 
+    else if (block_type == INDIRECT) {
+        /* check the first four bytes */
+        if (byte0 != INDIRECT || byte1 != SAFETY_HEX || byte2 < 1 || byte2 > INDIRECT_LEVELS || byte3 != EMPTY_TABLEVAL) {
+            return ERR_BAD_DISK;
+        }
+
+        /* everything below is a data block, or an indirect block one level lower */
+        int num_data = 0;
+        int range = MAX_INDIRECT_PTRS / ptr_size;
+        if ((ERR = _prefetch_blocks(cache, buffer + FIRST_INDIRECT_LOC, range, ptr_size, ptr_size)) < 0) {
+            return ERR;
+        }
+        for (int i = 0; i < range; i++) {
+            uint32_t ptr = _get_ptr(buffer + FIRST_INDIRECT_LOC, i, ptr_size);
+            if (ptr == 0) {
+                continue;
+            }
+            if ((ERR = _check_block_con(cache, ptr, byte2 == 1 ? FILEEX : INDIRECT, blocks_checked, features)) < 0) {
+                return ERR;
+            }
+            if (byte2 == 1) {
+                num_data++;
+            } else if (_indirect_level(cache, ptr) != byte2 - 1) {
+                return ERR_BAD_DISK;
+            } else {
+                num_data += ERR;
+            }
+        }
+        return num_data;
+    }
+
+    else if (block_type == EXTENT) {
+        /* check the first four bytes */
+        if (byte0 != EXTENT || byte1 != SAFETY_HEX || byte2 != EMPTY_TABLEVAL || byte3 != EMPTY_TABLEVAL) {
+            return ERR_BAD_DISK;
+        }
+        /* an EXTENT block is never left empty */
+        uint32_t first = _get_extent(buffer + FIRST_EXTENT_LOC, 0, EXTENT_LOGICAL, features);
+        int num_data = _check_extents(cache, buffer + FIRST_EXTENT_LOC, MAX_EXTENT_BYTES / EXTENT_SIZE(features), first, FILEEX, blocks_checked, features);
+        return num_data == 0 ? ERR_BAD_DISK : num_data;
+    }
+
     else if (block_type == FILEEX) {
         /* check the first four bytes */
         if (byte0 != FILEEX || byte1 != SAFETY_HEX || byte2 != EMPTY_TABLEVAL || byte3 != EMPTY_TABLEVAL) {
@@ -107,7 +1552,7 @@ int _check_block_con(int diskNum, int block, int block_type, char* blocks_checke
         }
 
         if (byte2 != 0) {
-            return _check_block_con(diskNum, byte2, FREE, blocks_checked);
+            return _check_block_con(cache, byte2, FREE, blocks_checked, features);
         }
     }
     
@@ -125,18 +1570,15 @@ int _check_block_con(int diskNum, int block, int block_type, char* blocks_checke
         - if a directory along that path cannot be found */
 int _navigate_to_dir(char* dirName, char* last_path_h, int* current_h, int* parent_h, int searching_for) {
 
-    /* The superblock effectively behaves as the inode for the root */
-    int current = SUPERBLOCK_DISKLOC;
-    char current_block[BLOCKSIZE]; 
+    /* Start at the root (the superblock effectively behaves as its inode on disks
+        without TFS_FEAT_ROOTDIR), directories are only read once a lookup misses
+        the dentry cache */
+    int current = mounted->root;
     int parent = current;
-    if ((ERR = readBlock(mounted->diskNum, SUPERBLOCK_DISKLOC, current_block)) < 0) {
-        return ERR;
-    }
 
     bool dir_found_flag = false; 
     int path_index = _find_path_start(dirName);
     char cur_path[FILENAME_LENGTH + 1]; 
-    char inode_buffer[BLOCKSIZE];
 
     /* navigate through the directories until the end */
     while (path_index != strlen(dirName) + 1) {
@@ -147,44 +1589,28 @@ int _navigate_to_dir(char* dirName, char* last_path_h, int* current_h, int* pare
             return path_index;
         }
 
-        /* look through the inode pointers in the parent_block for the next path */
-        dir_found_flag = false;
-
-        /* set the bounds for i based on wether in the superblock or a directory inode */
-        int start_bound = current == 0 ? FIRST_SUPBLOCK_INODE_LOC : DIR_DATA_LOC;
-        int range = current == 0 ? MAX_SUPBLOCK_INODES : MAX_DIR_INODES;
-        for(int i = start_bound; i < range + start_bound; i++) {
-
-            /* skip over if we have an empty block, meaning no inode exists there */
-            if(!current_block[i]) {
-                continue;
-            }
-
-            /* Grab the name from the inode buffer */
-            memset(inode_buffer, 0, BLOCKSIZE);
-            if ((ERR = readBlock(mounted->diskNum, current_block[i], inode_buffer)) < 0) {
-                return ERR;
+        /* ask the dentry cache first, else look the next path up in the current
+            directory and remember what was found */
+        uint32_t child = 0;
+        int type = 0;
+        if (!dcacheLookup(mounted->dentries, current, cur_path, &child, &type)) {
+            int inode_num = _dir_lookup(current, cur_path, &type);
+            if (inode_num < 0) {
+                return inode_num;
             }
-            char* filename = inode_buffer + FILE_NAME_LOC; 
-
-            /* if found, reset that directory as the parent_block */
-            if(strcmp(cur_path, filename) == 0) {
-                dir_found_flag = true;
-
-                /* make sure the file found is of type 'directory' */
-                if (inode_buffer[FILE_TYPE_FLAG_LOC] == FILE_TYPE_FILE && (path_index != strlen(dirName) + 1 || searching_for == FILE_TYPE_DIR)) {
-                    return ERR_NOT_A_DIR;
-                }
+            child = inode_num;
+            dcacheInsert(mounted->dentries, current, cur_path, child, type);
+        }
 
-                /* get the inode of the found directory and store it as the parent */
-                parent = current;
-                current = current_block[i];
-                if ((ERR = readBlock(mounted->diskNum, current_block[i], current_block)) < 0) {                    
-                    return ERR;
-                }
-                
-                break;
+        /* if found, reset that directory as the current one */
+        dir_found_flag = child != 0;
+        if (dir_found_flag) {
+            /* make sure the file found is of type 'directory' */
+            if (type == FILE_TYPE_FILE && (path_index != strlen(dirName) + 1 || searching_for == FILE_TYPE_DIR)) {
+                return ERR_NOT_A_DIR;
             }
+            parent = current;
+            current = child;
         }
 
         /* if not at the last path and unable to find the directory, error */
@@ -243,7 +1669,7 @@ int _update_fd_table_index() {
 
     /* iterate to the end of the list until next available fd */
     for(int i = fd_table_index; i < FD_TABLESIZE; i++) {
-        if(fd_table[fd_table_index] == EMPTY_TABLEVAL) {
+        if(fd_table[fd_table_index].inodeNum == EMPTY_TABLEVAL) {
             return fd_table_index;
         } else {
             fd_table_index++;
@@ -253,7 +1679,7 @@ int _update_fd_table_index() {
     /* Start over until up until original starting point */
     fd_table_index = 0;
     for(int i=0; i < original; i++) {
-        if(fd_table[fd_table_index] == EMPTY_TABLEVAL) {
+        if(fd_table[fd_table_index].inodeNum == EMPTY_TABLEVAL) {
             return fd_table_index;
         } else {
             fd_table_index++;
@@ -264,171 +1690,650 @@ int _update_fd_table_index() {
     return ERR_OUT_OF_FDS;
 }
 
+/* _open_file(): the open file behind a file descriptor
+    > returns NULL if FD is not an open descriptor */
+openFile* _open_file(int FD) {
+    if (FD < 0 || FD >= FD_TABLESIZE || fd_table[FD].inodeNum == EMPTY_TABLEVAL) {
+        return NULL;
+    }
+    return &fd_table[FD];
+}
+
+/* _open_inode(): open the file with the given inode on descriptor FD, at offset 0
+    + another descriptor's unwritten changes to the inode are written first, so the
+      new copy starts from the newest inode */
+int _open_inode(int FD, uint32_t inode_num) {
+    for (int i = 0; i < FD_TABLESIZE; i++) {
+        if (fd_table[i].inodeNum == inode_num && (ERR = _flush_open_file(&fd_table[i])) < 0) {
+            return ERR;
+        }
+    }
+    if ((ERR = cacheReadBlock(mounted->cache, inode_num, fd_table[FD].inode)) < 0) {
+        return ERR;
+    }
+    fd_table[FD].inodeNum = inode_num;
+    fd_table[FD].offset = 0;
+    fd_table[FD].dirty = false;
+    fd_table[FD].writer = NULL;
+    return TFS_SUCCESS;
+}
+
+/* _flush_open_file(): hand a descriptor's changes to its inode to the cache */
+int _flush_open_file(openFile* file) {
+    if (!file->dirty) {
+        return TFS_SUCCESS;
+    }
+    if ((ERR = cacheWriteBlock(mounted->cache, file->inodeNum, file->inode)) < 0) {
+        return ERR;
+    }
+    file->dirty = false;
+    return TFS_SUCCESS;
+}
+
+/* _flush_open_files(): _flush_open_file() every open descriptor of the mounted tfs */
+int _flush_open_files() {
+    for (int i = 0; i < FD_TABLESIZE; i++) {
+        if (fd_table[i].inodeNum != EMPTY_TABLEVAL && (ERR = _flush_open_file(&fd_table[i])) < 0) {
+            return ERR;
+        }
+    }
+    return TFS_SUCCESS;
+}
+
+/* _stamp_atime(): record that an open file was read, as the mount's TFS_ATIME_* policy says
+    + TFS_ATIME_LAZY stamps the descriptor's copy without making it dirty, so the time
+      is written only if something else flushes the inode, and lost otherwise */
+void _stamp_atime(openFile* file) {
+    unsigned long now = time(NULL);
+    switch (mounted->atimePolicy) {
+        case TFS_ATIME_NOATIME:
+            return;
+        case TFS_ATIME_LAZY:
+            _write_long(file->inode, now, FILE_ACCESSTIME_LOC);
+            return;
+        case TFS_ATIME_RELATIME: {
+            unsigned long atime = _read_long(file->inode, FILE_ACCESSTIME_LOC);
+            if (atime > _read_long(file->inode, FILE_MODIFIEDTIME_LOC) && (long) (now - atime) < RELATIME_INTERVAL) {
+                return;
+            }
+            break;
+        }
+    }
+    _write_long(file->inode, now, FILE_ACCESSTIME_LOC);
+    file->dirty = true;
+}
+
+/* _read_file(): copy up to 'size' bytes of an open file, starting at 'offset', into 'buffer'
+    + each data block is looked up once and the blocks are read in batches of half
+      the cache with cacheReadBlocks(), so a run of consecutive blocks (an extent)
+      that misses the cache becomes one disk read, and each payload is copied whole
+    > returns how many bytes were copied, fewer than size at the end of the file
+    - errors if offset is past the end of the file */
+int _read_file(openFile* file, char* buffer, int size, int offset) {
+    uint8_t* s = file->inode + FILE_SIZE_LOC;
+    int file_size = (s[0] << 24) + (s[1] << 16) + (s[2] << 8) + s[3];
+    if (offset > file_size) {
+        return ERR_FILE_PNTR_OUT_OF_BOUNDS;
+    }
+    if (size > file_size - offset) {
+        size = file_size - offset;
+    }
+    if (size <= 0) {
+        return 0;
+    }
+
+    /* inline data is all in the inode already */
+    if (file->inode[FILE_MAP_LOC] & FILE_MAP_INLINE) {
+        memcpy(buffer, file->inode + FILE_DATA_LOC + offset, size);
+        return size;
+    }
+
+    int window = mounted->cache->capacity / 2 > 0 ? mounted->cache->capacity / 2 : 1;
+    uint8_t* scratch = (uint8_t*) malloc(window * BLOCKSIZE);
+    blockIO* ios = (blockIO*) malloc(window * sizeof(blockIO));
+    if (scratch == NULL || ios == NULL) {
+        free(scratch);
+        free(ios);
+        return SYS_ERR_MALLOC;
+    }
+
+    int status = TFS_SUCCESS;
+    int copied = 0;
+    int block_num = offset / MAX_DATA_SPACE;
+    while (copied < size && status >= 0) {
+        /* look up the next batch of blocks */
+        int batch = 0;
+        int end = offset + size;
+        while (batch < window && (block_num + batch) * MAX_DATA_SPACE < end) {
+            int block = _file_block(file->inode, block_num + batch);
+            if (block <= 0) {
+                status = block < 0 ? block : ERR_BAD_DISK;
+                break;
+            }
+            ios[batch].bNum = block;
+            ios[batch].block = scratch + batch * BLOCKSIZE;
+            batch++;
+        }
+        if (status < 0 || (status = cacheReadBlocks(mounted->cache, ios, batch)) < 0) {
+            break;
+        }
+
+        /* copy the payloads, the first and last may be partial */
+        for (int i = 0; i < batch; i++) {
+            int from = (offset + copied) % MAX_DATA_SPACE;
+            int length = MAX_DATA_SPACE - from;
+            if (length > size - copied) {
+                length = size - copied;
+            }
+            memcpy(buffer + copied, scratch + i * BLOCKSIZE + FIRST_DATA_LOC + from, length);
+            copied += length;
+        }
+        block_num += batch;
+    }
+
+    free(scratch);
+    free(ios);
+    return status < 0 ? status : copied;
+}
+
+/* _stream_flush(): write the block a stream is filling to a newly taken block
+    + the block follows the stream's last one when that is free, so a stream
+      written without interruption lands in as few runs as the disk allows
+    - errors with ERR_DISK_OUT_OF_SPACE if the file cannot take another block */
+int _stream_flush(openFile* file, int policy) {
+    fileWriter* writer = file->writer;
+    if (writer->numBlocks >= _max_file_blocks(mounted->features)) {
+        return ERR_DISK_OUT_OF_SPACE;
+    }
+    if (writer->numBlocks == writer->capacity) {
+        int capacity = writer->capacity > 0 ? writer->capacity * 2 : 16;
+        uint32_t* blocks = (uint32_t*) realloc(writer->blocks, capacity * sizeof(uint32_t));
+        if (blocks == NULL) {
+            return SYS_ERR_MALLOC;
+        }
+        writer->blocks = blocks;
+        writer->capacity = capacity;
+    }
+
+    uint32_t last = writer->numBlocks > 0 ? writer->blocks[writer->numBlocks - 1] : 0;
+    uint32_t* block = writer->blocks + writer->numBlocks;
+    if ((ERR = _alloc_blocks_after(last, 1, block, policy)) < 0) {
+        return ERR;
+    }
+    writer->partial[BLOCK_TYPE_LOC] = FILEEX;
+    writer->partial[SAFETY_BYTE_LOC] = SAFETY_HEX;
+    writer->partial[FREE_PTR_LOC] = EMPTY_TABLEVAL;
+    writer->partial[EMPTY_BYTE_LOC] = EMPTY_TABLEVAL;
+    if ((ERR = cacheWriteBlock(mounted->cache, *block, writer->partial)) < 0) {
+        _free_block(*block);
+        return ERR;
+    }
+    writer->numBlocks++;
+    writer->partialBytes = 0;
+    memset(writer->partial, 0, BLOCKSIZE);
+    return TFS_SUCCESS;
+}
+
+/* _stream_abort(): close a descriptor's write stream, giving back the blocks it wrote */
+void _stream_abort(openFile* file) {
+    if (file->writer == NULL) {
+        return;
+    }
+    _free_blocks(file->writer->blocks, file->writer->numBlocks);
+    free(file->writer->blocks);
+    free(file->writer);
+    file->writer = NULL;
+}
+
+/* _write_inode(): write a changed file inode to the cache and to every descriptor
+    that has the file open, which then have nothing left to write
+    + the newest access time any descriptor stamped goes along, so a read through one
+      descriptor is not forgotten when another one writes */
+int _write_inode(uint32_t inode_num, uint8_t* inode) {
+    for (int i = 0; i < FD_TABLESIZE; i++) {
+        if (fd_table[i].inodeNum == inode_num && _read_long(fd_table[i].inode, FILE_ACCESSTIME_LOC) > _read_long(inode, FILE_ACCESSTIME_LOC)) {
+            _write_long(inode, _read_long(fd_table[i].inode, FILE_ACCESSTIME_LOC), FILE_ACCESSTIME_LOC);
+        }
+    }
+    if ((ERR = cacheWriteBlock(mounted->cache, inode_num, inode)) < 0) {
+        return ERR;
+    }
+    for (int i = 0; i < FD_TABLESIZE; i++) {
+        if (fd_table[i].inodeNum == inode_num) {
+            memcpy(fd_table[i].inode, inode, BLOCKSIZE);
+            fd_table[i].dirty = false;
+        }
+    }
+    return TFS_SUCCESS;
+}
+
 /* Pop and return the next free block, and replace the parent index
- with that block's next block. Should return 0 if no more free blocks exist. */
-char _pop_free_block() {
+ with that block's next block. Returns ERR_DISK_OUT_OF_SPACE if no more free blocks exist. */
+int _pop_free_block() {
+    /* bitmap disks allocate from the in-memory bitmap, without any block I/O */
+    if (mounted->freeSpace != NULL) {
+        return freeMapAlloc(mounted->freeSpace);
+    }
+
     // Grab the superblock. This is done locally as some functions may not
     // need to store the superblock so this function does it just in case
     char superblock[BLOCKSIZE];
-    if ((ERR = readBlock(mounted->diskNum, SUPERBLOCK_DISKLOC, superblock)) < 0) {
+    if ((ERR = cacheReadBlock(mounted->cache, SUPERBLOCK_DISKLOC, superblock)) < 0) {
         return ERR;
     }
 
     char newBlock[BLOCKSIZE];
-    char next_free_block = superblock[FREE_PTR_LOC];
+    uint8_t next_free_block = superblock[FREE_PTR_LOC];
+    if (next_free_block == 0) {
+        return ERR_DISK_OUT_OF_SPACE;
+    }
     /* then, grab the address for the next free inode*/
-    if ((ERR = readBlock(mounted->diskNum, next_free_block, newBlock)) < 0) {
+    if ((ERR = cacheReadBlock(mounted->cache, next_free_block, newBlock)) < 0) {
         return ERR;
     }
     /* update next free block */
     superblock[FREE_PTR_LOC] = newBlock[FREE_PTR_LOC];
-    if ((ERR = writeBlock(mounted->diskNum, SUPERBLOCK_DISKLOC, superblock)) < 0) {
+    if ((ERR = cacheWriteBlock(mounted->cache, SUPERBLOCK_DISKLOC, superblock)) < 0) {
         return ERR;
     }
+    mounted->freeBlocks--;
     return next_free_block;
 }
 
+/* _count_free_list(): walk the free list of a free-list disk, for tfs_mount()
+    > returns how many blocks are on it (never more links than blocks) */
+int _count_free_list(blockCache* cache, int num_blocks) {
+    uint8_t block[BLOCKSIZE];
+    if ((ERR = cacheReadBlock(cache, SUPERBLOCK_DISKLOC, block)) < 0) {
+        return ERR;
+    }
+    int count = 0;
+    uint8_t next = block[FREE_PTR_LOC];
+    while (next != 0 && count < num_blocks) {
+        if ((ERR = cacheReadBlock(cache, next, block)) < 0) {
+            return ERR;
+        }
+        count++;
+        next = block[FREE_PTR_LOC];
+    }
+    return count;
+}
+
 /* free_block turns the given block into a free block, and also adds
     it to the list of free blocks. Returns a 0 on success or -1 on error*/
-int _free_block(char block_addr) {
+int _free_block(int block_addr) {
+    uint32_t block = block_addr;
+    return _free_blocks(&block, 1);
+}
+
+/* _free_blocks(): free 'count' blocks at once
+    + on a free-list disk the blocks are chained to each other in memory, the
+      last one pointing at the old head of the list, then written as one batch,
+      so the superblock is read and written once however many blocks go
+    + bitmap disks only flip the blocks' bits, the blocks themselves are left
+      as they are (nothing reads a block the bitmap calls free) */
+int _free_blocks(uint32_t* blocks, int count) {
+    if (count <= 0) {
+        return TFS_SUCCESS;
+    }
+    if (mounted->freeSpace != NULL) {
+        for (int i = 0; i < count; i++) {
+            if ((ERR = freeMapSetFree(mounted->freeSpace, blocks[i], true)) < 0) {
+                return ERR;
+            }
+        }
+        return TFS_SUCCESS;
+    }
+
     // Grab the superblock
     char superblock[BLOCKSIZE];
-    if ((ERR = readBlock(mounted->diskNum, SUPERBLOCK_DISKLOC, superblock)) < 0) {
+    if ((ERR = cacheReadBlock(mounted->cache, SUPERBLOCK_DISKLOC, superblock)) < 0) {
         return ERR;
     }
 
-    // Change block type
-    char clean_block[BLOCKSIZE];
-    clean_block[BLOCK_TYPE_LOC] = FREE;
-    clean_block[SAFETY_BYTE_LOC] = SAFETY_HEX;
-    clean_block[EMPTY_BYTE_LOC] = EMPTY_TABLEVAL;
-    clean_block[FREE_PTR_LOC] = superblock[FREE_PTR_LOC];
-    memset(clean_block + FIRST_DATA_LOC, 0, MAX_DATA_SPACE);
-    if ((ERR = writeBlock(mounted->diskNum, block_addr, clean_block)) < 0) {
+    uint8_t* clean_blocks = (uint8_t*) calloc(count, BLOCKSIZE);
+    blockIO* ios = (blockIO*) malloc(count * sizeof(blockIO));
+    if (clean_blocks == NULL || ios == NULL) {
+        free(clean_blocks);
+        free(ios);
+        return SYS_ERR_MALLOC;
+    }
+
+    // Change block types, each block pointing to the next one
+    for (int i = 0; i < count; i++) {
+        uint8_t* clean_block = clean_blocks + i * BLOCKSIZE;
+        clean_block[BLOCK_TYPE_LOC] = FREE;
+        clean_block[SAFETY_BYTE_LOC] = SAFETY_HEX;
+        clean_block[EMPTY_BYTE_LOC] = EMPTY_TABLEVAL;
+        clean_block[FREE_PTR_LOC] = i + 1 < count ? blocks[i + 1] : (uint8_t) superblock[FREE_PTR_LOC];
+        ios[i].bNum = blocks[i];
+        ios[i].block = clean_block;
+    }
+    ERR = cacheWriteBlocks(mounted->cache, ios, count);
+    free(clean_blocks);
+    free(ios);
+    if (ERR < 0) {
         return ERR;
     }
-    
+
     // Change free list
-    superblock[FREE_PTR_LOC] = block_addr;
-    if ((ERR = writeBlock(mounted->diskNum, SUPERBLOCK_DISKLOC, superblock)) < 0) {
+    superblock[FREE_PTR_LOC] = blocks[0];
+    if ((ERR = cacheWriteBlock(mounted->cache, SUPERBLOCK_DISKLOC, superblock)) < 0) {
         return ERR;
     }
+    mounted->freeBlocks += count;
 
     return TFS_SUCCESS;
 }
 
-int _print_directory_contents(int block, int tabs) {
+/* _alloc_blocks(): reserve 'count' free blocks for one write, filling 'blocks'
+    + TFS_ALLOC_EXTENT on a bitmap disk takes them as the fewest runs of
+      consecutive blocks: the first run that holds all that is left, otherwise
+      the longest run there is, and repeat
+    + anything else takes the next free blocks one at a time
+    - errors with ERR_DISK_OUT_OF_SPACE before taking any block if fewer than
+      'count' blocks are free, and gives back what it took on any other error */
+int _alloc_blocks(int count, uint32_t* blocks, int policy) {
+    int free_blocks = tfs_freeBlocks();
+    if (free_blocks < 0) {
+        return free_blocks;
+    }
+    if (free_blocks < count) {
+        return ERR_DISK_OUT_OF_SPACE;
+    }
 
-    char directory_inode[BLOCKSIZE];
-    if ((ERR = readBlock(mounted->diskNum, block, directory_inode)) < 0) {
-        return ERR;
+    int taken = 0;
+    if (policy == TFS_ALLOC_EXTENT && mounted->freeSpace != NULL) {
+        while (taken < count) {
+            int start;
+            int run = freeMapFindRun(mounted->freeSpace, count - taken, &start);
+            for (int i = 0; i < run; i++) {
+                freeMapSetFree(mounted->freeSpace, start + i, false);
+                blocks[taken++] = start + i;
+            }
+        }
+        return TFS_SUCCESS;
     }
 
-    char inode[BLOCKSIZE];
-    for(int i = 0; i < MAX_DIR_INODES; i++) {
+    while (taken < count) {
+        int block = _pop_free_block();
+        if (block < 0) {
+            _free_blocks(blocks, taken);
+            return block;
+        }
+        blocks[taken++] = block;
+    }
+    return TFS_SUCCESS;
+}
 
-        if(directory_inode[i + DIR_DATA_LOC]) {
+/* _alloc_blocks_after(): _alloc_blocks(), but first carry on from block 'last' (if
+    not 0) for as long as the blocks after it are free, on a bitmap disk
+    - on error every block taken is given back */
+int _alloc_blocks_after(uint32_t last, int count, uint32_t* blocks, int policy) {
+    int taken = 0;
+    while (mounted->freeSpace != NULL && last != 0 && taken < count && freeMapIsFree(mounted->freeSpace, last + 1)) {
+        blocks[taken++] = ++last;
+        freeMapSetFree(mounted->freeSpace, last, false);
+    }
+    int status = _alloc_blocks(count - taken, blocks + taken, policy);
+    if (status < 0) {
+        _free_blocks(blocks, taken);
+        return status;
+    }
+    return TFS_SUCCESS;
+}
 
-            if ((ERR = readBlock(mounted->diskNum, directory_inode[i + DIR_DATA_LOC], inode)) < 0) {
-                return ERR;
-            }
+/* _collect_fragmentation(): add the files under the given directory (the
+    superblock for the root) to the extent counts in 'stats' */
+int _collect_fragmentation(int block, fragStats* stats) {
+    dirEntry* entries;
+    int count = _dir_list(block, &entries, NULL, NULL);
+    if (count < 0) {
+        return count;
+    }
 
-            for(int i = 0; i < tabs; i++) {
-                printf("     ");
-            }
-            if(inode[FILE_TYPE_FLAG_LOC] == FILE_TYPE_DIR) {
-                printf("%s\n", (inode + FILE_NAME_LOC));
-                if ((ERR = _print_directory_contents(directory_inode[i + DIR_DATA_LOC], tabs+1)) < 0) {
-                    return ERR;
-                }
-            } else {
-                printf("%s\n", (inode + FILE_NAME_LOC));
+    int status = TFS_SUCCESS;
+    uint8_t inode[BLOCKSIZE];
+    for (int i = 0; i < count && status >= 0; i++) {
+        if ((status = cacheReadBlock(mounted->cache, entries[i].inode, inode)) < 0) {
+            break;
+        }
+
+        if (inode[FILE_TYPE_FLAG_LOC] == FILE_TYPE_DIR) {
+            status = _collect_fragmentation(entries[i].inode, stats);
+            continue;
+        }
+
+        /* every break in the block numbers starts another extent */
+        uint32_t* data;
+        int num_meta;
+        int num_data = _file_blocks(inode, &data, &num_meta);
+        if (num_data < 0) {
+            status = num_data;
+            break;
+        }
+        for (int j = 0; j < num_data; j++) {
+            if (j == 0 || data[j] != data[j - 1] + 1) {
+                stats->extents++;
             }
+        }
+        stats->dataBlocks += num_data;
+        stats->files += num_data > 0;
+        free(data);
+    }
 
+    free(entries);
+    return status < 0 ? status : TFS_SUCCESS;
+}
+
+/* _load_bitmap(): read the bitmap blocks of a bitmap disk into 'map'
+    + marks the bitmap blocks in blocks_checked
+    - errors if a bitmap block is malformed or marks blocks past the end of the disk free */
+int _load_bitmap(blockCache* cache, freeMap* map, char* blocks_checked) {
+    int num_bitmap = NUM_BITMAP_BLOCKS(map->numBlocks);
+    if (FIRST_BITMAP_DISKLOC + num_bitmap > map->numBlocks) {
+        return ERR_BAD_DISK;
+    }
+
+    uint8_t* bitmap = (uint8_t*) malloc(num_bitmap * BLOCKSIZE);
+    blockIO* ios = (blockIO*) malloc(num_bitmap * sizeof(blockIO));
+    if (bitmap == NULL || ios == NULL) {
+        free(bitmap);
+        free(ios);
+        return SYS_ERR_MALLOC;
+    }
+    for (int i = 0; i < num_bitmap; i++) {
+        ios[i].bNum = FIRST_BITMAP_DISKLOC + i;
+        ios[i].block = bitmap + i * BLOCKSIZE;
+    }
+
+    int status = cacheReadBlocks(cache, ios, num_bitmap);
+    for (int i = 0; i < num_bitmap && status == TFS_SUCCESS; i++) {
+        uint8_t* block = bitmap + i * BLOCKSIZE;
+        if (block[BLOCK_TYPE_LOC] != BITMAP || block[SAFETY_BYTE_LOC] != SAFETY_HEX ||
+            block[FREE_PTR_LOC] != EMPTY_TABLEVAL || block[EMPTY_BYTE_LOC] != EMPTY_TABLEVAL) {
+            status = ERR_BAD_DISK;
+        } else if (freeMapImport(map, i * BITMAP_BITS_PER_BLOCK, block + FIRST_BITMAP_LOC, BLOCKSIZE - FIRST_BITMAP_LOC) < 0) {
+            status = ERR_BAD_DISK;
         }
+        blocks_checked[FIRST_BITMAP_DISKLOC + i] = 1;
     }
+    freeMapClean(map);
+
+    free(bitmap);
+    free(ios);
+    return status;
+}
 
+/* _store_bitmap(): write the bitmap blocks whose bits changed since the last store
+    + bitmap blocks go through the cache like any other block, so this is only
+      a memory copy until the cache writes them back */
+int _store_bitmap(blockCache* cache, freeMap* map) {
+    uint8_t block[BLOCKSIZE];
+    for (int i = 0; i < NUM_BITMAP_BLOCKS(map->numBlocks); i++) {
+        if (!freeMapDirty(map, i * BITMAP_BITS_PER_BLOCK, BITMAP_BITS_PER_BLOCK)) {
+            continue;
+        }
+        memset(block, 0, BLOCKSIZE);
+        block[BLOCK_TYPE_LOC] = BITMAP;
+        block[SAFETY_BYTE_LOC] = SAFETY_HEX;
+        freeMapExport(map, i * BITMAP_BITS_PER_BLOCK, block + FIRST_BITMAP_LOC, BLOCKSIZE - FIRST_BITMAP_LOC);
+        if ((ERR = cacheWriteBlock(cache, FIRST_BITMAP_DISKLOC + i, block)) < 0) {
+            return ERR;
+        }
+    }
+    freeMapClean(map);
     return TFS_SUCCESS;
 }
 
+/* _abort_mount(): undo a tfs_mount() that failed part way through
+    > returns the given error, so the caller can return it directly */
+int _abort_mount(int diskNum, blockCache* cache, freeMap* free_space, char* blocks_checked, int error) {
+    free(blocks_checked);
+    freeMapDestroy(free_space);
+    cacheDestroy(cache);
+    closeDisk(diskNum);
+    return error;
+}
+
+/* _print_directory_contents(): print the names under a directory, 'tabs' levels deep
+    + walks an open directory descriptor entry by entry, without reading any sizes */
+int _print_directory_contents(int block, int tabs) {
+    openDir handle;
+    int status = _dir_snapshot(block, &handle);
+    if (status < 0) {
+        return status;
+    }
+
+    dirEntry entry;
+    while ((status = _dir_next(&handle, &entry, 1, false)) > 0) {
+        for(int t = 0; t < tabs; t++) {
+            printf("     ");
+        }
+        printf("%s\n", entry.name);
+        if(entry.type == FILE_TYPE_DIR && (status = _print_directory_contents(entry.inode, tabs+1)) < 0) {
+            break;
+        }
+    }
+
+    _dir_close(&handle);
+    return status < 0 ? status : TFS_SUCCESS;
+}
+
 /* given a file inode number and its parent, delete it */
-int _remove_inode_and_blocks(char inode_num, char parent) {
+int _remove_inode_and_blocks(int inode_num, int parent) {
     /* Grab the block's inode */
-    char inode[BLOCKSIZE]; 
-    if ((ERR = readBlock(mounted->diskNum, inode_num, inode)) < 0 ) {
+    uint8_t inode[BLOCKSIZE]; 
+    if ((ERR = cacheReadBlock(mounted->cache, inode_num, inode)) < 0 ) {
         return ERR;
     }
 
-    // Resetting the direct blocks so the data is "lost" since nothing is pointing to them
-    // Counter for clearing
-    int i = 0;
-    char dir_block = inode[FILE_DATA_LOC + i++];
-    while(dir_block != 0x0) {
-        // Allocating each block as "free" and adding them to the linked list
-        if ((ERR = _free_block(dir_block)) < 0) {
-            return ERR;
-        }
-        dir_block = inode[FILE_DATA_LOC + i++];
+    // Resetting the data and indirect blocks so the data is "lost" since nothing is pointing to them,
+    // freeing them together with the inode itself
+    uint32_t* blocks;
+    int num_meta;
+    int count = _file_blocks(inode, &blocks, &num_meta);
+    if (count < 0) {
+        return count;
     }
-
-    /* Finally, freeing the inode */
-    if ((ERR = _free_block(inode_num)) < 0) {
+    count += num_meta;
+    blocks[count++] = inode_num;
+    ERR = _free_blocks(blocks, count);
+    free(blocks);
+    if (ERR < 0) {
         return ERR;
     }
 
     /* close the file in the fd table and if there are 
-        multiple FDs for the file, close those too */
+        multiple FDs for the file, close those too (dropping their
+        unwritten changes, the inode block is already free) */
     for(int i = 0; i < FD_TABLESIZE; i++) {
-        if(fd_table[i] == inode_num) {
-            if ((ERR = tfs_closeFile(i)) < 0) {
-                return ERR;
-            }
+        if(fd_table[i].inodeNum == inode_num) {
+            _stream_abort(&fd_table[i]);
+            fd_table[i].inodeNum = EMPTY_TABLEVAL;
+            fd_table[i].dirty = false;
         }
     }
-    // Remove the inode number from the parent_block
-    char parent_block[BLOCKSIZE];
-    if ((ERR = readBlock(mounted->diskNum, parent, parent_block)) < 0 ) {
-        return ERR;
-    }
-
-    i = parent == SUPERBLOCK_DISKLOC ? FIRST_SUPBLOCK_INODE_LOC : DIR_DATA_LOC;
-    while (parent_block[i] != inode_num) i++;
-
-    parent_block[i] = EMPTY_TABLEVAL;
-    if ((ERR = writeBlock(mounted->diskNum, parent, parent_block)) < 0 ) {
+    // Remove the inode number from the parent, found by the name the inode had
+    if ((ERR = _dir_remove(parent, inode_num, (char*) inode + FILE_NAME_LOC)) < 0 ) {
         return ERR;
     }
+    dcacheForget(mounted->dentries, inode_num);
 
     return TFS_SUCCESS;
 }
 
-/* given an inode, finds the parent */
-int _fetch_parent(char inode_num) {
+/* given an inode, finds the parent
+    + the inode points back at it, only a pointer of 0 (INODE_PARENT_LOC) is looked into:
+      an entry of the superblock is found there, any other inode is from before parents
+      were kept and the disk is scanned for the directory holding it */
+int _fetch_parent(int inode_num) {
 
-    struct stat file_stat;
-    if (fstat(mounted->diskNum, &file_stat) == -1) {
-        return SYS_ERR_FSTAT;
-    }  
-
-    int num_blocks = file_stat.st_size / BLOCKSIZE; 
+    uint8_t inode[BLOCKSIZE];
+    if ((ERR = cacheReadBlock(mounted->cache, inode_num, inode)) < 0) {
+        return ERR;
+    }
+    uint32_t parent = _get_ptr(inode + INODE_PARENT_LOC, 0, mounted->ptrSize);
+    if (parent != 0) {
+        return parent;
+    }
+    if (mounted->root == SUPERBLOCK_DISKLOC) {
+        uint8_t superblock[BLOCKSIZE];
+        if ((ERR = cacheReadBlock(mounted->cache, SUPERBLOCK_DISKLOC, superblock)) < 0) {
+            return ERR;
+        }
+        int start_bound;
+        int range = _dir_slots(SUPERBLOCK_DISKLOC, &start_bound);
+        for (int j = 0; j < range; j++) {
+            if (_dirent_inode(superblock + start_bound, j, mounted->features) == (uint32_t) inode_num) {
+                return SUPERBLOCK_DISKLOC;
+            }
+        }
+    }
 
-    char buffer[BLOCKSIZE];
-    for(int i=0; i < num_blocks; i++) {
+    int num_blocks = getDiskSize(mounted->diskNum);
+    if (num_blocks < 0) {
+        return num_blocks;
+    }
 
-        if((ERR = readBlock(mounted->diskNum, i, buffer)) < 0) {
+    /* an indexed directory is asked for the inode's name instead of being scanned */
+    char name[FILENAME_LENGTH + 1];
+    memcpy(name, inode + FILE_NAME_LOC, FILENAME_LENGTH + 1);
+
+    /* scan the disk a chunk of blocks at a time, one batched read per chunk.
+        A freed block on a bitmap disk keeps its old contents, so it is never read */
+    uint8_t chunk[FETCH_PARENT_CHUNK][BLOCKSIZE];
+    blockIO ios[FETCH_PARENT_CHUNK];
+    int next = 0;
+    while (next < num_blocks) {
+        int num_ios = 0;
+        while (num_ios < FETCH_PARENT_CHUNK && next < num_blocks) {
+            if (mounted->freeSpace == NULL || !freeMapIsFree(mounted->freeSpace, next)) {
+                ios[num_ios].bNum = next;
+                ios[num_ios].block = chunk[num_ios];
+                num_ios++;
+            }
+            next++;
+        }
+        if((ERR = cacheReadBlocks(mounted->cache, ios, num_ios)) < 0) {
             return ERR;
         }
 
-        if(i == SUPERBLOCK_DISKLOC) {
-            for(int j = FIRST_SUPBLOCK_INODE_LOC; j < FIRST_SUPBLOCK_INODE_LOC + MAX_SUPBLOCK_INODES; j++) {
-                if(buffer[j] == inode_num) {
-                    return SUPERBLOCK_DISKLOC;
+        for (int k = 0; k < num_ios; k++) {
+            int i = ios[k].bNum;
+            uint8_t* buffer = chunk[k];
+
+            if (buffer[BLOCK_TYPE_LOC] == INODE && buffer[FILE_TYPE_FLAG_LOC] == FILE_TYPE_DIR && _dir_indexed(i, buffer)) {
+                int type;
+                int found = _dir_lookup(i, name, &type);
+                if (found < 0 || found == inode_num) {
+                    return found < 0 ? found : i;
                 }
-            }
-        } else {
-            if(buffer[BLOCK_TYPE_LOC] == INODE && buffer[FILE_TYPE_FLAG_LOC] == FILE_TYPE_DIR) {
-                for(int j = DIR_DATA_LOC; j < DIR_DATA_LOC + MAX_DIR_INODES; j++) {
-                    if(buffer[j] == inode_num) {
+            } else if(i == mounted->root || (buffer[BLOCK_TYPE_LOC] == INODE && buffer[FILE_TYPE_FLAG_LOC] == FILE_TYPE_DIR)) {
+                int start_bound;
+                int range = _dir_slots(i, &start_bound);
+                for(int j = 0; j < range; j++) {
+                    if(_dirent_inode(buffer + start_bound, j, mounted->features) == inode_num) {
                         return i;
                     }
                 }
@@ -439,6 +2344,22 @@ int _fetch_parent(char inode_num) {
     return ERR_BAD_DISK;
 }
 
+/* flush the mounted tfs's block cache, registered with atexit() by tfs_mount() so
+    programs that exit without unmounting do not lose cached writes */
+void _sync_at_exit() {
+    if (mounted != NULL) {
+        /* streams never committed are dropped, not published */
+        for (int i = 0; i < FD_TABLESIZE; i++) {
+            _stream_abort(&fd_table[i]);
+        }
+        _flush_open_files();
+        if (mounted->freeSpace != NULL) {
+            _store_bitmap(mounted->cache, mounted->freeSpace);
+        }
+        cacheSync(mounted->cache);
+    }
+}
+
 // Writing longs to a block, specifically for timestamps
 int _write_long(uint8_t* block, unsigned long longVal, char loc) { 
     char *longConverted = (char *)&longVal;
@@ -448,6 +2369,13 @@ int _write_long(uint8_t* block, unsigned long longVal, char loc) {
     return 0;
 }
 
+// Reading back a long written by _write_long()
+unsigned long _read_long(uint8_t* block, char loc) {
+    unsigned long longVal;
+    memcpy(&longVal, block + loc, sizeof(longVal));
+    return longVal;
+}
+
 // Formatting the path name
 int _find_path_start(char *path)
 {
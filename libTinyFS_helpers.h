@@ -8,15 +8,59 @@
 
 /* internal helper functions */
 int     _update_fd_table_index();
-char    _pop_free_block();
-int     _free_block(char block_addr);
+openFile* _open_file(int FD);
+openDir* _open_dir(int DD);
+int     _open_inode(int FD, uint32_t inode_num);
+int     _flush_open_file(openFile* file);
+int     _flush_open_files();
+int     _write_inode(uint32_t inode_num, uint8_t* inode);
+int     _read_file(openFile* file, char* buffer, int size, int offset);
+int     _stream_flush(openFile* file, int policy);
+void    _stream_abort(openFile* file);
+uint32_t _get_ptr(const uint8_t* table, int index, int ptr_size);
+void    _set_ptr(uint8_t* table, int index, int ptr_size, uint32_t value);
+int     _dir_slots(int block, int* loc);
+uint32_t _dirent_inode(const uint8_t* table, int index, int features);
+int     _dirent_read(const uint8_t* table, int index, char* name, int* type);
+void    _set_dirent(uint8_t* table, int index, uint32_t inode_num, int type, const char* name);
+int     _dir_lookup(int dir, const char* name, int* type);
+int     _dir_add(int dir, const char* name, int type, uint32_t child);
+int     _dir_remove(int dir, uint32_t child, const char* name);
+int     _dir_rename(int dir, uint32_t child, int type, const char* oldName, const char* newName);
+int     _dir_list(int dir, dirEntry** entries, uint32_t** blocks, int* num_blocks);
+int     _dir_release(int dir);
+int     _dir_snapshot(int dir, openDir* handle);
+int     _dir_next(openDir* handle, dirEntry* out, int max, bool sizes);
+void    _dir_close(openDir* handle);
+int     _direct_slots(int features);
+int     _indirect_span(int features, int level);
+int     _max_file_blocks(int features);
+int     _map_blocks(int features, int count);
+int     _map_size(uint32_t* data, int count);
+int     _file_block(uint8_t* inode, int index);
+int     _file_blocks(uint8_t* inode, uint32_t** blocks, int* num_meta);
+void    _build_map(uint8_t* inode, uint32_t* data, int count, uint32_t* meta, uint8_t* meta_blocks);
+int     _pop_free_block();
+int     _count_free_list(blockCache* cache, int num_blocks);
+int     _free_block(int block_addr);
+int     _free_blocks(uint32_t* blocks, int count);
 int     _parse_path(char* path, int index, char* buffer);
 int     _navigate_to_dir(char* dirName, char* last_path_h, int* current_h, int* parent_h, int searching_for); 
 int     _print_directory_contents(int block, int tabs);
 int     _write_long(uint8_t* block, unsigned long longVal, char loc);
-int     _remove_inode_and_blocks(char inode, char parent);
-int     _fetch_parent(char inode_num);
+unsigned long _read_long(uint8_t* block, char loc);
+void    _stamp_atime(openFile* file);
+int     _remove_inode_and_blocks(int inode, int parent);
+int     _fetch_parent(int inode_num);
 int     _find_path_start(char *path);
-int     _check_block_con(int diskNum, int block, int block_type, char* blocks_checked);
+int     _prefetch_blocks(blockCache* cache, uint8_t* table, int count, int ptr_size, int stride);
+int     _check_block_con(blockCache* cache, int block, int block_type, char* blocks_checked, int features);
+int     _alloc_blocks(int count, uint32_t* blocks, int policy);
+int     _alloc_blocks_after(uint32_t last, int count, uint32_t* blocks, int policy);
+int     _collect_fragmentation(int block, fragStats* stats);
+int     _load_bitmap(blockCache* cache, freeMap* map, char* blocks_checked);
+int     _store_bitmap(blockCache* cache, freeMap* map);
+int     _abort_mount(int diskNum, blockCache* cache, freeMap* free_space, char* blocks_checked, int error);
+void    _sync_at_exit();
 
 #endif
\ No newline at end of file
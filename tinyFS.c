@@ -4,27 +4,69 @@
 tinyFS* mounted = NULL;
 
 /* 
-- fd_table: gloabl array of inodes for open file descriptors on memory
-    > fd_table[fd] = inode corresponding to fd
-    > value of 0 means invalid fd / fd is available to be set
+- fd_table: gloabl array of open files (openFile) for open file descriptors on memory
+    > fd_table[fd].inodeNum = inode corresponding to fd, with a copy of it and the fd's offset
+    > inodeNum of 0 means invalid fd / fd is available to be set
 - fd_table_index: the next available index of fd_table once updated
     > updated by _update_fd_table_index()
 */
-uint8_t fd_table[FD_TABLESIZE]; 
+openFile fd_table[FD_TABLESIZE]; 
 int fd_table_index = 0;
 
+/* dir_table: open directory descriptors (openDir), each with the entries of its
+    directory as they were at tfs_opendir(), inUse of false means available */
+openDir dir_table[DIR_TABLESIZE];
+
 /* error status holder */
 int ERR = 0;
 
+/* how many blocks the block cache gets at the next tfs_mount() */
+static int cache_size = DEFAULT_CACHE_BLOCKS;
+
+/* how tfs_writeFile() picks the blocks for a file's data (TFS_ALLOC_*) */
+static int alloc_policy = TFS_ALLOC_FIRST_FREE;
+
+/* the TFS_ATIME_* policy the next tfs_mount() uses */
+static int atime_policy = TFS_ATIME_STRICT;
+
 int tfs_mkfs(char *filename, int nBytes) {
+    return tfs_mkfsFormat(filename, nBytes, 0);
+}
+
+int tfs_mkfsFormat(char *filename, off_t nBytes, int features) {
     /* error if given 0 bytes */
     if(nBytes == 0 || filename == NULL || strlen(filename) == 0) {
         return ERR_INVALID_INPUT;
     }
+    /* 32 bit pointers leave no room for a free list pointer in the block header */
+    if((features & ~TFS_FEAT_KNOWN) || ((features & TFS_FEAT_ADDR32) && !(features & TFS_FEAT_BITMAP))) {
+        return ERR_INVALID_INPUT;
+    }
+    /* a file inode maps its blocks either through indirect pointers or as extents */
+    if((features & TFS_FEAT_INDIRECT) && (features & TFS_FEAT_EXTENTS)) {
+        return ERR_INVALID_INPUT;
+    }
+    /* directory indexes find entries by the names kept in them */
+    if((features & TFS_FEAT_DIRINDEX) && !(features & TFS_FEAT_DIRENTS)) {
+        return ERR_INVALID_INPUT;
+    }
 
     /* find how many blocks the file will use and ensure that the disk size is not too large */
+    off_t max_blocks = features & TFS_FEAT_ADDR32 ? MAX_BLOCKS_ADDR32 : MAX_BLOCKS;
+    if(nBytes / BLOCKSIZE > max_blocks) {
+        return ERR_INVALID_INPUT;
+    }
     int number_of_blocks = nBytes / BLOCKSIZE;
-    if(number_of_blocks > MAX_BLOCKS) {
+
+    /* a bitmap disk only writes its metadata: the superblock and the bitmap blocks.
+        Every other block stays a hole of zeros until it is allocated */
+    int bitmap_blocks = features & TFS_FEAT_BITMAP ? NUM_BITMAP_BLOCKS(number_of_blocks) : 0;
+    int root_blocks = features & TFS_FEAT_ROOTDIR ? 1 : 0;
+    int blocks_written = features & TFS_FEAT_BITMAP ? 1 + bitmap_blocks + root_blocks : number_of_blocks;
+    if((features & TFS_FEAT_ROOTDIR) && number_of_blocks < 2) {
+        return ERR_INVALID_INPUT;
+    }
+    if((features & TFS_FEAT_BITMAP) && number_of_blocks <= blocks_written) {
         return ERR_INVALID_INPUT;
     }
 
@@ -34,42 +76,79 @@ int tfs_mkfs(char *filename, int nBytes) {
         return disk_descriptor;
     }
 
-    /* buffer to write data to newly opened disk*/
-    char buffer[BLOCKSIZE];
-    memset(buffer, 0, BLOCKSIZE);
-
-    /* initialize free blocks */
-    buffer[BLOCK_TYPE_LOC] = FREE;
-    buffer[SAFETY_BYTE_LOC] = SAFETY_HEX;
-    buffer[FREE_PTR_LOC] = 0x01;
-    for(int i = 1; i < number_of_blocks; i++) {
-
-        /* if not at the last block, link to the next free block */
-        if(i+1 != number_of_blocks) {
-            buffer[FREE_PTR_LOC]++;
+    /* build every block to be written in memory (at most MAX_BLOCKS blocks, or
+        the superblock and bitmap), so the file system is laid down with one batched write */
+    uint8_t* blocks = (uint8_t*) calloc(blocks_written, BLOCKSIZE);
+    blockIO* ios = (blockIO*) malloc(blocks_written * sizeof(blockIO));
+    if (blocks == NULL || ios == NULL) {
+        free(blocks);
+        free(ios);
+        closeDisk(disk_descriptor);
+        return SYS_ERR_MALLOC;
+    }
 
-        /* if at the last block, store the last free block */
-        } else {
-            buffer[FREE_PTR_LOC] = 0x00;
+    if (features & TFS_FEAT_BITMAP) {
+        /* everything past the superblock and the bitmap itself starts out free */
+        freeMap* map = freeMapCreate(number_of_blocks);
+        if (map == NULL) {
+            free(blocks);
+            free(ios);
+            closeDisk(disk_descriptor);
+            return SYS_ERR_MALLOC;
         }
-
-        /* update the block with the correct type, safety, and pointer bytes */
-        if ((ERR = writeBlock(disk_descriptor, i, buffer)) < 0) {  
-            return ERR;
+        for(int i = blocks_written; i < number_of_blocks; i++) {
+            freeMapSetFree(map, i, true);
+        }
+        for(int i = 0; i < bitmap_blocks; i++) {
+            uint8_t* buffer = blocks + (FIRST_BITMAP_DISKLOC + i) * BLOCKSIZE;
+            buffer[BLOCK_TYPE_LOC] = BITMAP;
+            buffer[SAFETY_BYTE_LOC] = SAFETY_HEX;
+            freeMapExport(map, i * BITMAP_BITS_PER_BLOCK, buffer + FIRST_BITMAP_LOC, BLOCKSIZE - FIRST_BITMAP_LOC);
+        }
+        freeMapDestroy(map);
+    } else {
+        /* initialize free blocks, each linking to the next one and the last ending the list */
+        for(int i = 1 + root_blocks; i < number_of_blocks; i++) {
+            uint8_t* buffer = blocks + i * BLOCKSIZE;
+            buffer[BLOCK_TYPE_LOC] = FREE;
+            buffer[SAFETY_BYTE_LOC] = SAFETY_HEX;
+            buffer[FREE_PTR_LOC] = i + 1 != number_of_blocks ? i + 1 : 0x00;
         }
     }
 
-    /* Initialize superblock and update it in the disk*/
-    memset(buffer, 0, BLOCKSIZE);
-    buffer[BLOCK_TYPE_LOC] = SUPERBLOCK;
-    buffer[SAFETY_BYTE_LOC] = SAFETY_HEX;
-    buffer[FREE_PTR_LOC] = number_of_blocks > 1 ? 0x01 : 0;
-
-    if ((ERR = writeBlock(disk_descriptor, SUPERBLOCK_DISKLOC, buffer)) < 0) {
+    /* Initialize superblock */
+    blocks[BLOCK_TYPE_LOC] = SUPERBLOCK;
+    blocks[SAFETY_BYTE_LOC] = SAFETY_HEX;
+    blocks[FREE_PTR_LOC] = number_of_blocks > 1 + root_blocks && !(features & TFS_FEAT_BITMAP) ? 1 + root_blocks : 0;
+    blocks[EMPTY_BYTE_LOC] = features;
+
+    /* the root directory's inode takes the first block after the superblock and bitmap */
+    if (features & TFS_FEAT_ROOTDIR) {
+        int root = 1 + bitmap_blocks;
+        uint8_t* inode = blocks + root * BLOCKSIZE;
+        inode[BLOCK_TYPE_LOC] = INODE;
+        inode[SAFETY_BYTE_LOC] = SAFETY_HEX;
+        inode[FILE_TYPE_FLAG_LOC] = FILE_TYPE_DIR;
+        strcpy((char*) inode + FILE_NAME_LOC, ROOT_DIR_NAME);
+        _write_long(inode, time(NULL), DIR_CREATEDTIME_LOC);
+        _write_long(inode, time(NULL), DIR_MODIFIEDTIME_LOC);
+        _write_long(inode, time(NULL), DIR_ACCESSTIME_LOC);
+        _set_ptr(blocks + ROOT_INODE_LOC, 0, PTR_SIZE(features), root);
+    }
+
+    for(int i = 0; i < blocks_written; i++) {
+        ios[i].bNum = i;
+        ios[i].block = blocks + i * BLOCKSIZE;
+    }
+    ERR = writeBlocks(disk_descriptor, ios, blocks_written);
+    free(blocks);
+    free(ios);
+    if (ERR < 0) {
+        closeDisk(disk_descriptor);
         return ERR;
     }
 
-    return TFS_SUCCESS;
+    return closeDisk(disk_descriptor);
 }
 
 int tfs_mount(char* diskname) {
@@ -91,43 +170,95 @@ int tfs_mount(char* diskname) {
 
     struct stat file_stat;
     if (fstat(diskNum, &file_stat) == -1) {
+        closeDisk(diskNum);
         return SYS_ERR_FSTAT;
     }  
 
     /* make sure nBytes is evenly divisible by BLOCKSIZE */
     if(file_stat.st_size % BLOCKSIZE != 0) {
+        closeDisk(diskNum);
         return ERR_BAD_DISK;
     }
-    int num_blocks = file_stat.st_size / BLOCKSIZE;
+    int num_blocks = getDiskSize(diskNum);
     char* blocks_checked = (char*) malloc(num_blocks);
     if (blocks_checked == NULL) {
+        closeDisk(diskNum);
         return SYS_ERR_MALLOC;
     }
     memset(blocks_checked, 0, num_blocks);
 
+    /* every block access from here on goes through the block cache */
+    blockCache* cache = cacheCreate(diskNum, cache_size);
+    if (cache == NULL) {
+        free(blocks_checked);
+        closeDisk(diskNum);
+        return SYS_ERR_MALLOC;
+    }
+
+    /* a bitmap disk's free space is loaded into memory first, the check below
+        then compares it against the blocks the file system really uses */
+    uint8_t superblock[BLOCKSIZE];
+    if ((ERR = cacheReadBlock(cache, SUPERBLOCK_DISKLOC, superblock)) < 0) {
+        return _abort_mount(diskNum, cache, NULL, blocks_checked, ERR_BAD_DISK);
+    }
+    int features = superblock[EMPTY_BYTE_LOC];
+    freeMap* free_space = NULL;
+    if (features & TFS_FEAT_BITMAP) {
+        if ((free_space = freeMapCreate(num_blocks)) == NULL) {
+            return _abort_mount(diskNum, cache, NULL, blocks_checked, SYS_ERR_MALLOC);
+        }
+        if (_load_bitmap(cache, free_space, blocks_checked) < 0) {
+            return _abort_mount(diskNum, cache, free_space, blocks_checked, ERR_BAD_DISK);
+        }
+    }
+
     /* Returning an ERRor if the file isn't formatted properly */
-    if ((ERR = _check_block_con(diskNum, SUPERBLOCK_DISKLOC, SUPERBLOCK, blocks_checked)) < 0) {
-        return ERR_BAD_DISK;
+    if ((ERR = _check_block_con(cache, SUPERBLOCK_DISKLOC, SUPERBLOCK, blocks_checked, features)) < 0) {
+        return _abort_mount(diskNum, cache, free_space, blocks_checked, ERR_BAD_DISK);
     }
 
-    /* Checks to see if every block is marked as checked */
+    /* Checks to see if every block is marked as checked, or for a bitmap disk
+        that exactly the blocks not in use are marked free */
     for (int i = 0; i < num_blocks; i++) {
-        if (blocks_checked[i] == 0) {
-            printf("116\n");
-            return ERR_BAD_DISK;
+        bool in_use = blocks_checked[i] != 0;
+        if (free_space != NULL ? in_use == freeMapIsFree(free_space, i) : !in_use) {
+            return _abort_mount(diskNum, cache, free_space, blocks_checked, ERR_BAD_DISK);
         }
     }
     free(blocks_checked);
 
+    /* a free-list disk counts its free blocks once, allocations keep the count */
+    int free_blocks = 0;
+    if (free_space == NULL && (free_blocks = _count_free_list(cache, num_blocks)) < 0) {
+        return _abort_mount(diskNum, cache, NULL, NULL, free_blocks);
+    }
+
     /* Initialize a new tinyFS object */
-    if ((mounted = (tinyFS *) malloc(sizeof(tinyFS))) == NULL) {
-        return SYS_ERR_MALLOC;
+    dentryCache* dentries = dcacheCreate(DEFAULT_DENTRY_ENTRIES);
+    if (dentries == NULL || (mounted = (tinyFS *) malloc(sizeof(tinyFS))) == NULL) {
+        dcacheDestroy(dentries);
+        return _abort_mount(diskNum, cache, free_space, NULL, SYS_ERR_MALLOC);
     }
     mounted->name = diskname;
     mounted->diskNum = diskNum;
+    mounted->cache = cache;
+    mounted->features = features;
+    mounted->ptrSize = PTR_SIZE(features);
+    mounted->freeSpace = free_space;
+    mounted->freeBlocks = free_blocks;
+    mounted->atimePolicy = atime_policy;
+    mounted->dentries = dentries;
+    mounted->root = features & TFS_FEAT_ROOTDIR ? (int) _get_ptr(superblock + ROOT_INODE_LOC, 0, PTR_SIZE(features)) : SUPERBLOCK_DISKLOC;
+
+    /* make sure cached writes reach the disk even if the program never unmounts */
+    static bool sync_registered = false;
+    if (!sync_registered) {
+        atexit(_sync_at_exit);
+        sync_registered = true;
+    }
 
     /* reset the fd table */
-    memset(fd_table, 0, FD_TABLESIZE);
+    memset(fd_table, 0, sizeof(fd_table));
     return TFS_SUCCESS;
 }
 
@@ -137,13 +268,37 @@ int tfs_unmount() {
         return ERR_NO_DISK_MOUNTED;
     }
 
-    /* Free the mounted variable and change it to a null pointer */
-    int returnVal = closeDisk(mounted->diskNum);
+    /* drop uncommitted streams, write back the open inodes, the free-space bitmap
+        and everything still cached, then close the disk */
+    for (int i = 0; i < FD_TABLESIZE; i++) {
+        _stream_abort(&fd_table[i]);
+    }
+    int returnVal = _flush_open_files();
+    if (mounted->freeSpace != NULL) {
+        int bitmapVal = _store_bitmap(mounted->cache, mounted->freeSpace);
+        if (returnVal == TFS_SUCCESS) {
+            returnVal = bitmapVal;
+        }
+        freeMapDestroy(mounted->freeSpace);
+    }
+    int cacheVal = cacheDestroy(mounted->cache);
+    if (returnVal == TFS_SUCCESS) {
+        returnVal = cacheVal;
+    }
+    int closeVal = closeDisk(mounted->diskNum);
+    if (returnVal == TFS_SUCCESS) {
+        returnVal = closeVal;
+    }
 
+    /* Free the mounted variable and change it to a null pointer */
+    dcacheDestroy(mounted->dentries);
     free(mounted);
     mounted = NULL;
 
-    memset(fd_table, 0, FD_TABLESIZE);
+    memset(fd_table, 0, sizeof(fd_table));
+    for (int i = 0; i < DIR_TABLESIZE; i++) {
+        _dir_close(&dir_table[i]);
+    }
 
     return returnVal; 
 }
@@ -159,7 +314,7 @@ fileDescriptor tfs_openFile(char *name) {
         return ERR_INVALID_INPUT;  // ERR: invalid input error
     }
 
-    int parent = SUPERBLOCK_DISKLOC;
+    int parent = mounted->root;
     char cur_path[FILENAME_LENGTH + 1];
 
     /* see if the file in the path already exists */
@@ -170,34 +325,26 @@ fileDescriptor tfs_openFile(char *name) {
 
     /* if the file already exists */
     if (dir_found_flag) {
-        int fd_table_index = _update_fd_table_index();
-        fd_table[fd_table_index] = parent;
-        uint8_t *inode = malloc(BLOCKSIZE * sizeof(char));
-        if ((ERR = readBlock(mounted->diskNum, parent, inode)) < 0) {
+        if ((ERR = _update_fd_table_index()) < 0) {
             return ERR;
         }
-        _write_long(inode, time(NULL), FILE_ACCESSTIME_LOC);
-
-        
-        if ((ERR = writeBlock(mounted->diskNum, parent, inode)) < 0) {
+        if ((ERR = _open_inode(fd_table_index, parent)) < 0) {
             return ERR;
         }
-
-        free(inode);
+        _stamp_atime(&fd_table[fd_table_index]);
         return fd_table_index;
     } 
 
     /* get next free block */
-    char next_free_block = _pop_free_block();
-    if(!next_free_block) {
-        return ERR_DISK_OUT_OF_SPACE;
+    int next_free_block = _pop_free_block();
+    if(next_free_block < 0) {
+        return next_free_block;
     }
     
-    /* find the next available fd and set it to the next */ 
+    /* find the next available fd, it is opened once the inode exists */ 
     if ((ERR = _update_fd_table_index()) < 0) {
         return ERR;
     }
-    fd_table[fd_table_index] = next_free_block;
 
     /* put name of file on the inode and information bytes */
     uint8_t inode_buffer[BLOCKSIZE];
@@ -209,6 +356,7 @@ fileDescriptor tfs_openFile(char *name) {
     _write_long(inode_buffer, time(NULL), FILE_CREATEDTIME_LOC);
     _write_long(inode_buffer, time(NULL), FILE_MODIFIEDTIME_LOC);
     _write_long(inode_buffer, time(NULL), FILE_ACCESSTIME_LOC);
+    _set_ptr(inode_buffer + INODE_PARENT_LOC, 0, mounted->ptrSize, parent);
     int z = 0;
     while(cur_path[z] != '\000') {
         inode_buffer[z+FILE_NAME_LOC] = cur_path[z]; 
@@ -216,43 +364,38 @@ fileDescriptor tfs_openFile(char *name) {
     }
 
     /* turn the free block into an inode */
-    if ((ERR = writeBlock(mounted->diskNum, next_free_block, inode_buffer)) < 0) {
-        return ERR;
-    }
-
-    /* Get the parent */
-    char parent_block[BLOCKSIZE];
-    if ((ERR = readBlock(mounted->diskNum, parent, parent_block)) < 0) {
+    if ((ERR = cacheWriteBlock(mounted->cache, next_free_block, inode_buffer)) < 0) {
         return ERR;
     }
 
-    /* find the first empty byte in the superblock and add the inode */
-    /* set the bounds for i based on wether in the superblock or a directory inode */
-    int start_bound = parent == 0 ? FIRST_SUPBLOCK_INODE_LOC : DIR_DATA_LOC;
-    int range = parent == 0 ? MAX_SUPBLOCK_INODES : MAX_DIR_INODES;
-    for(int i = start_bound; i < range + start_bound; i++) {
-        if(!parent_block[i]) {
-            parent_block[i] = next_free_block;
-            break;
-        }
+    /* add the inode to its parent, giving the block back if there is no room
+        there, the name no longer misses */
+    int added = _dir_add(parent, cur_path, FILE_TYPE_FILE, next_free_block);
+    if (added < 0) {
+        _free_block(next_free_block);
+        return added;
     }
+    dcacheInsert(mounted->dentries, parent, cur_path, next_free_block, FILE_TYPE_FILE);
 
-    /* update the parent of the file */
-    if ((ERR = writeBlock(mounted->diskNum, parent, parent_block)) < 0) {
+    if ((ERR = _open_inode(fd_table_index, next_free_block)) < 0) {
         return ERR;
     }
-
     return fd_table_index;
 }
 
 int tfs_closeFile(fileDescriptor FD) {
     /* make sure there is an fd entry */
-    if(!fd_table[FD]) {
+    openFile* file = _open_file(FD);
+    if(file == NULL) {
         return ERR_INVALID_FD;
     }
 
-    /* remove the entry */
-    fd_table[FD] = EMPTY_TABLEVAL;
+    /* drop an uncommitted stream, write back what the descriptor changed, then remove the entry */
+    _stream_abort(file);
+    if ((ERR = _flush_open_file(file)) < 0) {
+        return ERR;
+    }
+    file->inodeNum = EMPTY_TABLEVAL;
     return TFS_SUCCESS;
 }
 
@@ -263,14 +406,21 @@ int tfs_writeFile(fileDescriptor FD, char *buffer, int size) {
     }
 
     /* make sure there is an fd entry */
-    if(!fd_table[FD] || buffer == NULL) {
+    openFile* file = _open_file(FD);
+    if(file == NULL || buffer == NULL) {
         return ERR_INVALID_FD;
     }
 
-    /* Grab the block's inode */
+    /* work on a copy of the open inode, the descriptors keep the old one until the write is done */
     uint8_t inode[BLOCKSIZE]; 
-    if ((ERR = readBlock(mounted->diskNum, fd_table[FD], inode)) < 0) {
-        return ERR;
+    memcpy(inode, file->inode, BLOCKSIZE);
+
+    /* list the blocks the old content holds, before the size changes */
+    uint32_t* old_blocks;
+    int old_meta;
+    int old_data = _file_blocks(inode, &old_blocks, &old_meta);
+    if (old_data < 0) {
+        return old_data;
     }
 
     /* store the file size in the inode */
@@ -281,39 +431,100 @@ int tfs_writeFile(fileDescriptor FD, char *buffer, int size) {
     inode[i + 3] = size & 0xFF;
     _write_long(inode, time(NULL), FILE_MODIFIEDTIME_LOC);
 
-    // Resetting the direct blocks so the data is "lost" since nothing is pointing to them
-    // Counter for clearing
-    i = 0;
-    uint8_t dir_block = inode[FILE_DATA_LOC + i++];
-    while(dir_block != 0x0) {
-        // Allocating each block as "free" and adding them to the linked list
-        if ((ERR = _free_block(dir_block)) < 0) {
+    /* a file small enough to fit goes into its own inode, giving back any blocks it had */
+    if ((mounted->features & TFS_FEAT_INLINE) && size > 0 && size <= MAX_INLINE_DATA) {
+        ERR = _free_blocks(old_blocks, old_data + old_meta);
+        free(old_blocks);
+        if (ERR < 0) {
             return ERR;
         }
-
-        dir_block = inode[FILE_DATA_LOC + i++];
+        memset(inode + FILE_DATA_LOC, 0, MAX_FILE_DATA);
+        memcpy(inode + FILE_DATA_LOC, buffer, size);
+        inode[FILE_MAP_LOC] = FILE_MAP_INLINE;
+        if ((ERR = _write_inode(file->inodeNum, inode)) < 0) {
+            return ERR;
+        }
+        file->offset = 0;
+        return TFS_SUCCESS;
     }
 
     // Determining the amount of blocks to be written. A plus one at the end for data outside the 256 byte margin.
     // NOTE TO PROGRAMMER: I set this to size-1 so write of 256 bytes(or any number on the line)
     // will not take up extra blocks. Might cause problems in the future.
     int numBlocks = ((size-1) / MAX_DATA_SPACE) + 1;
-    // Writing those blocks to the file
-    char temp_addr;
-    char temp_block[BLOCKSIZE];
+
+    /* fail before touching anything if the new content (and the indirect blocks
+        mapping it) cannot fit, counting the blocks the old content gives back */
+    int free_blocks = tfs_freeBlocks();
+    if (free_blocks < 0) {
+        free(old_blocks);
+        return free_blocks;
+    }
+    /* extents take more EXTENT blocks the more the data is split, which is only
+        known once it is placed, so on a bitmap disk (which can undo a write that
+        does not fit) only the data has to fit up front. A free-list disk overwrites
+        the old blocks as it frees them, so it counts the most EXTENT blocks there
+        could be */
+    bool extents = mounted->features & TFS_FEAT_EXTENTS;
+    int numMeta = _map_blocks(mounted->features, numBlocks);
+    bool worst_case = !extents || mounted->freeSpace == NULL;
+    if (free_blocks + old_data + old_meta < numBlocks + (worst_case ? numMeta : 0) || numBlocks > _max_file_blocks(mounted->features)) {
+        free(old_blocks);
+        return ERR_DISK_OUT_OF_SPACE;
+    }
+    uint8_t* data_blocks = (uint8_t*) calloc(numBlocks + numMeta, BLOCKSIZE);
+    blockIO* ios = (blockIO*) malloc((numBlocks + numMeta) * sizeof(blockIO));
+    uint32_t* new_blocks = (uint32_t*) malloc((numBlocks + numMeta) * sizeof(uint32_t));
+    if (data_blocks == NULL || ios == NULL || new_blocks == NULL) {
+        free(old_blocks);
+        free(data_blocks);
+        free(ios);
+        free(new_blocks);
+        return SYS_ERR_MALLOC;
+    }
+
+    // Resetting the old blocks so the data is "lost" since nothing is pointing to them
+    ERR = _free_blocks(old_blocks, old_data + old_meta);
+
+    /* reserve every data block (then the indirect blocks) up front and build them
+        all in memory, so the whole file reaches the cache (or the disk) as one batch
+        + extents always take the data as the fewest runs of blocks they can */
+    int taken = 0;
+    if (ERR >= 0 && (ERR = _alloc_blocks(numBlocks, new_blocks, extents ? TFS_ALLOC_EXTENT : alloc_policy)) >= 0) {
+        taken = numBlocks;
+        ERR = numMeta = _map_size(new_blocks, numBlocks);
+    }
+    if (ERR >= 0) {
+        ERR = _alloc_blocks(numMeta, new_blocks + numBlocks, alloc_policy);
+    }
+
+    /* the blocks taken go back on failure. A bitmap disk left the old blocks as they
+        were, so a write that does not fit (free space too split up for the extents,
+        say) can hand them back untouched */
+    if (ERR < 0) {
+        int status = ERR;
+        if (mounted->freeSpace != NULL) {
+            for (int i = 0; i < taken; i++) {
+                freeMapSetFree(mounted->freeSpace, new_blocks[i], true);
+            }
+            for (int i = 0; i < old_data + old_meta; i++) {
+                freeMapSetFree(mounted->freeSpace, old_blocks[i], false);
+            }
+        } else {
+            _free_blocks(new_blocks, taken);
+        }
+        free(old_blocks);
+        free(data_blocks);
+        free(ios);
+        free(new_blocks);
+        return status;
+    }
+    free(old_blocks);
     int bufferHead = 0;
     for (int i = 0; i < numBlocks; i++) {
-        // A value to keep track of where we are in the buffer
         // A variable to keep track of how many bytes should be written so that bytes outside the buffer aren't included
         int writeSize = size - (i * MAX_DATA_SPACE);
-        temp_addr = _pop_free_block();
-        if (!temp_addr) {
-            return ERR_DISK_OUT_OF_SPACE;
-        }
-        if ((ERR = readBlock(mounted->diskNum, temp_addr, temp_block)) < 0) {
-            return ERR;
-        }
-        // Update important data
+        uint8_t* temp_block = data_blocks + i * BLOCKSIZE;
         temp_block[BLOCK_TYPE_LOC] = FILEEX;
         temp_block[SAFETY_BYTE_LOC] = SAFETY_HEX;
         temp_block[FREE_PTR_LOC] = EMPTY_TABLEVAL;
@@ -323,25 +534,378 @@ int tfs_writeFile(fileDescriptor FD, char *buffer, int size) {
         if(writeSize > MAX_DATA_SPACE) {
             writeSize = MAX_DATA_SPACE;
         }
-        for (int j = FIRST_DATA_LOC; j < writeSize + FIRST_DATA_LOC; j++) {
-            temp_block[j] = buffer[bufferHead++];
+        memcpy(temp_block + FIRST_DATA_LOC, buffer + bufferHead, writeSize);
+        bufferHead += writeSize;
+    }
+    _build_map(inode, new_blocks, numBlocks, new_blocks + numBlocks, data_blocks + numBlocks * BLOCKSIZE);
+    for (int i = 0; i < numBlocks + numMeta; i++) {
+        ios[i].bNum = new_blocks[i];
+        ios[i].block = data_blocks + i * BLOCKSIZE;
+    }
+
+    /* write the data and indirect blocks together, then the inode once */
+    ERR = cacheWriteBlocks(mounted->cache, ios, numBlocks + numMeta);
+    free(data_blocks);
+    free(ios);
+    free(new_blocks);
+    if (ERR < 0) {
+        return ERR;
+    }
+    if ((ERR = _write_inode(file->inodeNum, inode)) < 0) {
+        return ERR;
+    }
+
+    /* set the file offset to be 0 */
+    file->offset = 0;
+
+    return TFS_SUCCESS;
+}
+
+int tfs_pwrite(fileDescriptor FD, char *buffer, int size, int offset) {
+    /* make sure there is a mounted tfs */
+    if (mounted == NULL) {
+        return ERR_NO_DISK_MOUNTED;
+    }
+
+    /* make sure there is an fd entry */
+    openFile* file = _open_file(FD);
+    if(file == NULL || buffer == NULL) {
+        return ERR_INVALID_FD;
+    }
+    if (size < 0 || offset < 0 || size > INT32_MAX - offset) {
+        return ERR_INVALID_INPUT;
+    }
+
+    /* work on a copy of the open inode, the descriptors keep the old one until the write is done */
+    uint8_t inode[BLOCKSIZE]; 
+    memcpy(inode, file->inode, BLOCKSIZE);
+    int i = FILE_SIZE_LOC;
+    int old_size = (inode[i] << 24) + (inode[i + 1] << 16) + (inode[i + 2] << 8) + inode[i + 3];
+
+    /* files have no holes, a write may start at the end but not past it */
+    if (offset > old_size) {
+        return ERR_FILE_PNTR_OUT_OF_BOUNDS;
+    }
+    if (size == 0) {
+        return 0;
+    }
+    int new_size = offset + size > old_size ? offset + size : old_size;
+
+    uint32_t* old_blocks;
+    int old_meta;
+    int old_data = _file_blocks(inode, &old_blocks, &old_meta);
+    if (old_data < 0) {
+        return old_data;
+    }
+
+    /* an inline (or still empty) file stays in its inode while it fits there, and
+        is rewritten whole into blocks once it does not: it is small either way */
+    bool inline_data = inode[FILE_MAP_LOC] & FILE_MAP_INLINE;
+    if ((mounted->features & TFS_FEAT_INLINE) && (inline_data || old_data == 0) && new_size <= MAX_INLINE_DATA) {
+        free(old_blocks);
+        memcpy(inode + FILE_DATA_LOC + offset, buffer, size);
+        inode[FILE_MAP_LOC] = FILE_MAP_INLINE;
+        i = FILE_SIZE_LOC;
+        inode[i] = (new_size >> 24) & 0xFF;
+        inode[i + 1] = (new_size >> 16) & 0xFF;
+        inode[i + 2] = (new_size >> 8) & 0xFF;
+        inode[i + 3] = new_size & 0xFF;
+        _write_long(inode, time(NULL), FILE_MODIFIEDTIME_LOC);
+        return (ERR = _write_inode(file->inodeNum, inode)) < 0 ? ERR : size;
+    }
+    if (inline_data) {
+        free(old_blocks);
+        char* whole = (char*) malloc(new_size);
+        if (whole == NULL) {
+            return SYS_ERR_MALLOC;
         }
-        if ((ERR = writeBlock(mounted->diskNum, temp_addr, temp_block)) < 0) {
-            return ERR;
+        memcpy(whole, inode + FILE_DATA_LOC, old_size);
+        memcpy(whole + offset, buffer, size);
+        int pointer = file->offset;
+        ERR = tfs_writeFile(FD, whole, new_size);
+        free(whole);
+        file->offset = pointer;
+        return ERR < 0 ? ERR : size;
+    }
+
+    /* only growth takes new blocks, and only growth changes the map */
+    int numBlocks = ((new_size - 1) / MAX_DATA_SPACE) + 1;
+    int grow = numBlocks - old_data;
+    bool extents = mounted->features & TFS_FEAT_EXTENTS;
+    int maxMeta = grow > 0 ? _map_blocks(mounted->features, numBlocks) : 0;
+    if (grow > 0) {
+        int free_blocks = tfs_freeBlocks();
+        if (free_blocks < 0 || free_blocks < grow + (extents ? 0 : maxMeta) || numBlocks > _max_file_blocks(mounted->features)) {
+            free(old_blocks);
+            return free_blocks < 0 ? free_blocks : ERR_DISK_OUT_OF_SPACE;
+        }
+    }
+    int first = offset / MAX_DATA_SPACE;
+    int last = (offset + size - 1) / MAX_DATA_SPACE;
+    uint32_t* blocks = (uint32_t*) malloc((numBlocks + maxMeta) * sizeof(uint32_t));
+    uint8_t* data_blocks = (uint8_t*) calloc(last - first + 1 + maxMeta, BLOCKSIZE);
+    blockIO* ios = (blockIO*) malloc((last - first + 1 + maxMeta) * sizeof(blockIO));
+    if (blocks == NULL || data_blocks == NULL || ios == NULL) {
+        free(old_blocks);
+        free(blocks);
+        free(data_blocks);
+        free(ios);
+        return SYS_ERR_MALLOC;
+    }
+    memcpy(blocks, old_blocks, old_data * sizeof(uint32_t));
+
+    /* take the new data blocks, carrying on the file's last run while the blocks
+        after it are free, then the blocks the new map needs */
+    int numMeta = 0;
+    int taken = 0;
+    bool allocated = false;
+    ERR = TFS_SUCCESS;
+    if (grow > 0) {
+        uint32_t last = old_data > 0 ? blocks[old_data - 1] : 0;
+        if ((ERR = _alloc_blocks_after(last, grow, blocks + old_data, extents ? TFS_ALLOC_EXTENT : alloc_policy)) >= 0) {
+            taken = grow;
+            ERR = numMeta = _map_size(blocks, numBlocks);
+        }
+        if (ERR >= 0 && (ERR = _alloc_blocks(numMeta, blocks + numBlocks, alloc_policy)) >= 0) {
+            allocated = true;
+        }
+        if (ERR < 0) {
+            int status = ERR;
+            _free_blocks(blocks + old_data, taken);
+            ERR = status;
+        }
+    }
+
+    /* build every block the write touches, reading the old ones it only partly covers */
+    int num_ios = 0;
+    for (int b = first; b <= last && ERR >= 0; b++) {
+        uint8_t* block = data_blocks + num_ios * BLOCKSIZE;
+        int from = b == first ? offset % MAX_DATA_SPACE : 0;
+        int to = b == last ? (offset + size - 1) % MAX_DATA_SPACE + 1 : MAX_DATA_SPACE;
+        if (b < old_data && (from > 0 || to < MAX_DATA_SPACE)) {
+            ERR = cacheReadBlock(mounted->cache, blocks[b], block);
+        } else {
+            block[BLOCK_TYPE_LOC] = FILEEX;
+            block[SAFETY_BYTE_LOC] = SAFETY_HEX;
+        }
+        memcpy(block + FIRST_DATA_LOC + from, buffer + b * MAX_DATA_SPACE + from - offset, to - from);
+        ios[num_ios].bNum = blocks[b];
+        ios[num_ios].block = block;
+        num_ios++;
+    }
+    if (ERR >= 0 && grow > 0) {
+        _build_map(inode, blocks, numBlocks, blocks + numBlocks, data_blocks + num_ios * BLOCKSIZE);
+        for (int m = 0; m < numMeta; m++) {
+            ios[num_ios].bNum = blocks[numBlocks + m];
+            ios[num_ios].block = data_blocks + num_ios * BLOCKSIZE;
+            num_ios++;
         }
+    }
+
+    /* write the blocks as one batch, then the inode once, then give the old map back */
+    if (ERR >= 0) {
+        ERR = cacheWriteBlocks(mounted->cache, ios, num_ios);
+    }
+    if (ERR >= 0) {
+        i = FILE_SIZE_LOC;
+        inode[i] = (new_size >> 24) & 0xFF;
+        inode[i + 1] = (new_size >> 16) & 0xFF;
+        inode[i + 2] = (new_size >> 8) & 0xFF;
+        inode[i + 3] = new_size & 0xFF;
+        _write_long(inode, time(NULL), FILE_MODIFIEDTIME_LOC);
+        ERR = _write_inode(file->inodeNum, inode);
+    }
+    if (ERR >= 0 && grow > 0) {
+        ERR = _free_blocks(old_blocks + old_data, old_meta);
+    } else if (ERR < 0 && allocated) {
+        int status = ERR;
+        _free_blocks(blocks + old_data, grow + numMeta);
+        ERR = status;
+    }
+    free(old_blocks);
+    free(blocks);
+    free(data_blocks);
+    free(ios);
+    return ERR < 0 ? ERR : size;
+}
+
+int tfs_append(fileDescriptor FD, char *buffer, int size) {
+    /* make sure there is an fd entry */
+    openFile* file = _open_file(FD);
+    if(file == NULL) {
+        return ERR_INVALID_FD;
+    }
+
+    int i = FILE_SIZE_LOC;
+    int end = (file->inode[i] << 24) + (file->inode[i + 1] << 16) + (file->inode[i + 2] << 8) + file->inode[i + 3];
+    return tfs_pwrite(FD, buffer, size, end);
+}
+
+int tfs_openStream(fileDescriptor FD) {
+    /* make sure there is a mounted tfs */
+    if (mounted == NULL) {
+        return ERR_NO_DISK_MOUNTED;
+    }
+
+    /* make sure there is an fd entry, without a stream yet */
+    openFile* file = _open_file(FD);
+    if(file == NULL) {
+        return ERR_INVALID_FD;
+    }
+    if (file->writer != NULL) {
+        return ERR_STREAM_OPEN;
+    }
+
+    if ((file->writer = (fileWriter*) calloc(1, sizeof(fileWriter))) == NULL) {
+        return SYS_ERR_MALLOC;
+    }
+    return TFS_SUCCESS;
+}
+
+int tfs_writeStream(fileDescriptor FD, char *buffer, int size) {
+    /* make sure there is a mounted tfs */
+    if (mounted == NULL) {
+        return ERR_NO_DISK_MOUNTED;
+    }
+
+    /* make sure there is an fd entry with a stream */
+    openFile* file = _open_file(FD);
+    if(file == NULL || buffer == NULL) {
+        return ERR_INVALID_FD;
+    }
+    fileWriter* writer = file->writer;
+    if (writer == NULL) {
+        return ERR_NO_STREAM;
+    }
+    if (size < 0 || size > INT32_MAX - writer->size) {
+        return ERR_INVALID_INPUT;
+    }
 
-        /* update the file inode with the data block */
-        inode[FILE_DATA_LOC + i] = temp_addr;
-        if ((ERR = writeBlock(mounted->diskNum, fd_table[FD], inode)) < 0) {
+    /* fill the partial block, writing it out each time it is full */
+    int policy = mounted->features & TFS_FEAT_EXTENTS ? TFS_ALLOC_EXTENT : alloc_policy;
+    int done = 0;
+    while (done < size) {
+        if (writer->partialBytes == MAX_DATA_SPACE && (ERR = _stream_flush(file, policy)) < 0) {
             return ERR;
         }
+        int length = MAX_DATA_SPACE - writer->partialBytes;
+        if (length > size - done) {
+            length = size - done;
+        }
+        memcpy(writer->partial + FIRST_DATA_LOC + writer->partialBytes, buffer + done, length);
+        writer->partialBytes += length;
+        writer->size += length;
+        done += length;
     }
+    return size;
+}
 
-    /* set the file offset to be 0 */
-    if ((ERR = tfs_seek(FD, 0)) < 0) {
+int tfs_commitStream(fileDescriptor FD) {
+    /* make sure there is a mounted tfs */
+    if (mounted == NULL) {
+        return ERR_NO_DISK_MOUNTED;
+    }
+
+    /* make sure there is an fd entry with a stream */
+    openFile* file = _open_file(FD);
+    if(file == NULL) {
+        return ERR_INVALID_FD;
+    }
+    fileWriter* writer = file->writer;
+    if (writer == NULL) {
+        return ERR_NO_STREAM;
+    }
+
+    /* a stream that never filled a block may go inline, otherwise its last block goes out */
+    int size = writer->size;
+    bool inline_data = (mounted->features & TFS_FEAT_INLINE) && writer->numBlocks == 0 && size > 0 && size <= MAX_INLINE_DATA;
+    int policy = mounted->features & TFS_FEAT_EXTENTS ? TFS_ALLOC_EXTENT : alloc_policy;
+    if (!inline_data && writer->partialBytes > 0 && (ERR = _stream_flush(file, policy)) < 0) {
+        return ERR;
+    }
+
+    uint8_t inode[BLOCKSIZE]; 
+    memcpy(inode, file->inode, BLOCKSIZE);
+    uint32_t* old_blocks;
+    int old_meta;
+    int old_data = _file_blocks(inode, &old_blocks, &old_meta);
+    if (old_data < 0) {
+        return old_data;
+    }
+
+    /* lay out the new map, taking the blocks it needs */
+    int count = writer->numBlocks;
+    int numMeta = 0;
+    uint8_t* meta_blocks = NULL;
+    blockIO* ios = NULL;
+    memset(inode + FILE_DATA_LOC, 0, MAX_FILE_DATA);
+    inode[FILE_MAP_LOC] = EMPTY_TABLEVAL;
+    ERR = TFS_SUCCESS;
+    if (inline_data) {
+        memcpy(inode + FILE_DATA_LOC, writer->partial + FIRST_DATA_LOC, size);
+        inode[FILE_MAP_LOC] = FILE_MAP_INLINE;
+    } else if (count > 0 && (ERR = numMeta = _map_size(writer->blocks, count)) >= 0) {
+        uint32_t* blocks = (uint32_t*) realloc(writer->blocks, (count + numMeta + 1) * sizeof(uint32_t));
+        meta_blocks = (uint8_t*) calloc(numMeta + 1, BLOCKSIZE);
+        ios = (blockIO*) malloc((numMeta + 1) * sizeof(blockIO));
+        if (blocks != NULL) {
+            writer->blocks = blocks;
+            writer->capacity = count + numMeta + 1;
+        }
+        if (blocks == NULL || meta_blocks == NULL || ios == NULL) {
+            ERR = SYS_ERR_MALLOC;
+        } else if ((ERR = _alloc_blocks(numMeta, writer->blocks + count, alloc_policy)) >= 0) {
+            _build_map(inode, writer->blocks, count, writer->blocks + count, meta_blocks);
+            for (int i = 0; i < numMeta; i++) {
+                ios[i].bNum = writer->blocks[count + i];
+                ios[i].block = meta_blocks + i * BLOCKSIZE;
+            }
+            if ((ERR = cacheWriteBlocks(mounted->cache, ios, numMeta)) < 0) {
+                _free_blocks(writer->blocks + count, numMeta);
+            }
+        }
+    }
+    free(meta_blocks);
+    free(ios);
+    if (ERR < 0) {
+        free(old_blocks);
+        return ERR;
+    }
+
+    /* publish the size and the map with one inode write, then give the old content back */
+    int i = FILE_SIZE_LOC;
+    inode[i] = (size >> 24) & 0xFF;
+    inode[i + 1] = (size >> 16) & 0xFF;
+    inode[i + 2] = (size >> 8) & 0xFF;
+    inode[i + 3] = size & 0xFF;
+    _write_long(inode, time(NULL), FILE_MODIFIEDTIME_LOC);
+    if ((ERR = _write_inode(file->inodeNum, inode)) >= 0) {
+        ERR = _free_blocks(old_blocks, old_data + old_meta);
+    }
+    free(old_blocks);
+    if (ERR < 0) {
         return ERR;
     }
 
+    /* the stream's blocks belong to the file now */
+    free(writer->blocks);
+    free(writer);
+    file->writer = NULL;
+    file->offset = 0;
+    return TFS_SUCCESS;
+}
+
+int tfs_abortStream(fileDescriptor FD) {
+    /* make sure there is an fd entry with a stream */
+    openFile* file = _open_file(FD);
+    if(file == NULL) {
+        return ERR_INVALID_FD;
+    }
+    if (file->writer == NULL) {
+        return ERR_NO_STREAM;
+    }
+
+    _stream_abort(file);
     return TFS_SUCCESS;
 }
 
@@ -352,10 +916,11 @@ int tfs_deleteFile(fileDescriptor FD) {
     }
 
     /* make sure there is an fd entry */
-    if(!fd_table[FD]) {
+    openFile* file = _open_file(FD);
+    if(file == NULL) {
         return ERR_INVALID_FD;
     }
-    char inode_num = fd_table[FD];
+    int inode_num = file->inodeNum;
 
     int parent = _fetch_parent(inode_num);
     if (parent < 0) {
@@ -372,41 +937,42 @@ int tfs_readByte(fileDescriptor FD, char* buffer) {
     }
 
     /* make sure there is an fd entry */
-    if(!fd_table[FD] || buffer == NULL) {
+    openFile* file = _open_file(FD);
+    if(file == NULL || buffer == NULL) {
         return ERR_INVALID_FD;
     }
 
-    /* grab the inode block */
-    uint8_t inode[BLOCKSIZE]; 
-    if ((ERR = readBlock(mounted->diskNum, fd_table[FD], inode)) < 0) {
-        return ERR;
-    }
-
-    _write_long(inode, time(NULL), FILE_ACCESSTIME_LOC);
+    /* the inode and offset are already in memory, only the data block may need reading */
+    uint8_t* inode = file->inode;
+    _stamp_atime(file);
 
-    /* get file offset from inode block and convert to block & block offset */
-    int i = FILE_OFFSET_LOC;
-    uint32_t offset = (inode[i] << 24) + (inode[i + 1] << 16) + (inode[i + 2] << 8) + inode[i + 3];
+    /* convert the file offset to block & block offset */
+    int offset = file->offset;
     int block_num = offset / MAX_DATA_SPACE;
     int block_offset = offset % MAX_DATA_SPACE;
 
-    i = FILE_SIZE_LOC;
+    int i = FILE_SIZE_LOC;
     int size = (inode[i] << 24) + (inode[i + 1] << 16) + (inode[i + 2] << 8) + inode[i + 3];
 
-    /* make sure that the offset is not outside of the file */
-    if(offset > size) {
+    /* make sure that the offset is not at or past the end of the file */
+    if(offset >= size) {
         return ERR_FILE_PNTR_OUT_OF_BOUNDS;
     }
+    file->offset++;
 
-    /* increment the offset and make sure it is in the file */
-    if ((ERR = tfs_seek(FD, ++offset)) < 0) {
-        return ERR;
+    /* inline data is read straight out of the inode */
+    if (inode[FILE_MAP_LOC] & FILE_MAP_INLINE) {
+        buffer[0] = inode[FILE_DATA_LOC + block_offset];
+        return TFS_SUCCESS;
     }
 
     /* grab the data block */
-    char data_block_num = inode[FILE_DATA_LOC + block_num];
+    int data_block_num = _file_block(inode, block_num);
+    if (data_block_num < 0) {
+        return data_block_num;
+    }
     char data_block[BLOCKSIZE]; 
-    if ((ERR = readBlock(mounted->diskNum, data_block_num, data_block)) < 0) {
+    if ((ERR = cacheReadBlock(mounted->cache, data_block_num, data_block)) < 0) {
         return ERR;
     }
 
@@ -423,7 +989,8 @@ int tfs_seek(fileDescriptor FD, int offset) {
     }
 
     /* make sure there is an fd entry */
-    if(!fd_table[FD]) {
+    openFile* file = _open_file(FD);
+    if(file == NULL) {
         return ERR_INVALID_FD;
     }
 
@@ -431,33 +998,70 @@ int tfs_seek(fileDescriptor FD, int offset) {
         return ERR_INVALID_INPUT;
     }
 
-    /* grab the inode */
-    uint8_t inode[BLOCKSIZE]; 
-    if ((ERR = readBlock(mounted->diskNum, fd_table[FD], inode)) < 0) {
-        return ERR;
-    }
-
     /* get the file size */
     int i = FILE_SIZE_LOC;
-    int size = (inode[i] << 24) + (inode[i + 1] << 16) + (inode[i + 2] << 8) + inode[i + 3];
+    int size = (file->inode[i] << 24) + (file->inode[i + 1] << 16) + (file->inode[i + 2] << 8) + file->inode[i + 3];
 
     /* make sure the offset is in the file */
     if (offset > size) {
         return ERR_FILE_PNTR_OUT_OF_BOUNDS;
     } 
 
-    /* store the offset in the file inode */
-    i = FILE_OFFSET_LOC;
-    inode[i] = (offset >> 24) & 0xFF;
-    inode[i + 1] = (offset >> 16) & 0xFF;
-    inode[i + 2] = (offset >> 8) & 0xFF;
-    inode[i + 3] = offset & 0xFF;
+    /* the offset belongs to the descriptor, nothing goes to the disk */
+    file->offset = offset;
 
-    if ((ERR = writeBlock(mounted->diskNum, fd_table[FD], inode)) < 0) {
-        return ERR;
+    return TFS_SUCCESS;
+}
+
+int tfs_read(fileDescriptor FD, char *buffer, int size) {
+    /* make sure there is a mounted tfs */
+    if (mounted == NULL) {
+        return ERR_NO_DISK_MOUNTED;
     }
 
-    return TFS_SUCCESS;
+    /* make sure there is an fd entry */
+    openFile* file = _open_file(FD);
+    if(file == NULL || buffer == NULL) {
+        return ERR_INVALID_FD;
+    }
+    if (size < 0) {
+        return ERR_INVALID_INPUT;
+    }
+
+    int copied = _read_file(file, buffer, size, file->offset);
+    if (copied < 0) {
+        return copied;
+    }
+
+    /* move the file pointer and stamp the access once for the whole read */
+    file->offset += copied;
+    _stamp_atime(file);
+    return copied;
+}
+
+int tfs_pread(fileDescriptor FD, char *buffer, int size, int offset) {
+    /* make sure there is a mounted tfs */
+    if (mounted == NULL) {
+        return ERR_NO_DISK_MOUNTED;
+    }
+
+    /* make sure there is an fd entry */
+    openFile* file = _open_file(FD);
+    if(file == NULL || buffer == NULL) {
+        return ERR_INVALID_FD;
+    }
+    if (size < 0 || offset < 0) {
+        return ERR_INVALID_INPUT;
+    }
+
+    int copied = _read_file(file, buffer, size, offset);
+    if (copied < 0) {
+        return copied;
+    }
+
+    /* the file pointer stays where it is */
+    _stamp_atime(file);
+    return copied;
 }
 
 /* ~ ADDITIONAL FEATURES ~ */
@@ -472,7 +1076,8 @@ int tfs_rename(fileDescriptor FD, char* newName) {
     }
 
     /* make sure there is an fd entry */
-    if(!fd_table[FD]) {
+    openFile* file = _open_file(FD);
+    if(file == NULL) {
         return ERR_INVALID_FD;
     }
 
@@ -486,11 +1091,9 @@ int tfs_rename(fileDescriptor FD, char* newName) {
         return ERR_INVALID_INPUT;
     }
 
-    /* read in the inode corresponding to the given fd */
+    /* copy the inode corresponding to the given fd */
     uint8_t inode[BLOCKSIZE]; 
-    if ((ERR = readBlock(mounted->diskNum, fd_table[FD], inode)) < 0) {
-        return ERR;
-    }
+    memcpy(inode, file->inode, BLOCKSIZE);
     _write_long((uint8_t*) inode, time(NULL), FILE_CREATEDTIME_LOC);
     /* clear out the current inode's name and write in the new one */
     uint8_t* filename = inode + FILE_NAME_LOC;
@@ -503,10 +1106,26 @@ int tfs_rename(fileDescriptor FD, char* newName) {
     }
     inode[FILE_NAME_LOC + z] = '\0';
 
-    /* update the inode */
-    if ((ERR = writeBlock(mounted->diskNum, fd_table[FD], inode)) < 0) {
+    /* the name is in the parent's entry as well on TFS_FEAT_DIRENTS disks */
+    if (mounted->features & TFS_FEAT_DIRENTS) {
+        int parent = _fetch_parent(file->inodeNum);
+        if (parent < 0) {
+            return parent;
+        }
+        char old_name[FILENAME_LENGTH + 1];
+        memcpy(old_name, file->inode + FILE_NAME_LOC, FILENAME_LENGTH + 1);
+        if ((ERR = _dir_rename(parent, file->inodeNum, inode[FILE_TYPE_FLAG_LOC], old_name, newName)) < 0) {
+            return ERR;
+        }
+    }
+
+    /* update the inode, for every descriptor of the file. Cached lookups of the
+        old name, and of the new one wherever it was missing, are wrong now */
+    if ((ERR = _write_inode(file->inodeNum, inode)) < 0) {
         return ERR;
     }
+    dcacheForget(mounted->dentries, file->inodeNum);
+    dcacheForgetName(mounted->dentries, newName);
 
     return TFS_SUCCESS;
 }
@@ -518,31 +1137,86 @@ int tfs_readdir() {
         return ERR_NO_DISK_MOUNTED;
     }
 
-    char superblock[BLOCKSIZE];
-    if ((ERR = readBlock(mounted->diskNum, SUPERBLOCK_DISKLOC, superblock)) < 0) {
-        return ERR;
+    /* everything under the root's entries is indented */
+    return _print_directory_contents(mounted->root, 0);
+}
+
+/* opens a directory for tfs_readdirEntries(), "/" for the root */
+dirDescriptor tfs_opendir(char* dirName) {
+    /* make sure there is a mounted tfs */
+    if (mounted == NULL) {
+        return ERR_NO_DISK_MOUNTED;
     }
 
-    char inode[BLOCKSIZE];
-    for(int i = 0; i < MAX_SUPBLOCK_INODES; i++) {
+    /* make sure the given dirName is not null */
+    if (dirName == NULL) {
+        return ERR_INVALID_INPUT;
+    }
 
-        if(superblock[i + FIRST_SUPBLOCK_INODE_LOC]) {
+    /* find a free directory descriptor */
+    int DD = 0;
+    while (DD < DIR_TABLESIZE && dir_table[DD].inUse) {
+        DD++;
+    }
+    if (DD == DIR_TABLESIZE) {
+        return ERR_OUT_OF_DDS;
+    }
 
-            if ((ERR = readBlock(mounted->diskNum, superblock[i + FIRST_SUPBLOCK_INODE_LOC], inode)) < 0) {
-                return ERR;
-            }
-    
-            if(inode[FILE_TYPE_FLAG_LOC] == FILE_TYPE_DIR) {
-                printf("%s\n", (inode + FILE_NAME_LOC));
-                if ((ERR = _print_directory_contents(superblock[i + FIRST_SUPBLOCK_INODE_LOC], 1)) < 0) {
-                    return ERR;
-                }
-            } else {
-                printf("%s\n", (inode + FILE_NAME_LOC));
-            }
+    int current = mounted->root;
+    int parent = current;
+    char cur_path[FILENAME_LENGTH + 1];
 
+    /* make sure the directory exists, skip if given dirName "/" */
+    if (strcmp(dirName, "/") != 0) {
+        int dir_found_flag = _navigate_to_dir(dirName, cur_path, &current, &parent, FILE_TYPE_DIR);
+        if(dir_found_flag < 0) {
+            return dir_found_flag;
+        }
+        if (!dir_found_flag) {
+            return ERR_DIR_NOT_FOUND;
         }
     }
+
+    /* every block of the directory is read here, once */
+    if ((ERR = _dir_snapshot(current, &dir_table[DD])) < 0) {
+        return ERR;
+    }
+    return DD;
+}
+
+/* reads the next entry of an open directory */
+int tfs_readdirEntry(dirDescriptor DD, dirEntry* entry) {
+    return tfs_readdirEntries(DD, entry, 1);
+}
+
+/* reads up to max entries of an open directory, with the sizes of its files */
+int tfs_readdirEntries(dirDescriptor DD, dirEntry* entries, int max) {
+    /* make sure there is a mounted tfs */
+    if (mounted == NULL) {
+        return ERR_NO_DISK_MOUNTED;
+    }
+
+    /* make sure there is a dd entry */
+    openDir* dir = _open_dir(DD);
+    if (dir == NULL) {
+        return ERR_INVALID_DD;
+    }
+    if (entries == NULL || max < 0) {
+        return ERR_INVALID_INPUT;
+    }
+
+    return _dir_next(dir, entries, max, true);
+}
+
+/* closes an open directory */
+int tfs_closedir(dirDescriptor DD) {
+    /* make sure there is a dd entry */
+    openDir* dir = _open_dir(DD);
+    if (dir == NULL) {
+        return ERR_INVALID_DD;
+    }
+
+    _dir_close(dir);
     return TFS_SUCCESS;
 }
 
@@ -561,7 +1235,7 @@ int tfs_createDir(char* dirName) {
     }
 
 
-    int parent = SUPERBLOCK_DISKLOC;
+    int parent = mounted->root;
     char cur_path[FILENAME_LENGTH + 1];
     
     /* make sure the last directory in the path does not already exist */
@@ -576,9 +1250,9 @@ int tfs_createDir(char* dirName) {
     }
 
     /* get the next free block to store the new inode in */
-    char next_free_block = _pop_free_block();
-    if(!next_free_block) {
-        return ERR_DISK_OUT_OF_SPACE;
+    int next_free_block = _pop_free_block();
+    if(next_free_block < 0) {
+        return next_free_block;
     }
 
     /* set up the new inode: put name of file on the inode and information bytes */
@@ -590,6 +1264,7 @@ int tfs_createDir(char* dirName) {
     _write_long(inode_buffer, time(NULL), FILE_CREATEDTIME_LOC);
     _write_long(inode_buffer, time(NULL), FILE_ACCESSTIME_LOC);
     _write_long(inode_buffer, time(NULL), FILE_MODIFIEDTIME_LOC);
+    _set_ptr(inode_buffer + INODE_PARENT_LOC, 0, mounted->ptrSize, parent);
     int z = 0;
     while(cur_path[z] != '\000') {
         inode_buffer[FILE_NAME_LOC + z] = cur_path[z];
@@ -597,31 +1272,18 @@ int tfs_createDir(char* dirName) {
     }
 
     /* write the inode into the grabbed free_block */
-    if ((ERR = writeBlock(mounted->diskNum, next_free_block, inode_buffer)) < 0) {
-        return ERR;
-    }
-
-    /* grab the parent's inode and update its pointers to hold the new directory */
-    char parent_block[BLOCKSIZE];
-    if ((ERR = readBlock(mounted->diskNum, parent, parent_block)) < 0) {
+    if ((ERR = cacheWriteBlock(mounted->cache, next_free_block, inode_buffer)) < 0) {
         return ERR;
     }
 
-    /* find the first empty byte in the parent block and add the inode */
-    /* set the bounds for i based on wether in the superblock or a directory inode */
-    int start_bound = parent == 0 ? FIRST_SUPBLOCK_INODE_LOC : DIR_DATA_LOC;
-    int range = parent == 0 ? MAX_SUPBLOCK_INODES : MAX_DIR_INODES;
-    for(int i = start_bound; i < range + start_bound; i++) {
-        if(!parent_block[i]) {
-            parent_block[i] = next_free_block;
-            break;
-        }
-    }
-
-    /* update the parent block */
-    if ((ERR = writeBlock(mounted->diskNum, parent, parent_block)) < 0) {
-        return ERR;
+    /* add the new directory to its parent, giving the block back if there is
+        no room there, the name no longer misses */
+    int added = _dir_add(parent, cur_path, FILE_TYPE_DIR, next_free_block);
+    if (added < 0) {
+        _free_block(next_free_block);
+        return added;
     }
+    dcacheInsert(mounted->dentries, parent, cur_path, next_free_block, FILE_TYPE_DIR);
 
     return TFS_SUCCESS;
 } 
@@ -638,7 +1300,7 @@ int tfs_removeDir(char* dirName) {
         return ERR_INVALID_INPUT;  // ERR: invalid input error
     }
 
-    int current = SUPERBLOCK_DISKLOC;
+    int current = mounted->root;
     int parent = current;
     char cur_path[FILENAME_LENGTH + 1];
     
@@ -653,39 +1315,19 @@ int tfs_removeDir(char* dirName) {
         return ERR_DIR_NOT_FOUND; 
     }
    
-    /* re-grab the block of the directory and make sure it is empty */
-    char inode_buffer[BLOCKSIZE];
-    if ((ERR = readBlock(mounted->diskNum, current, inode_buffer)) < 0) {
+    /* make sure the directory is empty (ERR_DIR_NOT_EMPTY), giving back any index it has */
+    if ((ERR = _dir_release(current)) < 0) {
         return ERR;
     }
-    for(int i = DIR_DATA_LOC; i < MAX_DIR_INODES; i++) {
-        if(inode_buffer[i]) {
-            return ERR_DIR_NOT_EMPTY; // ERR: directory is not empty
-        }
-    }
 
-    /* remove the directory inode block and update its parent indoe */
+    /* remove the directory inode block and update its parent inode */
     if ((ERR = _free_block(current)) < 0) {
         return ERR;
     }
-    char parent_block[BLOCKSIZE];
-    if ((ERR = readBlock(mounted->diskNum, parent, parent_block)) < 0) {
-        return ERR;
-    }
-
-    /* set the bounds for i based on wether in the superblock or a directory inode */
-    int start_bound = parent == 0 ? FIRST_SUPBLOCK_INODE_LOC : DIR_DATA_LOC;
-    int range = parent == 0 ? MAX_SUPBLOCK_INODES : MAX_DIR_INODES;
-    for(int i = start_bound; i < range + start_bound; i++) {
-        if(parent_block[i] == current) {
-            parent_block[i] = EMPTY_TABLEVAL;
-        }
-    }
-
-    /* update the parent block */
-    if ((ERR = writeBlock(mounted->diskNum, parent, parent_block)) < 0) {
+    if ((ERR = _dir_remove(parent, current, cur_path)) < 0) {
         return ERR;
     }
+    dcacheForget(mounted->dentries, current);
 
     return TFS_SUCCESS;
 }
@@ -703,7 +1345,7 @@ int tfs_removeAll(char* dirName) {
         return ERR_INVALID_INPUT;  // ERR: invalid input error
     }
 
-    int current = SUPERBLOCK_DISKLOC;
+    int current = mounted->root;
     int parent = current;
     char cur_path[FILENAME_LENGTH + 1];
 
@@ -721,62 +1363,44 @@ int tfs_removeAll(char* dirName) {
         }
     }
 
-    /* re-grab the block of the directory and remove every item in it */
-    char current_inode[BLOCKSIZE];
-    if ((ERR = readBlock(mounted->diskNum, current, current_inode)) < 0) {
-        return ERR;
+    /* list the directory and remove every item in it, each removal takes
+        its entry out of the directory */
+    dirEntry* entries;
+    int count = _dir_list(current, &entries, NULL, NULL);
+    if (count < 0) {
+        return count;
     }
-    char inode_buffer[BLOCKSIZE];
-
-    /* set the bounds for i based on wether in the superblock or a directory inode */
-    int start_bound = current == 0 ? FIRST_SUPBLOCK_INODE_LOC : DIR_DATA_LOC;
-    int range = current == 0 ? MAX_SUPBLOCK_INODES : MAX_DIR_INODES;
-    for(int i = start_bound; i < range + start_bound; i++) {
-        if(current_inode[i]) {
-            memset(inode_buffer, 0, BLOCKSIZE);
-            readBlock(mounted->diskNum, current_inode[i], inode_buffer);
-
-            if (inode_buffer[FILE_TYPE_FLAG_LOC] == FILE_TYPE_FILE) {
-                if ((ERR = _remove_inode_and_blocks(current_inode[i], current)) < 0) {
-                    return ERR;
-                }
-                current_inode[i] = 0x0;
-                if ((ERR = writeBlock(mounted->diskNum, current, current_inode)) < 0) {
-                    return ERR;
-                }
-            } else if (inode_buffer[FILE_TYPE_FLAG_LOC] == FILE_TYPE_DIR) {
-                char inode[BLOCKSIZE]; 
-                if ((ERR = readBlock(mounted->diskNum, current_inode[i], inode)) < 0) {
-                    return ERR;
-                }
-
-                char* dir_path = malloc(sizeof(dirName) + sizeof(inode[FILE_NAME_LOC]) + 1);
-                if (dir_path == NULL) {
-                    return SYS_ERR_MALLOC;
-                }
-
-                strcpy(dir_path, dirName);
-                if (strcmp(dirName, "/") != 0) {
-                    strcat(dir_path, "/");
-                }
-                strcat(dir_path, inode_buffer + FILE_NAME_LOC);
-
-                if ((ERR = tfs_removeAll(dir_path)) < 0) { 
-                    return ERR;
-                }
-                free(dir_path);
+
+    int status = TFS_SUCCESS;
+    for(int i = 0; i < count && status >= 0; i++) {
+        if (entries[i].type == FILE_TYPE_FILE) {
+            status = _remove_inode_and_blocks(entries[i].inode, current);
+        } else if (entries[i].type == FILE_TYPE_DIR) {
+            char* dir_path = malloc(strlen(dirName) + 1 + FILENAME_LENGTH + 1);
+            if (dir_path == NULL) {
+                status = SYS_ERR_MALLOC;
+                break;
             }
-            current_inode[i] = 0x0;
-            if ((ERR = writeBlock(mounted->diskNum, current, current_inode)) < 0) {
-                return ERR;
+
+            strcpy(dir_path, dirName);
+            if (strcmp(dirName, "/") != 0) {
+                strcat(dir_path, "/");
             }
+            strcat(dir_path, entries[i].name);
+
+            status = tfs_removeAll(dir_path);
+            free(dir_path);
         }
     }
+    free(entries);
+    if (status < 0) {
+        return status;
+    }
 
 
-    /* if not the root directory,
+    /* if not the root directory (which only gives back its index),
     once everything is removed, delete the current directory */
-    return current == 0 ? 0 : tfs_removeDir(dirName);
+    return current == mounted->root ? _dir_release(current) : tfs_removeDir(dirName);
 }
 
 /* (E) timestamps */
@@ -789,7 +1413,8 @@ int tfs_readFileInfo(fileDescriptor FD) {
     }
 
     /* make sure there is an fd entry */
-    if(!fd_table[FD]) {
+    openFile* file = _open_file(FD);
+    if(file == NULL) {
         return ERR_INVALID_FD;
     }
 
@@ -798,11 +1423,7 @@ int tfs_readFileInfo(fileDescriptor FD) {
     time_t* accessedTime;
     uint8_t* fileName;
     int fileSize;
-    uint8_t inode[BLOCKSIZE];
-    
-    if ((ERR = readBlock(mounted->diskNum, fd_table[FD], inode)) < 0) {
-        return ERR;
-    }
+    uint8_t* inode = file->inode;
     fileName = inode + FILE_NAME_LOC;
     // Print file name
     printf("Name:\t\t%s\n", fileName);
@@ -828,4 +1449,126 @@ int tfs_readFileInfo(fileDescriptor FD) {
     printf("Accessed:\t%s", ctime(accessedTime));
 
     return TFS_SUCCESS;
-}
\ No newline at end of file
+}
+
+/* block cache */
+
+/* writes every cached block that changed back to the disk and flushes the disk */
+int tfs_sync() {
+    /* make sure there is a mounted tfs */
+    if (mounted == NULL) {
+        return ERR_NO_DISK_MOUNTED;
+    }
+
+    if ((ERR = _flush_open_files()) < 0) {
+        return ERR;
+    }
+    if (mounted->freeSpace != NULL && (ERR = _store_bitmap(mounted->cache, mounted->freeSpace)) < 0) {
+        return ERR;
+    }
+    if ((ERR = cacheSync(mounted->cache)) < 0) {
+        return ERR;
+    }
+    return syncDisk(mounted->diskNum);
+}
+
+/* sets how many blocks the block cache holds, starting with the next mount */
+int tfs_setCacheSize(int blocks) {
+    if (blocks <= 0) {
+        return ERR_INVALID_INPUT;
+    }
+
+    cache_size = blocks;
+    return TFS_SUCCESS;
+}
+
+/* copies the hit/miss/eviction counters of the mounted tfs's cache */
+int tfs_getCacheStats(cacheStats* stats) {
+    /* make sure there is a mounted tfs */
+    if (mounted == NULL) {
+        return ERR_NO_DISK_MOUNTED;
+    }
+
+    return getCacheStats(mounted->cache, stats);
+}
+
+/* free space */
+
+/* counts the free blocks of the mounted tfs */
+int tfs_freeBlocks() {
+    /* make sure there is a mounted tfs */
+    if (mounted == NULL) {
+        return ERR_NO_DISK_MOUNTED;
+    }
+
+    /* bitmap disks keep a running count, free-list disks one counted at mount */
+    if (mounted->freeSpace != NULL) {
+        return freeMapCount(mounted->freeSpace);
+    }
+    return mounted->freeBlocks;
+}
+
+/* sets how tfs_writeFile() picks the blocks for a file's data */
+int tfs_setAllocPolicy(int policy) {
+    if (policy != TFS_ALLOC_FIRST_FREE && policy != TFS_ALLOC_EXTENT) {
+        return ERR_INVALID_INPUT;
+    }
+
+    alloc_policy = policy;
+    return TFS_SUCCESS;
+}
+
+/* sets when reads update access times, starting with the next mount */
+int tfs_setAtimePolicy(int policy) {
+    if (policy < TFS_ATIME_STRICT || policy > TFS_ATIME_LAZY) {
+        return ERR_INVALID_INPUT;
+    }
+
+    atime_policy = policy;
+    return TFS_SUCCESS;
+}
+
+/* reports how many pieces the mounted tfs's files and free space are in */
+int tfs_getFragStats(fragStats* stats) {
+    /* make sure there is a mounted tfs */
+    if (mounted == NULL) {
+        return ERR_NO_DISK_MOUNTED;
+    }
+    if (stats == NULL) {
+        return ERR_INVALID_INPUT;
+    }
+    memset(stats, 0, sizeof(fragStats));
+
+    if ((ERR = _collect_fragmentation(mounted->root, stats)) < 0) {
+        return ERR;
+    }
+
+    /* free runs come from the bitmap, or from a bitmap built off the free list */
+    freeMap* free_space = mounted->freeSpace;
+    if (free_space == NULL) {
+        if ((free_space = freeMapCreate(getDiskSize(mounted->diskNum))) == NULL) {
+            return SYS_ERR_MALLOC;
+        }
+        uint8_t block[BLOCKSIZE];
+        if ((ERR = cacheReadBlock(mounted->cache, SUPERBLOCK_DISKLOC, block)) < 0) {
+            freeMapDestroy(free_space);
+            return ERR;
+        }
+        uint8_t next = block[FREE_PTR_LOC];
+        while (next != 0 && !freeMapIsFree(free_space, next)) {
+            freeMapSetFree(free_space, next, true);
+            if ((ERR = cacheReadBlock(mounted->cache, next, block)) < 0) {
+                freeMapDestroy(free_space);
+                return ERR;
+            }
+            next = block[FREE_PTR_LOC];
+        }
+    }
+    stats->freeBlocks = freeMapCount(free_space);
+    stats->freeRuns = freeMapRuns(free_space, &stats->largestFreeRun);
+    if (free_space != mounted->freeSpace) {
+        freeMapDestroy(free_space);
+    }
+
+    return TFS_SUCCESS;
+}
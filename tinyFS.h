@@ -2,6 +2,79 @@
 #define LIBTINY_H
 
 #include "libDisk.h"
+#include "libCache.h"
+#include "libBitmap.h"
+#include "libDentry.h"
+
+/* how fragmented the mounted file system is, see tfs_getFragStats()
+(defined ahead of libTinyFS.h, whose prototypes use it) */
+typedef struct fragStats {
+    // Files holding data, and the data blocks they hold
+    int files;
+    int dataBlocks;
+    // Runs of consecutive block numbers those files are made of, a file in one piece is one extent
+    int extents;
+    // Free blocks, the runs of consecutive free blocks and the longest such run
+    int freeBlocks;
+    int freeRuns;
+    int largestFreeRun;
+} fragStats;
+
+/* a write stream open on a file descriptor (see tfs_openStream()): the data blocks
+written so far and the one block still being filled, the file itself is untouched
+until the stream is committed */
+typedef struct fileWriter {
+    // Data blocks already written, in file order, with room for 'capacity'
+    uint32_t* blocks;
+    int numBlocks;
+    int capacity;
+    // Bytes pushed so far, the last partialBytes of them still in 'partial'
+    int size;
+    int partialBytes;
+    uint8_t partial[BLOCKSIZE];
+} fileWriter;
+
+/* one entry of a directory, as the directory helpers hand them out (defined ahead of
+libTinyFS.h as well) */
+typedef struct dirEntry {
+    uint32_t inode;
+    // FILE_TYPE_* flag of the entry
+    int type;
+    // FILENAME_LENGTH characters at most, terminated
+    char name[8 + 1];
+    // Bytes in a file, 0 for a directory (only filled in by tfs_readdirEntries())
+    int size;
+} dirEntry;
+
+/* one open file descriptor: the file's inode stays in memory while it is open, so
+reading and seeking touch no inode block. Changes to the copy that only the descriptor
+makes (access times) mark it dirty and reach the cache on close, tfs_sync() or unmount;
+changes to the file itself (writes, renames) go to the cache at once and to every
+descriptor of the file (defined ahead of libTinyFS.h too, its helpers use it) */
+typedef struct openFile {
+    // Inode block of the file, EMPTY_TABLEVAL if the descriptor is not in use
+    uint32_t inodeNum;
+    // Where this descriptor reads next, each descriptor has its own
+    int offset;
+    // Whether 'inode' holds changes the cache has not seen
+    bool dirty;
+    uint8_t inode[BLOCKSIZE];
+    // Write stream open on the descriptor, NULL if none
+    fileWriter* writer;
+} openFile;
+
+/* one open directory descriptor: every entry of the directory is listed when it is
+opened, reading each directory block once, and handed out from memory in order
+(defined ahead of libTinyFS.h with the other descriptors) */
+typedef struct openDir {
+    // Whether the descriptor is in use
+    bool inUse;
+    // The entries listed at open, and the next one to hand out
+    dirEntry* entries;
+    int numEntries;
+    int next;
+} openDir;
+
 #include "libTinyFS.h"
 #include <stdlib.h>
 #include <stdio.h>
@@ -30,9 +103,35 @@
     /* 8 bit addressing for free blocks and inode data means max blocks is 256 */
     #define MAX_BLOCKS 256
 
+    /* TFS_FEAT_ADDR32 disks address blocks with 32 bits, capped by the int block numbers of libDisk */
+    #define MAX_BLOCKS_ADDR32 INT32_MAX
+
     /* the amount of FDs able to be open at once for the file system */
     #define FD_TABLESIZE 256
 
+    /* the amount of directories able to be open at once */
+    #define DIR_TABLESIZE 64
+
+    /* how many blocks the block cache of a mounted file system holds by default */
+    #define DEFAULT_CACHE_BLOCKS 64
+
+    /* how many directory lookups the dentry cache of a mounted file system remembers */
+    #define DEFAULT_DENTRY_ENTRIES 1024
+
+    /* how tfs_writeFile() picks the blocks for a file's data */
+    #define TFS_ALLOC_FIRST_FREE 0  // the next free blocks, wherever they are
+    #define TFS_ALLOC_EXTENT     1  // as few contiguous runs as possible (bitmap disks)
+
+    /* when reading a file updates its access time */
+    #define TFS_ATIME_STRICT    0   // on every open and read
+    #define TFS_ATIME_RELATIME  1   // only if it is not newer than the modified time, or a day old
+    #define TFS_ATIME_NOATIME   2   // never
+    #define TFS_ATIME_LAZY      3   // in memory, reaching the disk only with another change
+    #define RELATIME_INTERVAL   (24 * 60 * 60)
+
+    /* how many blocks are read per batch when scanning the whole disk */
+    #define FETCH_PARENT_CHUNK 16
+
 /* ^ MACROS FOR DEFAULT SIZES ^ */    
 
 /* standardized block information byte locations */
@@ -47,6 +146,11 @@
 #define INODE       0x02
 #define FILEEX      0x03
 #define FREE        0x04
+#define BITMAP      0x05
+#define INDIRECT    0x06
+#define EXTENT      0x07
+#define DIRINDEX    0x08
+#define DIRLEAF     0x09
 
 /* the value of the safety byte for each block */
 #define SAFETY_HEX  0x44
@@ -62,8 +166,40 @@
     #define FIRST_SUPBLOCK_INODE_LOC    (0 + NUM_RESERVED_BYTES)                // 4
     #define MAX_SUPBLOCK_INODES         (BLOCKSIZE - FIRST_SUPBLOCK_INODE_LOC)  // 252
 
+    /* format feature flags, kept in the superblock's EMPTY_BYTE_LOC (0 for the original format) */
+    #define TFS_FEAT_BITMAP             0x01    // free space is tracked in bitmap blocks, not a free list
+    #define TFS_FEAT_ADDR32             0x02    // block pointers are 4 bytes wide (needs TFS_FEAT_BITMAP)
+    #define TFS_FEAT_INDIRECT           0x04    // files map their data through indirect blocks past the direct pointers
+    #define TFS_FEAT_EXTENTS            0x08    // files map their data as runs of blocks (not with TFS_FEAT_INDIRECT)
+    #define TFS_FEAT_INLINE             0x10    // files small enough to fit keep their bytes in the inode
+    #define TFS_FEAT_DIRENTS            0x20    // directory entries hold the child's name and type next to its inode
+    #define TFS_FEAT_DIRINDEX           0x40    // directories outgrowing their inode index entries by name hash (needs TFS_FEAT_DIRENTS)
+    #define TFS_FEAT_ROOTDIR            0x80    // the root is a directory inode the superblock points to, not entries in the superblock
+    #define TFS_FEAT_KNOWN              (TFS_FEAT_BITMAP | TFS_FEAT_ADDR32 | TFS_FEAT_INDIRECT | TFS_FEAT_EXTENTS | TFS_FEAT_INLINE | TFS_FEAT_DIRENTS | TFS_FEAT_DIRINDEX | TFS_FEAT_ROOTDIR)
+
+    /* how many bytes one block pointer (in the superblock, inodes and fd table) takes */
+    #define PTR_SIZE(features)          ((features) & TFS_FEAT_ADDR32 ? 4 : 1)
+
+    /* on TFS_FEAT_ROOTDIR disks the superblock's only entry is this pointer to the root
+    directory's inode (named ROOT_DIR_NAME), which grows like any other directory */
+    #define ROOT_INODE_LOC              FIRST_SUPBLOCK_INODE_LOC
+    #define ROOT_DIR_NAME               "/"
+
 /* ^ MACROS FOR SUPER BLOCK ^ */
 
+/* ~ MACROS FOR FREE-SPACE BITMAP BLOCKS ~ */
+    /* the bitmap blocks directly follow the superblock */
+    #define FIRST_BITMAP_DISKLOC        1
+
+    /* one bit per block (set when the block is free), lowest block in the lowest bit */
+    #define FIRST_BITMAP_LOC            (0 + NUM_RESERVED_BYTES)                // 4
+    #define BITMAP_BITS_PER_BLOCK       ((BLOCKSIZE - FIRST_BITMAP_LOC) * 8)    // 2016
+
+    /* how many bitmap blocks a disk of n blocks needs */
+    #define NUM_BITMAP_BLOCKS(n)        (((n) + BITMAP_BITS_PER_BLOCK - 1) / BITMAP_BITS_PER_BLOCK)
+
+/* ^ MACROS FOR FREE-SPACE BITMAP BLOCKS ^ */
+
 /* ~ MACROS FOR INODE BLOCK ~ */
     /* inode block constants */
     #define FILE_TYPE_FILE      0x66                                    // f
@@ -76,7 +212,12 @@
 
     /* file inode block byte locations */
     #define FILE_SIZE_LOC       (FILE_NAME_LOC + FILENAME_LENGTH + 1)   // 14
-    #define FILE_OFFSET_LOC     (FILE_SIZE_LOC + 4)                     // 18
+    #define FILE_OFFSET_LOC     (FILE_SIZE_LOC + 4)                     // 18 (unused, offsets live in the fd table)
+
+    /* file and directory inodes keep a pointer to the directory holding their entry where
+    the offset would be: its inode, or 0 for the superblock (the root without TFS_FEAT_ROOTDIR).
+    Inodes written before the pointer was kept hold 0 too, so a 0 has to be confirmed */
+    #define INODE_PARENT_LOC    FILE_OFFSET_LOC                         // 18
         
         /* timestamp macros */
         #define FILE_CREATEDTIME_LOC    (FILE_OFFSET_LOC + 4)
@@ -84,6 +225,9 @@
         #define FILE_ACCESSTIME_LOC     (FILE_MODIFIEDTIME_LOC + 8)
 
     #define FILE_DATA_LOC       (FILE_ACCESSTIME_LOC + 8)              
+
+    /* how a file inode maps its data (FILE_MAP_* flags), 0 for the plain pointer table */
+    #define FILE_MAP_LOC        EMPTY_BYTE_LOC                          // 3
   
     /* directory inode block byte locations */
 
@@ -94,14 +238,90 @@
 
     #define DIR_DATA_LOC        (DIR_ACCESSTIME_LOC + 8)   
 
-    /* how many data blocks a file inode can hold */
+    /* how many data blocks a file inode can hold (divide by PTR_SIZE() for wider pointers) */
     #define MAX_FILE_DATA       (BLOCKSIZE - FILE_DATA_LOC)
 
-    /* how many inode blocks a directory inode can hold */
+    /* how many inode blocks a directory inode can hold (divide by PTR_SIZE() for wider pointers) */
     #define MAX_DIR_INODES      (BLOCKSIZE - DIR_DATA_LOC) 
 
+    /* a directory's entries (and the root's, in the superblock) are bare inode pointers, but on
+    TFS_FEAT_DIRENTS disks each entry also holds the child's FILE_TYPE_* flag and its name
+    (zero padded, without a terminator when it is FILENAME_LENGTH long), so directories are
+    searched and listed without reading their children */
+    #define DIRENT_INODE            0
+    #define DIRENT_TYPE(features)   PTR_SIZE(features)
+    #define DIRENT_NAME(features)   (PTR_SIZE(features) + 1)
+    #define DIRENT_SIZE(features)   ((features) & TFS_FEAT_DIRENTS ? PTR_SIZE(features) + 1 + FILENAME_LENGTH : PTR_SIZE(features))
+
+    /* on TFS_FEAT_INLINE disks a file of at most MAX_INLINE_DATA bytes keeps them where its
+    pointer table would be, and its map byte (FILE_MAP_LOC, the empty byte) says so */
+    #define FILE_MAP_INLINE     0x02
+    #define MAX_INLINE_DATA     MAX_FILE_DATA                           // 210
+
 /* ^ MACROS FOR INODE BLOCK ^ */
 
+/* ~ MACROS FOR INDIRECT BLOCKS ~ */
+    /* on TFS_FEAT_INDIRECT disks the last INDIRECT_LEVELS pointers of a file inode lead to a
+    single, double and triple indirect block, the pointers before them to data blocks */
+    #define INDIRECT_LEVELS     3
+
+    /* how many levels of indirect blocks this one heads (1: its pointers lead to data blocks) */
+    #define INDIRECT_LEVEL_LOC  FREE_PTR_LOC                            // 2
+
+    /* where the pointers start and how many bytes they fill (divide by PTR_SIZE()) */
+    #define FIRST_INDIRECT_LOC  (0 + NUM_RESERVED_BYTES)                // 4
+    #define MAX_INDIRECT_PTRS   (BLOCKSIZE - FIRST_INDIRECT_LOC)        // 252
+
+/* ^ MACROS FOR INDIRECT BLOCKS ^ */
+
+/* ~ MACROS FOR EXTENTS ~ */
+    /* on TFS_FEAT_EXTENTS disks a file inode's pointer table holds extents of three pointer-sized
+    fields: the first file block of the run, its first disk block and its length. They are sorted,
+    empty (length 0) ones last */
+    #define EXTENT_LOGICAL      0
+    #define EXTENT_START        1
+    #define EXTENT_LENGTH       2
+    #define EXTENT_SIZE(features)   (3 * PTR_SIZE(features))
+
+    /* when the extents do not fit, the inode's map byte says so and its extents point to EXTENT
+    blocks (the start) holding the real ones, each covering 'length' file blocks */
+    #define FILE_MAP_EXTENT_TREE    0x01
+
+    /* where the extents of an EXTENT block start and how many bytes they fill */
+    #define FIRST_EXTENT_LOC    (0 + NUM_RESERVED_BYTES)                // 4
+    #define MAX_EXTENT_BYTES    (BLOCKSIZE - FIRST_EXTENT_LOC)          // 252
+
+/* ^ MACROS FOR EXTENTS ^ */
+
+/* ~ MACROS FOR DIRECTORY INDEXES ~ */
+    /* on TFS_FEAT_DIRINDEX disks a directory whose entries no longer fit in its inode moves them
+    to DIRLEAF blocks, and its map byte says so. The inode then holds an index of (hash, block)
+    pairs sorted by hash, the first one 0: the entries whose name hashes (_dir_hash()) from one
+    hash up to the next are in that block. Below DIR_INDEX_LEVELS_LOC levels of DIRINDEX blocks
+    holding the same pairs come the leaves, a full node is split in two and the index grows a
+    level when the inode is full, so a lookup reads one block per level */
+    #define DIR_MAP_INDEX           0x04
+    #define DIR_INDEX_LEVELS_LOC    DIR_DATA_LOC                            // 46
+    #define DIR_INDEX_LOC           (DIR_DATA_LOC + 1)
+    #define MAX_DIR_INDEX           (MAX_DIR_INODES - 1)
+    #define DIR_INDEX_MAX_LEVELS    3
+
+    /* one (hash, block) pair, the hash 4 bytes big-endian */
+    #define DIRINDEX_HASH           0
+    #define DIRINDEX_PTR            4
+    #define DIRINDEX_ENTRY_SIZE(features)   (4 + PTR_SIZE(features))
+
+    /* how many levels of DIRINDEX blocks are below a DIRINDEX block (0: its pairs lead to leaves) */
+    #define DIRINDEX_LEVEL_LOC      FREE_PTR_LOC                            // 2
+
+    /* where the pairs of a DIRINDEX block / the entries of a DIRLEAF block start, and the bytes they fill */
+    #define FIRST_DIRINDEX_LOC      (0 + NUM_RESERVED_BYTES)                // 4
+    #define MAX_DIRINDEX_BYTES      (BLOCKSIZE - FIRST_DIRINDEX_LOC)        // 252
+    #define FIRST_DIRLEAF_LOC       (0 + NUM_RESERVED_BYTES)                // 4
+    #define MAX_DIRLEAF_BYTES       (BLOCKSIZE - FIRST_DIRLEAF_LOC)         // 252
+
+/* ^ MACROS FOR DIRECTORY INDEXES ^ */
+
 /* ~ MACROS FOR DATA/FILE-EXTENT/FREE BLOCKS */
     /* starting location of data in the data block */
     #define FIRST_DATA_LOC      (0 + NUM_RESERVED_BYTES)                // 4
@@ -116,6 +336,23 @@ typedef struct tinyFS {
     char *name;
     // Disk number returned by openDisk()
     int diskNum;
+    // Write-back cache every block access of the mounted disk goes through
+    blockCache* cache;
+    // TFS_FEAT_* flags of the mounted format
+    int features;
+    // Bytes per block pointer, PTR_SIZE(features)
+    int ptrSize;
+    // In-memory copy of the free-space bitmap, NULL for free-list disks
+    freeMap* freeSpace;
+    // Length of the free list of a free-list disk, counted at mount and kept up to date
+    // by _pop_free_block()/_free_blocks() (a bitmap disk's count is in freeSpace)
+    int freeBlocks;
+    // TFS_ATIME_* policy the disk was mounted with
+    int atimePolicy;
+    // Directory lookups made since the mount, see libDentry.h
+    dentryCache* dentries;
+    // Block holding the root directory: its inode, or the superblock without TFS_FEAT_ROOTDIR
+    int root;
 } tinyFS;
 
 /* use as a special type to keep track of files. This value serves as the
@@ -127,7 +364,8 @@ typedef int fileDescriptor;
 
 extern int ERR;
 extern tinyFS* mounted;
-extern uint8_t fd_table[FD_TABLESIZE]; 
+extern openFile fd_table[FD_TABLESIZE]; 
 extern int fd_table_index;
+extern openDir dir_table[DIR_TABLESIZE];
 
 #endif
\ No newline at end of file
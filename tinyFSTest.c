@@ -4,6 +4,7 @@
 #include <fcntl.h>
 #include <assert.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "tinyFS.h"
 #include "libTinyFS.h"
@@ -11,6 +12,25 @@
 void testTfs_mkfs();
 void testTfs_mount();
 void testTfs_updateFile();
+void testTfs_cache();
+void testTfs_bitmap();
+void testTfs_extents();
+void testTfs_freeBatch();
+void testTfs_addr32();
+void testTfs_indirect();
+void testTfs_extentMap();
+void testTfs_inline();
+void testTfs_openFiles();
+void testTfs_read();
+void testTfs_pwrite();
+void testTfs_stream();
+void testTfs_atime();
+void testTfs_dentry();
+void testTfs_dirents();
+void testTfs_dirIndex();
+void testTfs_rootDir();
+void testTfs_parent();
+void testTfs_readdirIter();
 void* verify_contents(char *filePath, int location, size_t dataSize);
 
 int main(int argc, char *argv[]) {
@@ -18,6 +38,25 @@ int main(int argc, char *argv[]) {
     testTfs_mkfs();
     testTfs_mount();
     testTfs_updateFile();
+    testTfs_cache();
+    testTfs_bitmap();
+    testTfs_extents();
+    testTfs_freeBatch();
+    testTfs_addr32();
+    testTfs_indirect();
+    testTfs_extentMap();
+    testTfs_inline();
+    testTfs_openFiles();
+    testTfs_read();
+    testTfs_pwrite();
+    testTfs_stream();
+    testTfs_atime();
+    testTfs_dentry();
+    testTfs_dirents();
+    testTfs_dirIndex();
+    testTfs_rootDir();
+    testTfs_parent();
+    testTfs_readdirIter();
 
     printf("> tinyFS Tests passed.\n");
     return 0;
@@ -157,6 +196,7 @@ void testTfs_updateFile()
     // Testing making a new file
     fileDescriptor fileNum = tfs_openFile("test");
     assert(fileNum >= 0);
+    assert(tfs_sync() == 0);
     char *inode = (char*) verify_contents(diskName, sizeof(char) * BLOCKSIZE * 1, sizeof(char) *BLOCKSIZE);
     assert(inode[BLOCK_TYPE_LOC] == INODE);
     assert(inode[SAFETY_BYTE_LOC] == 0x44);
@@ -211,6 +251,7 @@ void testTfs_updateFile()
     assert(wFileNum >= 0);
     char testStr[44] = "The quick brown fox jumps over the lazy dog";
     assert(tfs_writeFile(wFileNum, testStr, 44) == 0);
+    assert(tfs_sync() == 0);
     char *wFileinode = verify_contents(diskName, sizeof(char) * BLOCKSIZE * 1, sizeof(char) * BLOCKSIZE);
     char dataPtr = wFileinode[FILE_DATA_LOC];
     char *wFileData = verify_contents(diskName, sizeof(char) * BLOCKSIZE * dataPtr, sizeof(char) * BLOCKSIZE);
@@ -228,6 +269,7 @@ void testTfs_updateFile()
 
     char newString[72] = "This is a brand new string. It should overwrite any data in the blocks.";
     assert(tfs_writeFile(wFileNum, newString, 72) == 0);
+    assert(tfs_sync() == 0);
     wFileinode = verify_contents(diskName, sizeof(char) * BLOCKSIZE * 1, sizeof(char) * BLOCKSIZE);
     dataPtr = wFileinode[FILE_DATA_LOC];
     wFileData = verify_contents(diskName, sizeof(char) * BLOCKSIZE * dataPtr, sizeof(char) * BLOCKSIZE);
@@ -245,6 +287,7 @@ void testTfs_updateFile()
 
     char bigString[256] = "This is a very very looong string. It should take up 2 blocks. Lorem ipsum odor amet, consectetuer adipiscing elit. Libero curae hendrerit vel facilisis fames tellus quis nostra. Ac etiam risus in eu rutrum in.abcdefghijklmnopqrstuvwxyz1234567890qwertyuio";
     assert(tfs_writeFile(wFileNum, bigString, 256) == 0);
+    assert(tfs_sync() == 0);
     wFileinode = verify_contents(diskName, sizeof(char) * BLOCKSIZE * 1, sizeof(char) * BLOCKSIZE);
     dataPtr = wFileinode[FILE_DATA_LOC];
     wFileData = verify_contents(diskName, sizeof(char) * BLOCKSIZE * dataPtr, sizeof(char) * BLOCKSIZE);
@@ -403,6 +446,1828 @@ void testTfs_updateFile()
 
 }
 
+void testTfs_cache()
+{
+    char diskName[25] = "testFiles/cacheTest.dsk";
+    cacheStats stats;
+    diskStats dStats;
+    char fileByte;
+    remove(diskName);
+    tfs_unmount();
+
+    // Cache size has to be positive, and there are no stats without a mount
+    assert(tfs_setCacheSize(0) != 0);
+    assert(tfs_getCacheStats(&stats) == ERR_NO_DISK_MOUNTED);
+    assert(tfs_sync() == ERR_NO_DISK_MOUNTED);
+
+    assert(tfs_mkfs(diskName, DEFAULT_DISK_SIZE) == 0);
+    assert(tfs_mount(diskName) == 0);
+
+    // Writes stay in the cache until they are synced
+    fileDescriptor fd = tfs_openFile("/cached");
+    assert(fd >= 0);
+    assert(tfs_writeFile(fd, "cached data", 12) == 0);
+    char *rawInode = verify_contents(diskName, BLOCKSIZE * 1, BLOCKSIZE);
+    assert(rawInode[BLOCK_TYPE_LOC] == FREE);
+    free(rawInode);
+    assert(tfs_sync() == 0);
+    rawInode = verify_contents(diskName, BLOCKSIZE * 1, BLOCKSIZE);
+    assert(rawInode[BLOCK_TYPE_LOC] == INODE);
+    assert(strcmp(rawInode + FILE_NAME_LOC, "cached") == 0);
+    free(rawInode);
+
+    // Re-reading a file is served from the cache without touching the disk
+    assert(tfs_seek(fd, 0) == 0);
+    assert(tfs_sync() == 0);
+    assert(resetDiskStats(mounted->diskNum) == 0);
+    assert(tfs_getCacheStats(&stats) == 0);
+    unsigned long hitsBefore = stats.hits;
+    for (int i = 0; i < 12; i++) {
+        assert(tfs_readByte(fd, &fileByte) == 0);
+        assert(fileByte == "cached data"[i]);
+    }
+    assert(getDiskStats(mounted->diskNum, &dStats) == 0);
+    assert(dStats.blocksRead == 0 && dStats.blocksWritten == 0);
+    assert(tfs_getCacheStats(&stats) == 0);
+    assert(stats.hits > hitsBefore);
+    assert(tfs_unmount() == 0);
+
+    // Unmounting writes everything back, so a remount sees the data
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/cached");
+    assert(tfs_seek(fd, 0) == 0);
+    assert(tfs_readByte(fd, &fileByte) == 0);
+    assert(fileByte == 'c');
+    assert(tfs_unmount() == 0);
+
+    // A tiny cache still works, it just evicts (and writes back) more often
+    assert(tfs_setCacheSize(2) == 0);
+    assert(tfs_mount(diskName) == 0);
+    char content[1000];
+    for (int i = 0; i < 1000; i++) {
+        content[i] = 'a' + (i % 26);
+    }
+    fd = tfs_openFile("/big");
+    assert(tfs_writeFile(fd, content, 1000) == 0);
+    for (int i = 0; i < 1000; i++) {
+        assert(tfs_readByte(fd, &fileByte) == 0);
+        assert(fileByte == content[i]);
+    }
+    assert(tfs_getCacheStats(&stats) == 0);
+    assert(stats.evictions > 0);
+    assert(stats.writebacks > 0);
+    assert(tfs_unmount() == 0);
+    assert(tfs_setCacheSize(DEFAULT_CACHE_BLOCKS) == 0);
+
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/big");
+    assert(tfs_seek(fd, 0) == 0);
+    for (int i = 0; i < 1000; i++) {
+        assert(tfs_readByte(fd, &fileByte) == 0);
+        assert(fileByte == content[i]);
+    }
+    assert(tfs_unmount() == 0);
+    remove(diskName);
+}
+
+/* flips one bit of the on-disk bitmap of an unmounted bitmap disk */
+void flip_bitmap_bit(char *diskName, int block)
+{
+    int fd = open(diskName, O_RDWR);
+    off_t where = BLOCKSIZE * FIRST_BITMAP_DISKLOC + FIRST_BITMAP_LOC + block / 8;
+    uint8_t byte;
+    assert(pread(fd, &byte, 1, where) == 1);
+    byte ^= 1 << (block % 8);
+    assert(pwrite(fd, &byte, 1, where) == 1);
+    close(fd);
+}
+
+void testTfs_bitmap()
+{
+    char diskName[25] = "testFiles/bitmapTest.dsk";
+    int numBlocks = DEFAULT_DISK_SIZE / BLOCKSIZE;
+    diskStats dStats;
+    char fileByte;
+    remove(diskName);
+    tfs_unmount();
+
+    // Free-list disks count their free blocks by walking the list
+    assert(tfs_freeBlocks() == ERR_NO_DISK_MOUNTED);
+    assert(tfs_mkfs(diskName, DEFAULT_DISK_SIZE) == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_freeBlocks() == numBlocks - 1);
+    assert(tfs_unmount() == 0);
+
+    // Unknown format flags and disks too small for their bitmap are refused
+    assert(tfs_mkfsFormat(diskName, DEFAULT_DISK_SIZE, 0x100) == ERR_INVALID_INPUT);
+    assert(tfs_mkfsFormat(diskName, BLOCKSIZE * 2, TFS_FEAT_BITMAP) == ERR_INVALID_INPUT);
+
+    // Formatting only writes the superblock and the bitmap, the rest stays a hole
+    assert(tfs_mkfsFormat(diskName, BLOCKSIZE * MAX_BLOCKS, TFS_FEAT_BITMAP) == 0);
+    struct stat file_stat;
+    assert(stat(diskName, &file_stat) == 0);
+    assert(file_stat.st_size == BLOCKSIZE * MAX_BLOCKS);
+    assert(file_stat.st_blocks * 512 < file_stat.st_size);
+
+    assert(tfs_mkfsFormat(diskName, DEFAULT_DISK_SIZE, TFS_FEAT_BITMAP) == 0);
+    uint8_t *raw = verify_contents(diskName, 0, BLOCKSIZE * 2);
+    assert(raw[BLOCK_TYPE_LOC] == SUPERBLOCK && raw[EMPTY_BYTE_LOC] == TFS_FEAT_BITMAP);
+    assert(raw[FREE_PTR_LOC] == 0);
+    uint8_t *bitmap = raw + BLOCKSIZE;
+    assert(bitmap[BLOCK_TYPE_LOC] == BITMAP && bitmap[SAFETY_BYTE_LOC] == SAFETY_HEX);
+    // blocks 0 and 1 are in use, 2 to 39 are free and nothing exists past 39
+    assert(bitmap[FIRST_BITMAP_LOC] == 0xFC);
+    for (int i = 1; i < 5; i++) {
+        assert(bitmap[FIRST_BITMAP_LOC + i] == 0xFF);
+    }
+    assert(bitmap[FIRST_BITMAP_LOC + 5] == 0);
+    free(raw);
+
+    // Allocation works from memory: no block is read to find free space
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_freeBlocks() == numBlocks - 2);
+    assert(resetDiskStats(mounted->diskNum) == 0);
+    char content[600];
+    memset(content, 'x', 600);
+    fileDescriptor fd = tfs_openFile("/bits");
+    assert(fd >= 0);
+    assert(tfs_writeFile(fd, content, 600) == 0);
+    assert(getDiskStats(mounted->diskNum, &dStats) == 0);
+    assert(dStats.blocksRead == 0);
+    assert(tfs_freeBlocks() == numBlocks - 6);
+
+    // The on-disk bitmap only catches up on sync: inode 2, data 3 to 5
+    raw = verify_contents(diskName, BLOCKSIZE, BLOCKSIZE);
+    assert(raw[FIRST_BITMAP_LOC] == 0xFC);
+    free(raw);
+    assert(tfs_sync() == 0);
+    raw = verify_contents(diskName, BLOCKSIZE, BLOCKSIZE);
+    assert(raw[FIRST_BITMAP_LOC] == 0xC0);
+    free(raw);
+
+    // Rewriting and deleting give blocks back, and freed blocks are reused lowest first
+    assert(tfs_writeFile(fd, content, 10) == 0);
+    assert(tfs_freeBlocks() == numBlocks - 4);
+    fileDescriptor fd2 = tfs_openFile("/more");
+    assert(fd2 >= 0);
+    assert(tfs_writeFile(fd2, content, 300) == 0);
+    assert(tfs_freeBlocks() == numBlocks - 7);
+    assert(tfs_deleteFile(fd) == 0);
+    assert(tfs_freeBlocks() == numBlocks - 5);
+    assert(tfs_unmount() == 0);
+
+    // A remount sees the same free space and file contents
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_freeBlocks() == numBlocks - 5);
+    fd2 = tfs_openFile("/more");
+    assert(tfs_seek(fd2, 299) == 0);
+    assert(tfs_readByte(fd2, &fileByte) == 0 && fileByte == 'x');
+    int inode = fd_table[fd2].inodeNum;
+    assert(tfs_unmount() == 0);
+
+    // The bitmap has to agree with the blocks the file system really uses
+    flip_bitmap_bit(diskName, inode);
+    assert(tfs_mount(diskName) == ERR_BAD_DISK);
+    flip_bitmap_bit(diskName, inode);
+    flip_bitmap_bit(diskName, numBlocks - 1);
+    assert(tfs_mount(diskName) == ERR_BAD_DISK);
+    flip_bitmap_bit(diskName, numBlocks - 1);
+    flip_bitmap_bit(diskName, numBlocks);
+    assert(tfs_mount(diskName) == ERR_BAD_DISK);
+    flip_bitmap_bit(diskName, numBlocks);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_unmount() == 0);
+
+    // Run searches work a word at a time on the in-memory map
+    freeMap *map = freeMapCreate(200);
+    int start;
+    assert(freeMapFindRun(map, 1, &start) == 0);
+    for (int i = 10; i < 20; i++) {
+        assert(freeMapSetFree(map, i, true) == 0);
+    }
+    for (int i = 50; i < 130; i++) {
+        assert(freeMapSetFree(map, i, true) == 0);
+    }
+    assert(freeMapCount(map) == 90);
+    assert(freeMapFindRun(map, 5, &start) == 5 && start == 10);
+    assert(freeMapFindRun(map, 30, &start) == 30 && start == 50);
+    assert(freeMapFindRun(map, 100, &start) == 80 && start == 50);
+    assert(freeMapAlloc(map) == 10);
+    assert(freeMapSetFree(map, 200, true) == ERR_INVALID_INPUT);
+    freeMapDestroy(map);
+
+    remove(diskName);
+}
+
+/* writes 'blocks' data blocks worth of 'fill' to a new file */
+fileDescriptor write_blocks(char *name, int blocks, char fill)
+{
+    char *content = malloc(blocks * MAX_DATA_SPACE);
+    memset(content, fill, blocks * MAX_DATA_SPACE);
+    fileDescriptor fd = tfs_openFile(name);
+    assert(fd >= 0);
+    assert(tfs_writeFile(fd, content, blocks * MAX_DATA_SPACE) == 0);
+    free(content);
+    return fd;
+}
+
+void testTfs_extents()
+{
+    char diskName[25] = "testFiles/extentTest.dsk";
+    int numBlocks = DEFAULT_DISK_SIZE / BLOCKSIZE;
+    fragStats frag;
+    char fileByte;
+    remove(diskName);
+    tfs_unmount();
+    assert(tfs_setAllocPolicy(7) == ERR_INVALID_INPUT);
+    assert(tfs_getFragStats(&frag) == ERR_NO_DISK_MOUNTED);
+
+    // Punch two holes into the disk: a (inode 2, data 3-4), b (5, 6), c (7, 8-9), d (10, 11)
+    assert(tfs_mkfsFormat(diskName, DEFAULT_DISK_SIZE, TFS_FEAT_BITMAP) == 0);
+    assert(tfs_mount(diskName) == 0);
+    write_blocks("/a", 2, 'a');
+    fileDescriptor b = write_blocks("/b", 1, 'b');
+    write_blocks("/c", 2, 'c');
+    fileDescriptor d = write_blocks("/d", 1, 'd');
+    assert(tfs_deleteFile(b) == 0);
+    assert(tfs_deleteFile(d) == 0);
+    assert(tfs_getFragStats(&frag) == 0);
+    assert(frag.files == 2 && frag.dataBlocks == 4 && frag.extents == 2);
+    assert(frag.freeBlocks == numBlocks - 8 && frag.freeRuns == 2);
+    assert(frag.largestFreeRun == numBlocks - 10);
+
+    // Taking the next free blocks splits a new file around the hole (inode 5, data 6, 10, 11)
+    assert(tfs_setAllocPolicy(TFS_ALLOC_FIRST_FREE) == 0);
+    fileDescriptor e = write_blocks("/e", 3, 'e');
+    assert(tfs_getFragStats(&frag) == 0);
+    assert(frag.files == 3 && frag.extents == 4);
+
+    // Extent allocation keeps the rewritten file in one run
+    assert(tfs_setAllocPolicy(TFS_ALLOC_EXTENT) == 0);
+    char content[3 * MAX_DATA_SPACE];
+    memset(content, 'E', sizeof(content));
+    assert(tfs_writeFile(e, content, sizeof(content)) == 0);
+    assert(tfs_getFragStats(&frag) == 0);
+    assert(frag.files == 3 && frag.dataBlocks == 7 && frag.extents == 3);
+    assert(tfs_seek(e, 2 * MAX_DATA_SPACE) == 0);
+    assert(tfs_readByte(e, &fileByte) == 0 && fileByte == 'E');
+
+    // Fill the disk up to its last three blocks
+    fileDescriptor f = write_blocks("/f", numBlocks - 16, 'f');
+    assert(tfs_getFragStats(&frag) == 0);
+    assert(frag.freeBlocks == 3);
+    fileDescriptor g = tfs_openFile("/g");
+    assert(tfs_writeFile(g, content, 2 * MAX_DATA_SPACE) == 0);
+    assert(tfs_getFragStats(&frag) == 0);
+    assert(frag.freeBlocks == 0);
+
+    // A write that cannot fit fails up front and leaves the old content alone
+    assert(tfs_writeFile(f, content, 1) == 0);
+    assert(tfs_freeBlocks() == numBlocks - 17);
+    char *big = malloc(numBlocks * MAX_DATA_SPACE);
+    memset(big, 'z', numBlocks * MAX_DATA_SPACE);
+    assert(tfs_writeFile(g, big, numBlocks * MAX_DATA_SPACE) == ERR_DISK_OUT_OF_SPACE);
+    assert(tfs_freeBlocks() == numBlocks - 17);
+    assert(tfs_seek(g, MAX_DATA_SPACE) == 0);
+    assert(tfs_readByte(g, &fileByte) == 0 && fileByte == 'E');
+    free(big);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_unmount() == 0);
+
+    // Free-list disks report the same numbers
+    assert(tfs_mkfs(diskName, DEFAULT_DISK_SIZE) == 0);
+    assert(tfs_mount(diskName) == 0);
+    write_blocks("/a", 2, 'a');
+    assert(tfs_getFragStats(&frag) == 0);
+    assert(frag.files == 1 && frag.extents == 1);
+    assert(frag.freeBlocks == numBlocks - 4 && frag.freeRuns == 1);
+    assert(tfs_unmount() == 0);
+
+    assert(tfs_setAllocPolicy(TFS_ALLOC_FIRST_FREE) == 0);
+    remove(diskName);
+}
+
+void testTfs_freeBatch()
+{
+    char diskName[25] = "testFiles/freeTest.dsk";
+    int numBlocks = DEFAULT_DISK_SIZE / BLOCKSIZE;
+    diskStats dStats;
+    remove(diskName);
+    tfs_unmount();
+
+    // A file of eight data blocks: inode 1, data 2-9
+    assert(tfs_setCacheSize(4) == 0);
+    assert(tfs_mkfs(diskName, DEFAULT_DISK_SIZE) == 0);
+    assert(tfs_mount(diskName) == 0);
+    fileDescriptor fd = write_blocks("/file", 8, 'f');
+    assert(tfs_freeBlocks() == numBlocks - 10);
+
+    // Deleting it frees the nine blocks as one batch and updates the superblock once
+    assert(tfs_sync() == 0);
+    assert(resetDiskStats(mounted->diskNum) == 0);
+    assert(tfs_deleteFile(fd) == 0);
+    assert(tfs_sync() == 0);
+    assert(getDiskStats(mounted->diskNum, &dStats) == 0);
+    assert(dStats.blocksWritten == 10 && dStats.writeCalls <= 2);
+    assert(tfs_freeBlocks() == numBlocks - 1);
+    assert(tfs_unmount() == 0);
+
+    // The freed blocks are chained in order, the inode last, in front of the old list
+    char *superblock = verify_contents(diskName, 0, BLOCKSIZE);
+    assert(superblock[FREE_PTR_LOC] == 2);
+    free(superblock);
+    for (int block = 2; block <= 9; block++) {
+        char *raw = verify_contents(diskName, BLOCKSIZE * block, BLOCKSIZE);
+        assert(raw[BLOCK_TYPE_LOC] == FREE);
+        assert(raw[FREE_PTR_LOC] == (block == 9 ? 1 : block + 1));
+        free(raw);
+    }
+    char *raw = verify_contents(diskName, BLOCKSIZE * 1, BLOCKSIZE);
+    assert(raw[BLOCK_TYPE_LOC] == FREE && raw[FREE_PTR_LOC] == 10);
+    free(raw);
+
+    // Rewriting a file gives its old blocks back the same way
+    assert(tfs_mount(diskName) == 0);
+    fd = write_blocks("/file", 4, 'f');
+    char content[2 * MAX_DATA_SPACE];
+    memset(content, 'g', sizeof(content));
+    assert(tfs_writeFile(fd, content, sizeof(content)) == 0);
+    assert(tfs_freeBlocks() == numBlocks - 4);
+
+    // The free blocks are counted once at mount, a write never walks the list
+    cacheStats stats;
+    assert(resetCacheStats(mounted->cache) == 0);
+    assert(tfs_freeBlocks() == numBlocks - 4);
+    assert(tfs_writeFile(fd, content, sizeof(content)) == 0);
+    assert(tfs_getCacheStats(&stats) == 0);
+    assert(stats.hits + stats.misses < 16);
+    assert(tfs_freeBlocks() == numBlocks - 4);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_freeBlocks() == numBlocks - 4);
+    assert(tfs_unmount() == 0);
+
+    assert(tfs_setCacheSize(DEFAULT_CACHE_BLOCKS) == 0);
+    remove(diskName);
+}
+
+void testTfs_addr32()
+{
+    char diskName[25] = "testFiles/addr32Test.dsk";
+    off_t diskSize = (off_t) 5 << 30;
+    int numBlocks = diskSize / BLOCKSIZE;
+    int high = 1 << 24;
+    char content[3 * MAX_DATA_SPACE];
+    char fileByte;
+    struct stat diskStat;
+    remove(diskName);
+    tfs_unmount();
+
+    // 32 bit pointers need the bitmap, and the original format stops at MAX_BLOCKS
+    assert(tfs_mkfsFormat(diskName, DEFAULT_DISK_SIZE, TFS_FEAT_ADDR32) == ERR_INVALID_INPUT);
+    assert(tfs_mkfsFormat(diskName, (off_t) (MAX_BLOCKS + 1) * BLOCKSIZE, TFS_FEAT_BITMAP) == ERR_INVALID_INPUT);
+
+    // A 5 GiB disk only writes its superblock and bitmap
+    assert(tfs_mkfsFormat(diskName, diskSize, TFS_FEAT_BITMAP | TFS_FEAT_ADDR32) == 0);
+    assert(stat(diskName, &diskStat) == 0);
+    assert(diskStat.st_size == diskSize);
+    assert((off_t) diskStat.st_blocks * 512 < (off_t) 2 * NUM_BITMAP_BLOCKS(numBlocks) * BLOCKSIZE + (1 << 20));
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_freeBlocks() == numBlocks - 1 - NUM_BITMAP_BLOCKS(numBlocks));
+
+    // Hold every block below 2^24 so new blocks need all four pointer bytes
+    for (int i = 0; i < high; i++) {
+        freeMapSetFree(mounted->freeSpace, i, false);
+    }
+    for (int i = 0; i < sizeof(content); i++) {
+        content[i] = 'a' + (i % 26);
+    }
+    assert(tfs_createDir("/dir") == 0);
+    fileDescriptor fd = tfs_openFile("/dir/file");
+    assert(fd >= 0 && fd_table[fd].inodeNum > high);
+    assert(tfs_writeFile(fd, content, sizeof(content)) == 0);
+    fileDescriptor root = tfs_openFile("/root");
+    assert(tfs_writeFile(root, "root file", 10) == 0);
+    for (int i = 0; i < high; i++) {
+        freeMapSetFree(mounted->freeSpace, i, i > NUM_BITMAP_BLOCKS(numBlocks));
+    }
+    assert(tfs_unmount() == 0);
+
+    // Everything is found again after a remount
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/dir/file");
+    assert(fd_table[fd].inodeNum > high);
+    assert(tfs_seek(fd, sizeof(content) - 1) == 0);
+    assert(tfs_readByte(fd, &fileByte) == 0 && fileByte == content[sizeof(content) - 1]);
+    fragStats frag;
+    assert(tfs_getFragStats(&frag) == 0);
+    assert(frag.files == 2 && frag.dataBlocks == 4);
+    assert(tfs_deleteFile(fd) == 0);
+    assert(tfs_removeAll("/") == 0);
+    assert(tfs_freeBlocks() == numBlocks - 1 - NUM_BITMAP_BLOCKS(numBlocks));
+    assert(tfs_unmount() == 0);
+
+    // The superblock's pointer width has to match its flags
+    int disk = openDisk(diskName, 0);
+    uint8_t superblock[BLOCKSIZE];
+    assert(readBlock(disk, SUPERBLOCK_DISKLOC, superblock) == 0);
+    superblock[EMPTY_BYTE_LOC] = TFS_FEAT_ADDR32;
+    assert(writeBlock(disk, SUPERBLOCK_DISKLOC, superblock) == 0);
+    assert(closeDisk(disk) == 0);
+    assert(tfs_mount(diskName) == ERR_BAD_DISK);
+    remove(diskName);
+
+    // Original format disks still use every one of their 256 blocks
+    char *big = malloc(200 * MAX_DATA_SPACE);
+    memset(big, 'x', 200 * MAX_DATA_SPACE);
+    big[200 * MAX_DATA_SPACE - 1] = 'y';
+    assert(tfs_mkfs(diskName, MAX_BLOCKS * BLOCKSIZE) == 0);
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/big");
+    assert(tfs_writeFile(fd, big, 200 * MAX_DATA_SPACE) == 0);
+    assert(tfs_seek(fd, 200 * MAX_DATA_SPACE - 1) == 0);
+    assert(tfs_readByte(fd, &fileByte) == 0 && fileByte == 'y');
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/big");
+    assert(tfs_deleteFile(fd) == 0);
+    assert(tfs_freeBlocks() == MAX_BLOCKS - 1);
+    assert(tfs_unmount() == 0);
+    free(big);
+    remove(diskName);
+}
+
+void testTfs_indirect()
+{
+    char diskName[25] = "testFiles/indirTest.dsk";
+    int features = TFS_FEAT_BITMAP | TFS_FEAT_ADDR32 | TFS_FEAT_INDIRECT;
+    int numBlocks = 32768;
+    int direct = MAX_FILE_DATA / 4 - INDIRECT_LEVELS;
+    int fanout = MAX_INDIRECT_PTRS / 4;
+    cacheStats before, after;
+    char fileByte;
+    remove(diskName);
+    tfs_unmount();
+
+    // Without indirect blocks a file stops at its direct pointers
+    assert(tfs_mkfsFormat(diskName, (off_t) numBlocks * BLOCKSIZE, TFS_FEAT_BITMAP | TFS_FEAT_ADDR32) == 0);
+    assert(tfs_mount(diskName) == 0);
+    char *small = malloc((MAX_FILE_DATA / 4 + 1) * MAX_DATA_SPACE);
+    fileDescriptor fd = tfs_openFile("/file");
+    assert(tfs_writeFile(fd, small, (MAX_FILE_DATA / 4 + 1) * MAX_DATA_SPACE) == ERR_DISK_OUT_OF_SPACE);
+    free(small);
+    assert(tfs_unmount() == 0);
+
+    // A file reaching into the triple indirect tree: the single tree, a full double
+    // tree (1 + fanout blocks) and 1 block on each level of the triple tree
+    int dataBlocks = direct + fanout + fanout * fanout + 10;
+    int metaBlocks = 1 + (1 + fanout) + 3;
+    int size = dataBlocks * MAX_DATA_SPACE;
+    char *content = malloc(size);
+    for (int i = 0; i < size; i++) {
+        content[i] = (i / MAX_DATA_SPACE) % 251;
+    }
+    assert(tfs_mkfsFormat(diskName, (off_t) numBlocks * BLOCKSIZE, features) == 0);
+    assert(tfs_mount(diskName) == 0);
+    int freeBefore = tfs_freeBlocks();
+    fd = write_blocks("/file", 1, 'f');
+    assert(tfs_writeFile(fd, content, size) == 0);
+    assert(tfs_freeBlocks() == freeBefore - 1 - dataBlocks - metaBlocks);
+
+    // Bytes at the edges of each tree come back
+    int edges[] = {0, direct, direct + fanout, direct + fanout + fanout * fanout, dataBlocks - 1};
+    for (int i = 0; i < 5; i++) {
+        assert(tfs_seek(fd, edges[i] * MAX_DATA_SPACE) == 0);
+        assert(tfs_readByte(fd, &fileByte) == 0 && fileByte == content[edges[i] * MAX_DATA_SPACE]);
+    }
+
+    // Once cached, a lookup deep in the triple tree costs a fixed number of block reads, all hits
+    assert(tfs_seek(fd, size - 1) == 0);
+    assert(tfs_readByte(fd, &fileByte) == 0);
+    assert(tfs_seek(fd, size - 1) == 0);
+    assert(tfs_getCacheStats(&before) == 0);
+    assert(tfs_readByte(fd, &fileByte) == 0 && fileByte == content[size - 1]);
+    assert(tfs_getCacheStats(&after) == 0);
+    assert(after.misses == before.misses);
+    assert(after.hits - before.hits <= 2 + INDIRECT_LEVELS + 2);
+
+    fragStats frag;
+    assert(tfs_getFragStats(&frag) == 0);
+    assert(frag.files == 1 && frag.dataBlocks == dataBlocks);
+    assert(tfs_unmount() == 0);
+
+    // The mount check follows the trees
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/file");
+    assert(tfs_seek(fd, size - 1) == 0);
+    assert(tfs_readByte(fd, &fileByte) == 0 && fileByte == content[size - 1]);
+
+    // Shrinking gives the indirect blocks back, deleting gives everything back
+    assert(tfs_writeFile(fd, content, (direct + 1) * MAX_DATA_SPACE) == 0);
+    assert(tfs_freeBlocks() == freeBefore - 1 - (direct + 1) - 1);
+    assert(tfs_seek(fd, direct * MAX_DATA_SPACE) == 0);
+    assert(tfs_readByte(fd, &fileByte) == 0 && fileByte == content[direct * MAX_DATA_SPACE]);
+    assert(tfs_deleteFile(fd) == 0);
+    assert(tfs_freeBlocks() == freeBefore);
+
+    // An indirect block claiming the wrong level is caught
+    fd = tfs_openFile("/file");
+    assert(tfs_writeFile(fd, content, (direct + fanout + 1) * MAX_DATA_SPACE) == 0);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_unmount() == 0);
+    int disk = openDisk(diskName, 0);
+    uint8_t block[BLOCKSIZE];
+    int bNum = 0;
+    for (int i = 1; i < numBlocks && !bNum; i++) {
+        assert(readBlock(disk, i, block) == 0);
+        if (block[BLOCK_TYPE_LOC] == INDIRECT && block[INDIRECT_LEVEL_LOC] == 2) {
+            bNum = i;
+        }
+    }
+    assert(bNum != 0);
+    block[INDIRECT_LEVEL_LOC] = 1;
+    assert(writeBlock(disk, bNum, block) == 0);
+    assert(closeDisk(disk) == 0);
+    assert(tfs_mount(diskName) == ERR_BAD_DISK);
+    remove(diskName);
+
+    // Original format disks can use indirect blocks too
+    assert(tfs_mkfsFormat(diskName, MAX_BLOCKS * BLOCKSIZE, TFS_FEAT_INDIRECT) == 0);
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/file");
+    assert(tfs_writeFile(fd, content, 230 * MAX_DATA_SPACE) == 0);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/file");
+    assert(tfs_seek(fd, 229 * MAX_DATA_SPACE) == 0);
+    assert(tfs_readByte(fd, &fileByte) == 0 && fileByte == content[229 * MAX_DATA_SPACE]);
+    assert(tfs_deleteFile(fd) == 0);
+    assert(tfs_freeBlocks() == MAX_BLOCKS - 1);
+    assert(tfs_unmount() == 0);
+    free(content);
+    remove(diskName);
+}
+
+/* extent_field(): one big endian 4 byte field of the slot'th extent of a table */
+static uint32_t extent_field(uint8_t* table, int slot, int field)
+{
+    uint8_t* f = table + (slot * 3 + field) * 4;
+    return ((uint32_t) f[0] << 24) | (f[1] << 16) | (f[2] << 8) | f[3];
+}
+
+void testTfs_extentMap()
+{
+    char diskName[25] = "testFiles/extentTest.dsk";
+    int features = TFS_FEAT_BITMAP | TFS_FEAT_ADDR32 | TFS_FEAT_EXTENTS;
+    int numBlocks = 4096;
+    int perBlock = MAX_EXTENT_BYTES / EXTENT_SIZE(features);
+    cacheStats before, after;
+    uint8_t inode[BLOCKSIZE];
+    char fileByte;
+    remove(diskName);
+    tfs_unmount();
+
+    // A file is mapped by indirect blocks or by extents, not both
+    assert(tfs_mkfsFormat(diskName, (off_t) numBlocks * BLOCKSIZE, TFS_FEAT_BITMAP | TFS_FEAT_INDIRECT | TFS_FEAT_EXTENTS) == ERR_INVALID_INPUT);
+
+    // A large file written into free space is one extent in its inode
+    int dataBlocks = 2000;
+    int size = dataBlocks * MAX_DATA_SPACE;
+    char *content = malloc(size);
+    for (int i = 0; i < size; i++) {
+        content[i] = (i / MAX_DATA_SPACE) % 251;
+    }
+    assert(tfs_mkfsFormat(diskName, (off_t) numBlocks * BLOCKSIZE, features) == 0);
+    assert(tfs_mount(diskName) == 0);
+    int freeBefore = tfs_freeBlocks();
+    fileDescriptor fd = tfs_openFile("/file");
+    assert(tfs_writeFile(fd, content, size) == 0);
+    assert(tfs_freeBlocks() == freeBefore - 1 - dataBlocks);
+    assert(cacheReadBlock(mounted->cache, fd_table[fd].inodeNum, inode) == 0);
+    assert(inode[FILE_MAP_LOC] == 0);
+    uint8_t* table = inode + FILE_DATA_LOC;
+    assert(extent_field(table, 0, EXTENT_LOGICAL) == 0 && extent_field(table, 0, EXTENT_LENGTH) == dataBlocks);
+    assert(extent_field(table, 1, EXTENT_LENGTH) == 0);
+    int edges[] = {0, 1, dataBlocks / 2, dataBlocks - 1};
+    for (int i = 0; i < 4; i++) {
+        assert(tfs_seek(fd, edges[i] * MAX_DATA_SPACE) == 0);
+        assert(tfs_readByte(fd, &fileByte) == 0 && fileByte == content[edges[i] * MAX_DATA_SPACE]);
+    }
+
+    // Looking a block up reads no more than the inode and the data block (with no map blocks in between)
+    assert(tfs_seek(fd, size - 1) == 0);
+    assert(tfs_getCacheStats(&before) == 0);
+    assert(tfs_readByte(fd, &fileByte) == 0 && fileByte == content[size - 1]);
+    assert(tfs_getCacheStats(&after) == 0);
+    assert(after.misses == before.misses);
+    assert(after.hits - before.hits <= 2 + 2);
+    assert(tfs_unmount() == 0);
+
+    // Split the free space into single blocks by holding every other one
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/file");
+    assert(tfs_writeFile(fd, content, MAX_DATA_SPACE) == 0);
+    int *held = malloc(numBlocks * sizeof(int));
+    int numHeld = 0;
+    for (int i = 1; i < numBlocks; i += 2) {
+        if (freeMapIsFree(mounted->freeSpace, i)) {
+            freeMapSetFree(mounted->freeSpace, i, false);
+            held[numHeld++] = i;
+        }
+    }
+    int freeSplit = tfs_freeBlocks();
+
+    // 300 runs spill into 15 EXTENT blocks
+    dataBlocks = 300;
+    int extentBlocks = (dataBlocks + perBlock - 1) / perBlock;
+    fileDescriptor g = tfs_openFile("/split");
+    assert(tfs_writeFile(g, content, dataBlocks * MAX_DATA_SPACE) == 0);
+    assert(tfs_freeBlocks() == freeSplit - 1 - dataBlocks - extentBlocks);
+    assert(cacheReadBlock(mounted->cache, fd_table[g].inodeNum, inode) == 0);
+    assert(inode[FILE_MAP_LOC] == FILE_MAP_EXTENT_TREE);
+    assert(extent_field(table, extentBlocks - 1, EXTENT_LENGTH) != 0 && extent_field(table, extentBlocks, EXTENT_LENGTH) == 0);
+    for (int i = 0; i < dataBlocks; i += 37) {
+        assert(tfs_seek(g, i * MAX_DATA_SPACE) == 0);
+        assert(tfs_readByte(g, &fileByte) == 0 && fileByte == content[i * MAX_DATA_SPACE]);
+    }
+
+    // 600 runs are more than the inode can reach: the write fails and changes nothing
+    int freeSpilled = tfs_freeBlocks();
+    assert(tfs_writeFile(g, content, 600 * MAX_DATA_SPACE) == ERR_DISK_OUT_OF_SPACE);
+    assert(tfs_freeBlocks() == freeSpilled);
+    assert(tfs_seek(g, (dataBlocks - 1) * MAX_DATA_SPACE) == 0);
+    assert(tfs_readByte(g, &fileByte) == 0 && fileByte == content[(dataBlocks - 1) * MAX_DATA_SPACE]);
+
+    for (int i = 0; i < numHeld; i++) {
+        freeMapSetFree(mounted->freeSpace, held[i], true);
+    }
+    free(held);
+    assert(tfs_unmount() == 0);
+
+    // The mount check follows the EXTENT blocks, and the runs show up as extents
+    assert(tfs_mount(diskName) == 0);
+    fragStats frag;
+    assert(tfs_getFragStats(&frag) == 0);
+    assert(frag.files == 2 && frag.dataBlocks == 1 + dataBlocks && frag.extents == 1 + dataBlocks);
+    g = tfs_openFile("/split");
+    assert(tfs_seek(g, (dataBlocks - 1) * MAX_DATA_SPACE) == 0);
+    assert(tfs_readByte(g, &fileByte) == 0 && fileByte == content[(dataBlocks - 1) * MAX_DATA_SPACE]);
+    assert(tfs_deleteFile(g) == 0);
+    fd = tfs_openFile("/file");
+    assert(tfs_deleteFile(fd) == 0);
+    assert(tfs_freeBlocks() == freeBefore);
+    assert(tfs_unmount() == 0);
+    remove(diskName);
+
+    // Original format disks map a whole disk of data with one extent
+    assert(tfs_mkfsFormat(diskName, MAX_BLOCKS * BLOCKSIZE, TFS_FEAT_EXTENTS) == 0);
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/file");
+    assert(tfs_writeFile(fd, content, 250 * MAX_DATA_SPACE) == 0);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/file");
+    assert(tfs_seek(fd, 249 * MAX_DATA_SPACE) == 0);
+    assert(tfs_readByte(fd, &fileByte) == 0 && fileByte == content[249 * MAX_DATA_SPACE]);
+    assert(tfs_deleteFile(fd) == 0);
+    assert(tfs_freeBlocks() == MAX_BLOCKS - 1);
+
+    // They overwrite blocks as they free them, so a rewrite has to fit with every
+    // block a run of its own: fill the disk with one block files, then free every other one
+    char name[20];
+    int numFiles = (MAX_BLOCKS - 1) / 2;
+    for (int i = 0; i < numFiles; i++) {
+        snprintf(name, sizeof(name), "/f%d", i);
+        fd = write_blocks(name, 1, 'a' + i % 26);
+        assert(tfs_closeFile(fd) == 0);
+    }
+    for (int i = 1; i < numFiles; i += 2) {
+        snprintf(name, sizeof(name), "/f%d", i);
+        fd = tfs_openFile(name);
+        assert(tfs_deleteFile(fd) == 0);
+    }
+    int freeList = tfs_freeBlocks();
+    fd = tfs_openFile("/f0");
+    assert(tfs_writeFile(fd, content, (freeList + 1) * MAX_DATA_SPACE) == ERR_DISK_OUT_OF_SPACE);
+    assert(tfs_freeBlocks() == freeList);
+    assert(tfs_readByte(fd, &fileByte) == 0 && fileByte == 'a');
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+
+    // Leaving room for the most EXTENT blocks, the rewrite goes through
+    int worst = _map_blocks(TFS_FEAT_EXTENTS, freeList + 1 - 2);
+    assert(worst == 2);
+    fd = tfs_openFile("/f0");
+    assert(tfs_writeFile(fd, content, (freeList + 1 - worst) * MAX_DATA_SPACE) == 0);
+    assert(tfs_seek(fd, (freeList - worst) * MAX_DATA_SPACE) == 0);
+    assert(tfs_readByte(fd, &fileByte) == 0 && fileByte == content[(freeList - worst) * MAX_DATA_SPACE]);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_unmount() == 0);
+    free(content);
+    remove(diskName);
+}
+
+void testTfs_inline()
+{
+    char diskName[25] = "testFiles/inlineTest.dsk";
+    int numBlocks = DEFAULT_DISK_SIZE / BLOCKSIZE;
+    char content[4 * MAX_DATA_SPACE];
+    char fileByte;
+    diskStats dStats;
+    remove(diskName);
+    tfs_unmount();
+    for (int i = 0; i < sizeof(content); i++) {
+        content[i] = 'a' + (i % 26);
+    }
+
+    // A small file takes nothing but its inode, its bytes sit in the pointer table
+    assert(tfs_mkfsFormat(diskName, DEFAULT_DISK_SIZE, TFS_FEAT_INLINE) == 0);
+    assert(tfs_mount(diskName) == 0);
+    fileDescriptor fd = tfs_openFile("/small");
+    assert(tfs_writeFile(fd, content, 150) == 0);
+    assert(tfs_freeBlocks() == numBlocks - 2);
+    int inodeNum = fd_table[fd].inodeNum;
+    assert(tfs_unmount() == 0);
+    char *raw = verify_contents(diskName, BLOCKSIZE * inodeNum, BLOCKSIZE);
+    assert(raw[FILE_MAP_LOC] == FILE_MAP_INLINE);
+    assert(memcmp(raw + FILE_DATA_LOC, content, 150) == 0);
+    free(raw);
+
+    // Reading it all back only reads the inode
+    assert(tfs_setCacheSize(2) == 0);
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/small");
+    assert(tfs_sync() == 0);
+    assert(resetDiskStats(mounted->diskNum) == 0);
+    for (int i = 0; i < 150; i++) {
+        assert(tfs_readByte(fd, &fileByte) == 0 && fileByte == content[i]);
+    }
+    assert(tfs_readByte(fd, &fileByte) == ERR_FILE_PNTR_OUT_OF_BOUNDS);
+    assert(getDiskStats(mounted->diskNum, &dStats) == 0);
+    assert(dStats.blocksRead <= 1);
+    assert(tfs_setCacheSize(DEFAULT_CACHE_BLOCKS) == 0);
+
+    // Growing moves the file out to data blocks, shrinking brings it back
+    assert(tfs_writeFile(fd, content, sizeof(content)) == 0);
+    assert(tfs_freeBlocks() == numBlocks - 2 - 4);
+    assert(tfs_seek(fd, sizeof(content) - 1) == 0);
+    assert(tfs_readByte(fd, &fileByte) == 0 && fileByte == content[sizeof(content) - 1]);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/small");
+    assert(tfs_writeFile(fd, content, MAX_INLINE_DATA) == 0);
+    assert(tfs_freeBlocks() == numBlocks - 2);
+    assert(tfs_seek(fd, MAX_INLINE_DATA - 1) == 0);
+    assert(tfs_readByte(fd, &fileByte) == 0 && fileByte == content[MAX_INLINE_DATA - 1]);
+    assert(tfs_unmount() == 0);
+
+    // The mount check takes inline files, but not ones too big for the inode
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_unmount() == 0);
+    int disk = openDisk(diskName, 0);
+    uint8_t block[BLOCKSIZE];
+    assert(readBlock(disk, inodeNum, block) == 0);
+    block[FILE_SIZE_LOC + 3] = MAX_INLINE_DATA + 1;
+    assert(writeBlock(disk, inodeNum, block) == 0);
+    assert(closeDisk(disk) == 0);
+    assert(tfs_mount(diskName) == ERR_BAD_DISK);
+    remove(diskName);
+
+    // Without the flag files keep their data blocks, and an inline inode is corrupt
+    assert(tfs_mkfs(diskName, DEFAULT_DISK_SIZE) == 0);
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/small");
+    assert(tfs_writeFile(fd, content, 150) == 0);
+    assert(tfs_freeBlocks() == numBlocks - 3);
+    inodeNum = fd_table[fd].inodeNum;
+    assert(tfs_unmount() == 0);
+    disk = openDisk(diskName, 0);
+    assert(readBlock(disk, inodeNum, block) == 0);
+    block[FILE_MAP_LOC] = FILE_MAP_INLINE;
+    assert(writeBlock(disk, inodeNum, block) == 0);
+    assert(closeDisk(disk) == 0);
+    assert(tfs_mount(diskName) == ERR_BAD_DISK);
+    remove(diskName);
+
+    // Deleting an inline file gives back its inode, on any format
+    assert(tfs_mkfsFormat(diskName, DEFAULT_DISK_SIZE, TFS_FEAT_BITMAP | TFS_FEAT_ADDR32 | TFS_FEAT_EXTENTS | TFS_FEAT_INLINE) == 0);
+    assert(tfs_mount(diskName) == 0);
+    int freeBefore = tfs_freeBlocks();
+    fd = tfs_openFile("/small");
+    assert(tfs_writeFile(fd, content, 10) == 0);
+    assert(tfs_freeBlocks() == freeBefore - 1);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/small");
+    assert(tfs_readByte(fd, &fileByte) == 0 && fileByte == content[0]);
+    assert(tfs_deleteFile(fd) == 0);
+    assert(tfs_freeBlocks() == freeBefore);
+    assert(tfs_unmount() == 0);
+    remove(diskName);
+}
+
+void testTfs_openFiles()
+{
+    char diskName[25] = "testFiles/openTest.dsk";
+    char content[3 * MAX_DATA_SPACE];
+    char fileByte;
+    cacheStats before, after;
+    remove(diskName);
+    tfs_unmount();
+    for (int i = 0; i < sizeof(content); i++) {
+        content[i] = 'a' + (i % 26);
+    }
+
+    assert(tfs_mkfs(diskName, DEFAULT_DISK_SIZE) == 0);
+    assert(tfs_mount(diskName) == 0);
+    fileDescriptor fd = tfs_openFile("/file");
+    assert(tfs_writeFile(fd, content, sizeof(content)) == 0);
+
+    // Reading byte by byte only looks up the data blocks, the inode stays in memory
+    assert(tfs_getCacheStats(&before) == 0);
+    for (int i = 0; i < 100; i++) {
+        assert(tfs_readByte(fd, &fileByte) == 0 && fileByte == content[i]);
+    }
+    assert(tfs_getCacheStats(&after) == 0);
+    assert((after.hits + after.misses) - (before.hits + before.misses) == 100);
+
+    // Every descriptor has its own offset
+    fileDescriptor other = tfs_openFile("/file");
+    assert(other != fd);
+    assert(tfs_readByte(other, &fileByte) == 0 && fileByte == content[0]);
+    assert(tfs_readByte(fd, &fileByte) == 0 && fileByte == content[100]);
+    assert(tfs_seek(other, sizeof(content) - 1) == 0);
+    assert(tfs_readByte(other, &fileByte) == 0 && fileByte == content[sizeof(content) - 1]);
+    assert(tfs_readByte(other, &fileByte) == ERR_FILE_PNTR_OUT_OF_BOUNDS);
+
+    // A write or rename through one descriptor is seen through the others
+    assert(tfs_writeFile(fd, "short", 6) == 0);
+    assert(tfs_seek(other, 6) == 0);
+    assert(tfs_seek(other, 7) == ERR_FILE_PNTR_OUT_OF_BOUNDS);
+    assert(tfs_rename(other, "renamed") == 0);
+    assert(tfs_closeFile(other) == 0);
+    assert(tfs_closeFile(fd) == 0);
+    assert(tfs_readByte(fd, &fileByte) == ERR_INVALID_FD);
+    assert(tfs_unmount() == 0);
+
+    // Closing and unmounting wrote the inode back
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/renamed");
+    assert(tfs_readByte(fd, &fileByte) == 0 && fileByte == 's');
+
+    // Descriptors outside the table are refused, deleting closes every descriptor of the file
+    assert(tfs_readByte(-1, &fileByte) == ERR_INVALID_FD);
+    assert(tfs_seek(FD_TABLESIZE, 0) == ERR_INVALID_FD);
+    other = tfs_openFile("/renamed");
+    assert(tfs_deleteFile(fd) == 0);
+    assert(tfs_readByte(other, &fileByte) == ERR_INVALID_FD);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_unmount() == 0);
+    remove(diskName);
+}
+
+/* seconds since some fixed point, for timing */
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void testTfs_read()
+{
+    char diskName[25] = "testFiles/readTest.dsk";
+    int size = 50 * 1024;
+    int dataBlocks = (size - 1) / MAX_DATA_SPACE + 1;
+    char *content = malloc(size);
+    char *out = malloc(size + 1);
+    diskStats dStats;
+    remove(diskName);
+    tfs_unmount();
+    for (int i = 0; i < size; i++) {
+        content[i] = (i * 7 + i / MAX_DATA_SPACE) % 251;
+    }
+
+    assert(tfs_mkfsFormat(diskName, 1024 * BLOCKSIZE, TFS_FEAT_BITMAP | TFS_FEAT_ADDR32 | TFS_FEAT_EXTENTS) == 0);
+    assert(tfs_mount(diskName) == 0);
+    fileDescriptor fd = tfs_openFile("/file");
+    assert(tfs_writeFile(fd, content, size) == 0);
+
+    // Reads stop at the end of the file and move the pointer
+    assert(tfs_read(fd, out, 100) == 100 && memcmp(out, content, 100) == 0);
+    assert(tfs_read(fd, out, size) == size - 100 && memcmp(out, content + 100, size - 100) == 0);
+    assert(tfs_read(fd, out, 10) == 0);
+    assert(tfs_readByte(fd, out) == ERR_FILE_PNTR_OUT_OF_BOUNDS);
+
+    // Positional reads leave it alone, reads across block edges come back whole
+    assert(tfs_seek(fd, 5) == 0);
+    assert(tfs_pread(fd, out, 2 * MAX_DATA_SPACE, MAX_DATA_SPACE - 3) == 2 * MAX_DATA_SPACE);
+    assert(memcmp(out, content + MAX_DATA_SPACE - 3, 2 * MAX_DATA_SPACE) == 0);
+    assert(tfs_pread(fd, out, 10, size - 4) == 4 && memcmp(out, content + size - 4, 4) == 0);
+    assert(tfs_pread(fd, out, 10, size + 1) == ERR_FILE_PNTR_OUT_OF_BOUNDS);
+    assert(tfs_pread(fd, out, 10, -1) == ERR_INVALID_INPUT);
+    assert(tfs_read(fd, out, 1) == 1 && out[0] == content[5]);
+    assert(tfs_read(-1, out, 1) == ERR_INVALID_FD);
+    assert(tfs_unmount() == 0);
+
+    // Byte by byte against one bulk read, each from a cold cache
+    assert(tfs_setCacheSize(16) == 0);
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/file");
+    assert(tfs_sync() == 0);
+    assert(resetDiskStats(mounted->diskNum) == 0);
+    double start = now();
+    for (int i = 0; i < size; i++) {
+        assert(tfs_readByte(fd, out + i) == 0);
+    }
+    double byteTime = now() - start;
+    assert(getDiskStats(mounted->diskNum, &dStats) == 0);
+    unsigned long byteCalls = dStats.readCalls + dStats.ringCalls;
+    assert(memcmp(out, content, size) == 0);
+    assert(tfs_unmount() == 0);
+
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/file");
+    assert(tfs_sync() == 0);
+    assert(resetDiskStats(mounted->diskNum) == 0);
+    memset(out, 0, size);
+    start = now();
+    assert(tfs_read(fd, out, size) == size);
+    double bulkTime = now() - start;
+    assert(getDiskStats(mounted->diskNum, &dStats) == 0);
+    unsigned long bulkCalls = dStats.readCalls + dStats.ringCalls;
+    assert(memcmp(out, content, size) == 0);
+    assert(tfs_unmount() == 0);
+    assert(tfs_setCacheSize(DEFAULT_CACHE_BLOCKS) == 0);
+
+    // The one extent is read half a cache (8 blocks) per disk read
+    assert(bulkCalls <= (dataBlocks + 7) / 8 && bulkCalls * 4 <= byteCalls);
+    printf("> tfs_read %.1f MB/s, tfs_readByte %.1f MB/s (%lu vs %lu disk reads)\n",
+        size / bulkTime / 1e6, size / byteTime / 1e6, bulkCalls, byteCalls);
+
+    free(content);
+    free(out);
+    remove(diskName);
+}
+
+void testTfs_pwrite()
+{
+    char diskName[25] = "testFiles/pwriteTest.dsk";
+    int numBlocks = DEFAULT_DISK_SIZE / BLOCKSIZE;
+    char content[8 * MAX_DATA_SPACE];
+    char expect[8 * MAX_DATA_SPACE];
+    char line[20];
+    char out[8 * MAX_DATA_SPACE];
+    diskStats dStats;
+    fragStats frag;
+    remove(diskName);
+    tfs_unmount();
+    for (int i = 0; i < sizeof(content); i++) {
+        content[i] = 'a' + (i % 26);
+    }
+    memcpy(expect, content, sizeof(expect));
+
+    // Changing one byte writes its data block and the inode, nothing else
+    assert(tfs_mkfs(diskName, DEFAULT_DISK_SIZE) == 0);
+    assert(tfs_mount(diskName) == 0);
+    fileDescriptor fd = tfs_openFile("/file");
+    assert(tfs_writeFile(fd, content, 3 * MAX_DATA_SPACE) == 0);
+    assert(tfs_sync() == 0);
+    assert(resetDiskStats(mounted->diskNum) == 0);
+    assert(tfs_pwrite(fd, "X", 1, MAX_DATA_SPACE + 10) == 1);
+    assert(tfs_sync() == 0);
+    assert(getDiskStats(mounted->diskNum, &dStats) == 0);
+    assert(dStats.blocksWritten == 2);
+    expect[MAX_DATA_SPACE + 10] = 'X';
+    assert(tfs_freeBlocks() == numBlocks - 5);
+
+    // Writes may overlap the end, but not start past it
+    assert(tfs_pwrite(fd, "tail", 4, 3 * MAX_DATA_SPACE + 1) == ERR_FILE_PNTR_OUT_OF_BOUNDS);
+    assert(tfs_pwrite(fd, "tail", 4, 3 * MAX_DATA_SPACE - 2) == 4);
+    memcpy(expect + 3 * MAX_DATA_SPACE - 2, "tail", 4);
+    assert(tfs_freeBlocks() == numBlocks - 6);
+
+    // Appending log lines only takes blocks as the file grows, the file pointer stays
+    int size = 3 * MAX_DATA_SPACE + 2;
+    assert(tfs_seek(fd, 7) == 0);
+    for (int i = 0; i < 50; i++) {
+        snprintf(line, sizeof(line), "line %d\n", i);
+        int length = strlen(line);
+        if (i == 49) {
+            assert(tfs_sync() == 0);
+            assert(resetDiskStats(mounted->diskNum) == 0);
+        }
+        assert(tfs_append(fd, line, length) == length);
+        memcpy(expect + size, line, length);
+        size += length;
+    }
+    assert(tfs_sync() == 0);
+    assert(getDiskStats(mounted->diskNum, &dStats) == 0);
+    assert(dStats.blocksWritten <= 3);
+    assert(tfs_freeBlocks() == numBlocks - 2 - ((size - 1) / MAX_DATA_SPACE + 1));
+    assert(tfs_read(fd, out, 1) == 1 && out[0] == expect[7]);
+    assert(tfs_unmount() == 0);
+
+    // Everything survives a remount
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/file");
+    assert(tfs_read(fd, out, sizeof(out)) == size && memcmp(out, expect, size) == 0);
+    assert(tfs_unmount() == 0);
+    remove(diskName);
+
+    // Appends on an extent disk carry on the file's run, and past the direct
+    // pointers on an indirect disk the map grows with the file
+    int formats[] = {TFS_FEAT_BITMAP | TFS_FEAT_ADDR32 | TFS_FEAT_EXTENTS, TFS_FEAT_BITMAP | TFS_FEAT_ADDR32 | TFS_FEAT_INDIRECT};
+    int direct = MAX_FILE_DATA / 4 - INDIRECT_LEVELS;
+    for (int f = 0; f < 2; f++) {
+        assert(tfs_mkfsFormat(diskName, 1024 * BLOCKSIZE, formats[f]) == 0);
+        assert(tfs_mount(diskName) == 0);
+        int freeBefore = tfs_freeBlocks();
+        fd = tfs_openFile("/log");
+        for (int i = 0; i < direct + 20; i++) {
+            assert(tfs_append(fd, content, MAX_DATA_SPACE) == MAX_DATA_SPACE);
+        }
+        assert(tfs_getFragStats(&frag) == 0);
+        assert(frag.dataBlocks == direct + 20);
+        assert(f == 1 || frag.extents == 1);
+        assert(tfs_freeBlocks() == freeBefore - 1 - (direct + 20) - f);
+        assert(tfs_unmount() == 0);
+        assert(tfs_mount(diskName) == 0);
+        fd = tfs_openFile("/log");
+        assert(tfs_pread(fd, out, MAX_DATA_SPACE, (direct + 19) * MAX_DATA_SPACE) == MAX_DATA_SPACE);
+        assert(memcmp(out, content, MAX_DATA_SPACE) == 0);
+        assert(tfs_deleteFile(fd) == 0);
+        assert(tfs_freeBlocks() == freeBefore);
+        assert(tfs_unmount() == 0);
+        remove(diskName);
+    }
+
+    // Growth that falls in more runs than the inode can reach fails and changes nothing
+    int features = TFS_FEAT_BITMAP | TFS_FEAT_ADDR32 | TFS_FEAT_EXTENTS;
+    int growth = 400;
+    char *big = malloc(growth * MAX_DATA_SPACE);
+    memset(big, 'g', growth * MAX_DATA_SPACE);
+    assert(tfs_mkfsFormat(diskName, 4096 * BLOCKSIZE, features) == 0);
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/split");
+    assert(tfs_append(fd, content, MAX_DATA_SPACE) == MAX_DATA_SPACE);
+    int *held = malloc(4096 * sizeof(int));
+    int numHeld = 0;
+    for (int i = 1; i < 4096; i += 2) {
+        if (freeMapIsFree(mounted->freeSpace, i)) {
+            freeMapSetFree(mounted->freeSpace, i, false);
+            held[numHeld++] = i;
+        }
+    }
+    int freeSplit = tfs_freeBlocks();
+    assert(tfs_append(fd, big, growth * MAX_DATA_SPACE) == ERR_DISK_OUT_OF_SPACE);
+    assert(tfs_freeBlocks() == freeSplit);
+    assert(tfs_pread(fd, out, 2 * MAX_DATA_SPACE, 0) == MAX_DATA_SPACE && memcmp(out, content, MAX_DATA_SPACE) == 0);
+    for (int i = 0; i < numHeld; i++) {
+        freeMapSetFree(mounted->freeSpace, held[i], true);
+    }
+    free(held);
+    free(big);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_unmount() == 0);
+    remove(diskName);
+
+    // Inline files are written in their inode until they outgrow it
+    assert(tfs_mkfsFormat(diskName, DEFAULT_DISK_SIZE, TFS_FEAT_INLINE) == 0);
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/small");
+    assert(tfs_append(fd, content, 100) == 100);
+    assert(tfs_append(fd, content + 100, 100) == 100);
+    assert(tfs_freeBlocks() == numBlocks - 2);
+    assert(tfs_seek(fd, 3) == 0);
+    assert(tfs_append(fd, content + 200, 100) == 100);
+    assert(tfs_freeBlocks() == numBlocks - 2 - 2);
+    assert(tfs_read(fd, out, 1) == 1 && out[0] == content[3]);
+    assert(tfs_pread(fd, out, sizeof(out), 0) == 300 && memcmp(out, content, 300) == 0);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_unmount() == 0);
+    remove(diskName);
+}
+
+void testTfs_stream()
+{
+    char diskName[25] = "testFiles/streamTest.dsk";
+    int size = 300 * MAX_DATA_SPACE + 77;
+    char* content = (char*) malloc(size);
+    char* out = (char*) malloc(size);
+    diskStats dStats;
+    fragStats frag;
+    remove(diskName);
+    tfs_unmount();
+    for (int i = 0; i < size; i++) {
+        content[i] = 'a' + (i * 7 % 26);
+    }
+
+    // A stream of odd-sized chunks lands as one extent, the old content stays until the commit
+    assert(tfs_mkfsFormat(diskName, 1024 * BLOCKSIZE, TFS_FEAT_BITMAP | TFS_FEAT_ADDR32 | TFS_FEAT_EXTENTS) == 0);
+    assert(tfs_mount(diskName) == 0);
+    int freeBefore = tfs_freeBlocks();
+    fileDescriptor fd = tfs_openFile("/stream");
+    assert(tfs_writeFile(fd, "old", 3) == 0);
+    assert(tfs_writeStream(fd, content, 10) == ERR_NO_STREAM);
+    assert(tfs_commitStream(fd) == ERR_NO_STREAM);
+    assert(tfs_openStream(fd) == 0);
+    assert(tfs_openStream(fd) == ERR_STREAM_OPEN);
+    int written = 0;
+    for (int chunk = 1; written < size; chunk = chunk * 3 % 1000 + 1) {
+        int length = chunk < size - written ? chunk : size - written;
+        assert(tfs_writeStream(fd, content + written, length) == length);
+        written += length;
+    }
+    assert(tfs_pread(fd, out, size, 0) == 3 && memcmp(out, "old", 3) == 0);
+    assert(tfs_sync() == 0);
+    assert(resetDiskStats(mounted->diskNum) == 0);
+    assert(tfs_commitStream(fd) == 0);
+    assert(tfs_sync() == 0);
+    assert(getDiskStats(mounted->diskNum, &dStats) == 0);
+    assert(dStats.blocksWritten <= 3);
+    assert(tfs_pread(fd, out, size, 0) == size && memcmp(out, content, size) == 0);
+    assert(tfs_getFragStats(&frag) == 0);
+    assert(frag.dataBlocks == 301 && frag.extents == 1);
+    assert(tfs_freeBlocks() == freeBefore - 1 - 301);
+
+    // Aborting, closing or unmounting with a stream open gives its blocks back
+    assert(tfs_openStream(fd) == 0);
+    assert(tfs_writeStream(fd, content, 10 * MAX_DATA_SPACE) == 10 * MAX_DATA_SPACE);
+    assert(tfs_freeBlocks() < freeBefore - 1 - 301);
+    assert(tfs_abortStream(fd) == 0);
+    assert(tfs_abortStream(fd) == ERR_NO_STREAM);
+    assert(tfs_freeBlocks() == freeBefore - 1 - 301);
+    assert(tfs_openStream(fd) == 0);
+    assert(tfs_writeStream(fd, content, 10 * MAX_DATA_SPACE) == 10 * MAX_DATA_SPACE);
+    assert(tfs_closeFile(fd) == 0);
+    assert(tfs_freeBlocks() == freeBefore - 1 - 301);
+    fd = tfs_openFile("/stream");
+    assert(tfs_openStream(fd) == 0);
+    assert(tfs_writeStream(fd, content, 10 * MAX_DATA_SPACE) == 10 * MAX_DATA_SPACE);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_freeBlocks() == freeBefore - 1 - 301);
+    fd = tfs_openFile("/stream");
+    assert(tfs_read(fd, out, size) == size && memcmp(out, content, size) == 0);
+
+    // An empty stream leaves an empty file with no blocks
+    assert(tfs_openStream(fd) == 0);
+    assert(tfs_commitStream(fd) == 0);
+    assert(tfs_read(fd, out, 1) == 0);
+    assert(tfs_freeBlocks() == freeBefore - 1);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_unmount() == 0);
+    remove(diskName);
+
+    // On a legacy disk the chain is built from the streamed blocks, on an
+    // inline disk a short stream stays in the inode
+    int formats[] = {0, TFS_FEAT_INLINE};
+    for (int f = 0; f < 2; f++) {
+        assert(tfs_mkfsFormat(diskName, DEFAULT_DISK_SIZE, formats[f]) == 0);
+        assert(tfs_mount(diskName) == 0);
+        freeBefore = tfs_freeBlocks();
+        fd = tfs_openFile("/file");
+        assert(tfs_openStream(fd) == 0);
+        int length = f == 0 ? 5 * MAX_DATA_SPACE + 1 : MAX_INLINE_DATA;
+        assert(tfs_writeStream(fd, content, length / 2) == length / 2);
+        assert(tfs_writeStream(fd, content + length / 2, length - length / 2) == length - length / 2);
+        assert(tfs_commitStream(fd) == 0);
+        assert(tfs_freeBlocks() == freeBefore - 1 - (f == 0 ? 6 : 0));
+        assert(tfs_unmount() == 0);
+        assert(tfs_mount(diskName) == 0);
+        fd = tfs_openFile("/file");
+        assert(tfs_read(fd, out, size) == length && memcmp(out, content, length) == 0);
+        assert(tfs_unmount() == 0);
+        remove(diskName);
+    }
+    free(content);
+    free(out);
+}
+
+void testTfs_atime()
+{
+    char diskName[23] = "testFiles/atimeTest.dsk";
+    char out[100];
+    uint8_t inode[BLOCKSIZE];
+    diskStats dStats;
+    remove(diskName);
+    tfs_unmount();
+    assert(tfs_setAtimePolicy(-1) == ERR_INVALID_INPUT);
+    assert(tfs_setAtimePolicy(TFS_ATIME_LAZY + 1) == ERR_INVALID_INPUT);
+    assert(tfs_mkfs(diskName, DEFAULT_DISK_SIZE) == 0);
+    assert(tfs_mount(diskName) == 0);
+    fileDescriptor fd = tfs_openFile("/file");
+    assert(tfs_writeFile(fd, "read me", 7) == 0);
+    assert(tfs_unmount() == 0);
+
+    // Only the strict policy writes metadata when a file is opened and read
+    int policies[] = {TFS_ATIME_STRICT, TFS_ATIME_RELATIME, TFS_ATIME_NOATIME, TFS_ATIME_LAZY};
+    for (int p = 0; p < 4; p++) {
+        assert(tfs_setAtimePolicy(policies[p]) == 0);
+        assert(tfs_mount(diskName) == 0);
+        if (policies[p] == TFS_ATIME_RELATIME) {
+            // an access time newer than the modified time is left alone
+            fd = tfs_openFile("/file");
+            _write_long(fd_table[fd].inode, _read_long(fd_table[fd].inode, FILE_MODIFIEDTIME_LOC) + 10, FILE_ACCESSTIME_LOC);
+            fd_table[fd].dirty = true;
+            assert(tfs_closeFile(fd) == 0);
+        }
+        assert(tfs_sync() == 0);
+        assert(resetDiskStats(mounted->diskNum) == 0);
+        for (int i = 0; i < 3; i++) {
+            fd = tfs_openFile("/file");
+            assert(tfs_readByte(fd, out) == 0);
+            assert(tfs_read(fd, out, sizeof(out)) == 6);
+            assert(tfs_pread(fd, out, 1, 2) == 1);
+            assert(tfs_closeFile(fd) == 0);
+        }
+        assert(tfs_sync() == 0);
+        assert(getDiskStats(mounted->diskNum, &dStats) == 0);
+        assert((dStats.blocksWritten > 0) == (policies[p] == TFS_ATIME_STRICT));
+        assert(tfs_unmount() == 0);
+    }
+
+    // Relatime still stamps an access time that is a day old
+    assert(tfs_setAtimePolicy(TFS_ATIME_RELATIME) == 0);
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/file");
+    unsigned long modified = _read_long(fd_table[fd].inode, FILE_MODIFIEDTIME_LOC);
+    _write_long(fd_table[fd].inode, modified - 3 * RELATIME_INTERVAL, FILE_MODIFIEDTIME_LOC);
+    _write_long(fd_table[fd].inode, modified - 2 * RELATIME_INTERVAL, FILE_ACCESSTIME_LOC);
+    fd_table[fd].dirty = true;
+    assert(tfs_closeFile(fd) == 0);
+    fd = tfs_openFile("/file");
+    assert(fd_table[fd].dirty && _read_long(fd_table[fd].inode, FILE_ACCESSTIME_LOC) >= modified);
+    assert(tfs_closeFile(fd) == 0);
+    assert(tfs_unmount() == 0);
+
+    // A lazy access time is written along with the next change to the file
+    assert(tfs_setAtimePolicy(TFS_ATIME_LAZY) == 0);
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/file");
+    _write_long(fd_table[fd].inode, 0, FILE_ACCESSTIME_LOC);
+    fd_table[fd].dirty = true;
+    assert(tfs_closeFile(fd) == 0);
+    fd = tfs_openFile("/file");
+    assert(tfs_read(fd, out, 1) == 1);
+    assert(cacheReadBlock(mounted->cache, fd_table[fd].inodeNum, inode) == 0);
+    assert(_read_long(inode, FILE_ACCESSTIME_LOC) == 0);
+    assert(tfs_pwrite(fd, "R", 1, 0) == 1);
+    assert(cacheReadBlock(mounted->cache, fd_table[fd].inodeNum, inode) == 0);
+    assert(_read_long(inode, FILE_ACCESSTIME_LOC) > 0);
+    assert(tfs_unmount() == 0);
+
+    // A write through one descriptor keeps the access time another one stamped
+    assert(tfs_setAtimePolicy(TFS_ATIME_STRICT) == 0);
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/file");
+    fileDescriptor fd2 = tfs_openFile("/file");
+    assert(cacheReadBlock(mounted->cache, fd_table[fd].inodeNum, inode) == 0);
+    _write_long(inode, 0, FILE_ACCESSTIME_LOC);
+    assert(cacheWriteBlock(mounted->cache, fd_table[fd].inodeNum, inode) == 0);
+    memcpy(fd_table[fd].inode, inode, BLOCKSIZE);
+    memcpy(fd_table[fd2].inode, inode, BLOCKSIZE);
+    fd_table[fd].dirty = fd_table[fd2].dirty = false;
+    assert(tfs_read(fd, out, 1) == 1);
+    unsigned long stamped = _read_long(fd_table[fd].inode, FILE_ACCESSTIME_LOC);
+    assert(stamped > 0 && fd_table[fd].dirty);
+    assert(tfs_pwrite(fd2, "W", 1, 1) == 1);
+    assert(cacheReadBlock(mounted->cache, fd_table[fd].inodeNum, inode) == 0);
+    assert(_read_long(inode, FILE_ACCESSTIME_LOC) == stamped);
+    assert(_read_long(fd_table[fd].inode, FILE_ACCESSTIME_LOC) == stamped);
+    assert(tfs_unmount() == 0);
+    assert(tfs_setAtimePolicy(TFS_ATIME_NOATIME) == 0);
+    assert(tfs_mount(diskName) == 0);
+    fd = tfs_openFile("/file");
+    assert(_read_long(fd_table[fd].inode, FILE_ACCESSTIME_LOC) == stamped);
+    assert(tfs_unmount() == 0);
+    assert(tfs_setAtimePolicy(TFS_ATIME_STRICT) == 0);
+    remove(diskName);
+}
+
+void testTfs_dentry()
+{
+    char diskName[25] = "testFiles/dentryTest.dsk";
+    cacheStats stats;
+    remove(diskName);
+    tfs_unmount();
+    assert(tfs_mkfs(diskName, DEFAULT_DISK_SIZE) == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_createDir("/a") == 0);
+    assert(tfs_createDir("/a/b") == 0);
+    for (int i = 0; i < 20; i++) {
+        char name[20];
+        snprintf(name, sizeof(name), "/a/b/f%d", i);
+        fileDescriptor fd = tfs_openFile(name);
+        assert(fd >= 0 && tfs_closeFile(fd) == 0);
+    }
+    assert(tfs_unmount() == 0);
+
+    // Once a path has been resolved, opening it again reads only the file's inode
+    assert(tfs_setAtimePolicy(TFS_ATIME_NOATIME) == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_setAtimePolicy(TFS_ATIME_STRICT) == 0);
+    fileDescriptor fd = tfs_openFile("/a/b/f19");
+    assert(tfs_closeFile(fd) == 0);
+    assert(resetCacheStats(mounted->cache) == 0);
+    unsigned long hits = mounted->dentries->hits;
+    for (int i = 0; i < 10; i++) {
+        fd = tfs_openFile("/a/b/f19");
+        assert(tfs_closeFile(fd) == 0);
+    }
+    assert(tfs_getCacheStats(&stats) == 0);
+    assert(stats.hits + stats.misses == 10);
+    assert(mounted->dentries->hits == hits + 30);
+
+    // Names that do not exist are remembered too
+    assert(tfs_removeDir("/a/none") == ERR_DIR_NOT_FOUND);
+    assert(resetCacheStats(mounted->cache) == 0);
+    assert(tfs_removeDir("/a/none") == ERR_DIR_NOT_FOUND);
+    assert(tfs_openFile("/a/none/f") == ERR_DIR_NOT_FOUND);
+    assert(tfs_getCacheStats(&stats) == 0);
+    assert(stats.hits + stats.misses == 0);
+
+    // ... until the name is created
+    assert(tfs_createDir("/a/none") == 0);
+    fd = tfs_openFile("/a/none/f");
+    assert(fd >= 0 && tfs_closeFile(fd) == 0);
+
+    // Renaming and deleting drop the lookups they make wrong
+    fd = tfs_openFile("/a/b/f0");
+    int inode = fd_table[fd].inodeNum;
+    assert(tfs_removeDir("/a/b/renamed") == ERR_DIR_NOT_FOUND);
+    assert(tfs_rename(fd, "renamed") == 0);
+    assert(tfs_removeDir("/a/b/renamed") == ERR_NOT_A_DIR);
+    fileDescriptor fd2 = tfs_openFile("/a/b/renamed");
+    assert(fd2 >= 0 && fd_table[fd2].inodeNum == inode);
+    assert(tfs_deleteFile(fd) == 0);
+    assert(tfs_removeDir("/a/b/renamed") == ERR_DIR_NOT_FOUND);
+    fd = tfs_openFile("/a/b/f0");
+    assert(fd >= 0 && tfs_closeFile(fd) == 0);
+
+    // So do removing a directory and everything under it
+    assert(tfs_removeAll("/a/none") == 0);
+    assert(tfs_openFile("/a/none/f") == ERR_DIR_NOT_FOUND);
+    assert(tfs_createDir("/a/b/c") == 0);
+    assert(tfs_removeDir("/a/b/c") == 0);
+    assert(tfs_createDir("/a/b/c/d") == ERR_DIR_NOT_FOUND);
+    assert(tfs_removeAll("/a") == 0);
+    assert(tfs_openFile("/a/b/f1") == ERR_DIR_NOT_FOUND);
+    assert(tfs_createDir("/a") == 0);
+    assert(tfs_createDir("/a/b") == 0);
+    fd = tfs_openFile("/a/b/f1");
+    assert(fd >= 0 && tfs_closeFile(fd) == 0);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_unmount() == 0);
+    remove(diskName);
+}
+
+void testTfs_dirents()
+{
+    char diskName[25] = "testFiles/direntTest.dsk";
+    char listName[25] = "testFiles/direntTest.txt";
+    char name[20];
+    char listing[512];
+    cacheStats stats;
+    remove(diskName);
+    tfs_unmount();
+
+    // Entries carry names, so a lookup reads the directories on the path and the file's own inode
+    int formats[] = {TFS_FEAT_BITMAP | TFS_FEAT_ADDR32 | TFS_FEAT_DIRENTS, TFS_FEAT_DIRENTS};
+    for (int f = 0; f < 2; f++) {
+        assert(tfs_mkfsFormat(diskName, DEFAULT_DISK_SIZE, formats[f]) == 0);
+        assert(tfs_mount(diskName) == 0);
+        int slots = MAX_DIR_INODES / DIRENT_SIZE(formats[f]);
+        assert(tfs_createDir("/d") == 0);
+        assert(tfs_createDir("/d/sub") == 0);
+        for (int i = 0; i < slots - 1; i++) {
+            snprintf(name, sizeof(name), "/d/f%d", i);
+            fileDescriptor fd = tfs_openFile(name);
+            assert(fd >= 0 && tfs_closeFile(fd) == 0);
+        }
+        assert(tfs_unmount() == 0);
+
+        assert(tfs_setAtimePolicy(TFS_ATIME_NOATIME) == 0);
+        assert(tfs_mount(diskName) == 0);
+        assert(tfs_setAtimePolicy(TFS_ATIME_STRICT) == 0);
+        assert(resetCacheStats(mounted->cache) == 0);
+        snprintf(name, sizeof(name), "/d/f%d", slots - 2);
+        fileDescriptor fd = tfs_openFile(name);
+        assert(fd >= 0);
+        assert(tfs_getCacheStats(&stats) == 0);
+        assert(stats.hits + stats.misses == 3);
+
+        // A renamed file is found under its new name, also after a remount
+        int inode = fd_table[fd].inodeNum;
+        assert(tfs_rename(fd, "renamed") == 0);
+        assert(tfs_unmount() == 0);
+        assert(tfs_mount(diskName) == 0);
+        fd = tfs_openFile("/d/renamed");
+        assert(fd >= 0 && fd_table[fd].inodeNum == inode);
+
+        // Listing reads the directories only
+        assert(resetCacheStats(mounted->cache) == 0);
+        fflush(stdout);
+        int saved = dup(STDOUT_FILENO);
+        int out = open(listName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        dup2(out, STDOUT_FILENO);
+        assert(tfs_readdir() == 0);
+        fflush(stdout);
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+        close(out);
+        assert(tfs_getCacheStats(&stats) == 0);
+        assert(stats.hits + stats.misses == 3);
+        FILE* list = fopen(listName, "r");
+        int length = fread(listing, 1, sizeof(listing) - 1, list);
+        fclose(list);
+        listing[length] = '\0';
+        assert(strncmp(listing, "d\n     sub\n     f0\n", strlen("d\n     sub\n     f0\n")) == 0);
+        assert(strstr(listing, "     renamed\n") != NULL);
+        remove(listName);
+
+        // Deleting files and directories empties their entries
+        assert(tfs_deleteFile(fd) == 0);
+        assert(tfs_removeAll("/d") == 0);
+        assert(tfs_createDir("/d") == 0);
+        assert(tfs_unmount() == 0);
+        assert(tfs_mount(diskName) == 0);
+        assert(tfs_unmount() == 0);
+        remove(diskName);
+    }
+}
+
+void testTfs_dirIndex()
+{
+    char diskName[25] = "testFiles/dirIdxTest.dsk";
+    char name[20];
+    uint8_t inode[BLOCKSIZE];
+    cacheStats stats;
+    int numFiles = 10000;
+    remove(diskName);
+    tfs_unmount();
+
+    // The index finds entries by the names kept in them
+    assert(tfs_mkfsFormat(diskName, DEFAULT_DISK_SIZE, TFS_FEAT_DIRINDEX) == ERR_INVALID_INPUT);
+
+    // Without an index a full directory refuses another entry, and keeps no block for it
+    assert(tfs_mkfsFormat(diskName, DEFAULT_DISK_SIZE, TFS_FEAT_DIRENTS) == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_createDir("/d") == 0);
+    int slots = MAX_DIR_INODES / DIRENT_SIZE(TFS_FEAT_DIRENTS);
+    for (int i = 0; i < slots; i++) {
+        snprintf(name, sizeof(name), "/d/f%d", i);
+        fileDescriptor fd = tfs_openFile(name);
+        assert(fd >= 0 && tfs_closeFile(fd) == 0);
+    }
+    int freeBlocks = tfs_freeBlocks();
+    assert(tfs_openFile("/d/more") == ERR_DIR_FULL);
+    assert(tfs_createDir("/d/more") == ERR_DIR_FULL);
+    assert(tfs_freeBlocks() == freeBlocks);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_unmount() == 0);
+
+    // With one, a directory outgrowing its inode moves its entries to a leaf
+    int features = TFS_FEAT_BITMAP | TFS_FEAT_ADDR32 | TFS_FEAT_DIRENTS | TFS_FEAT_DIRINDEX;
+    assert(tfs_mkfsFormat(diskName, 16384 * BLOCKSIZE, features) == 0);
+    assert(tfs_mount(diskName) == 0);
+    freeBlocks = tfs_freeBlocks();
+    assert(tfs_createDir("/big") == 0);
+    int dir;
+    assert(_navigate_to_dir("/big", name, &dir, NULL, FILE_TYPE_DIR) == 1);
+    slots = MAX_DIR_INODES / DIRENT_SIZE(features);
+    double start = now();
+    for (int i = 0; i < numFiles; i++) {
+        snprintf(name, sizeof(name), "/big/f%d", i);
+        fileDescriptor fd = tfs_openFile(name);
+        assert(fd >= 0 && tfs_closeFile(fd) == 0);
+        if (i == slots - 1 || i == slots) {
+            assert(cacheReadBlock(mounted->cache, dir, inode) == 0);
+            assert(inode[FILE_MAP_LOC] == (i == slots ? DIR_MAP_INDEX : 0));
+        }
+    }
+    double createTime = now() - start;
+    assert(cacheReadBlock(mounted->cache, dir, inode) == 0);
+    int levels = inode[DIR_INDEX_LEVELS_LOC];
+    assert(levels >= 1 && levels <= DIR_INDEX_MAX_LEVELS);
+    assert(tfs_unmount() == 0);
+
+    // A lookup reads the directory, one index block per level and a leaf, then the file's inode
+    assert(tfs_setAtimePolicy(TFS_ATIME_NOATIME) == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_setAtimePolicy(TFS_ATIME_STRICT) == 0);
+    fileDescriptor fd = tfs_openFile("/big/f0");
+    assert(fd >= 0 && tfs_closeFile(fd) == 0);
+    assert(resetCacheStats(mounted->cache) == 0);
+    int lookups = 1000;
+    start = now();
+    for (int i = 0; i < lookups; i++) {
+        snprintf(name, sizeof(name), "/big/f%d", (i + 1) * 7919 % numFiles);
+        fd = tfs_openFile(name);
+        assert(fd >= 0 && tfs_closeFile(fd) == 0);
+    }
+    double lookupTime = now() - start;
+    assert(tfs_getCacheStats(&stats) == 0);
+    assert(stats.hits + stats.misses == (unsigned long) lookups * (levels + 3));
+    printf("> dirindex %d files: %d index levels, %d block reads and %.1f us per lookup, %.1f us per create\n",
+        numFiles, levels, levels + 3, lookupTime / lookups * 1e6, createTime / numFiles * 1e6);
+
+    // Renaming refiles the entry under the new name's hash, deleting empties it
+    fd = tfs_openFile("/big/f42");
+    int inodeNum = fd_table[fd].inodeNum;
+    assert(tfs_rename(fd, "renamed") == 0);
+    assert(tfs_openFile("/big/f42") >= 0);
+    fileDescriptor fd2 = tfs_openFile("/big/renamed");
+    assert(fd2 >= 0 && fd_table[fd2].inodeNum == inodeNum);
+    assert(tfs_deleteFile(fd2) == 0);
+    assert(tfs_removeDir("/big/renamed") == ERR_DIR_NOT_FOUND);
+    assert(tfs_removeDir("/big") == ERR_DIR_NOT_EMPTY);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+
+    // Removing the directory gives back its index too
+    assert(tfs_removeAll("/big") == 0);
+    assert(tfs_freeBlocks() == freeBlocks);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_unmount() == 0);
+    remove(diskName);
+}
+
+void testTfs_rootDir()
+{
+    char diskName[26] = "testFiles/rootDirTest.dsk";
+    char name[20];
+    uint8_t block[BLOCKSIZE];
+    remove(diskName);
+    tfs_unmount();
+
+    // The superblock only points at the root's inode, the first block past it
+    int features = TFS_FEAT_DIRENTS | TFS_FEAT_ROOTDIR;
+    int numBlocks = DEFAULT_DISK_SIZE / BLOCKSIZE;
+    assert(tfs_mkfsFormat(diskName, DEFAULT_DISK_SIZE, features) == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(mounted->root == 1);
+    assert(tfs_freeBlocks() == numBlocks - 2);
+    assert(cacheReadBlock(mounted->cache, SUPERBLOCK_DISKLOC, block) == 0);
+    assert(block[ROOT_INODE_LOC] == 1 && block[ROOT_INODE_LOC + 1] == 0);
+    assert(cacheReadBlock(mounted->cache, mounted->root, block) == 0);
+    assert(block[BLOCK_TYPE_LOC] == INODE && block[FILE_TYPE_FLAG_LOC] == FILE_TYPE_DIR);
+    assert(strcmp((char*) block + FILE_NAME_LOC, ROOT_DIR_NAME) == 0);
+
+    // Paths start at the root inode, which fills up like any flat directory
+    assert(tfs_createDir("/a") == 0);
+    fileDescriptor fd = tfs_openFile("/a/f");
+    assert(fd >= 0 && tfs_closeFile(fd) == 0);
+    int slots = MAX_DIR_INODES / DIRENT_SIZE(features);
+    for (int i = 1; i < slots; i++) {
+        snprintf(name, sizeof(name), "/f%d", i);
+        fd = tfs_openFile(name);
+        assert(fd >= 0 && tfs_closeFile(fd) == 0);
+    }
+    int freeBlocks = tfs_freeBlocks();
+    assert(tfs_openFile("/more") == ERR_DIR_FULL);
+    assert(tfs_freeBlocks() == freeBlocks);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_removeAll("/") == 0);
+    assert(tfs_freeBlocks() == numBlocks - 2);
+    assert(tfs_unmount() == 0);
+
+    // With a directory index the root holds far more than the superblock could
+    features = TFS_FEAT_BITMAP | TFS_FEAT_ADDR32 | TFS_FEAT_DIRENTS | TFS_FEAT_DIRINDEX | TFS_FEAT_ROOTDIR;
+    assert(tfs_mkfsFormat(diskName, 4096 * BLOCKSIZE, features) == 0);
+    assert(tfs_mount(diskName) == 0);
+    freeBlocks = tfs_freeBlocks();
+    int numFiles = 4 * MAX_SUPBLOCK_INODES;
+    for (int i = 0; i < numFiles; i++) {
+        snprintf(name, sizeof(name), "/f%d", i);
+        fd = tfs_openFile(name);
+        assert(fd >= 0 && tfs_closeFile(fd) == 0);
+    }
+    assert(tfs_createDir("/d") == 0);
+    assert(tfs_createDir("/d/e") == 0);
+    assert(cacheReadBlock(mounted->cache, mounted->root, block) == 0);
+    assert(block[FILE_MAP_LOC] == DIR_MAP_INDEX);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    for (int i = 0; i < numFiles; i += 97) {
+        snprintf(name, sizeof(name), "/f%d", i);
+        fd = tfs_openFile(name);
+        assert(fd >= 0 && tfs_deleteFile(fd) == 0);
+    }
+    assert(tfs_removeDir("/d") == ERR_DIR_NOT_EMPTY);
+    assert(tfs_removeAll("/") == 0);
+    assert(tfs_freeBlocks() == freeBlocks);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_unmount() == 0);
+    remove(diskName);
+}
+
+void testTfs_parent()
+{
+    char diskName[25] = "testFiles/parentTest.dsk";
+    char name[20];
+    uint8_t inode[BLOCKSIZE];
+    cacheStats stats;
+    remove(diskName);
+    tfs_unmount();
+
+    // Every inode points back at the directory holding its entry, the superblock for the root
+    assert(tfs_mkfsFormat(diskName, BLOCKSIZE * MAX_BLOCKS, 0) == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_createDir("/a") == 0);
+    assert(tfs_createDir("/a/b") == 0);
+    int a, b;
+    assert(_navigate_to_dir("/a", name, &a, NULL, FILE_TYPE_DIR) == 1);
+    assert(_navigate_to_dir("/a/b", name, &b, NULL, FILE_TYPE_DIR) == 1);
+    assert(cacheReadBlock(mounted->cache, a, inode) == 0 && inode[INODE_PARENT_LOC] == SUPERBLOCK_DISKLOC);
+    assert(cacheReadBlock(mounted->cache, b, inode) == 0 && inode[INODE_PARENT_LOC] == a);
+    for (int i = 0; i < 100; i++) {
+        snprintf(name, sizeof(name), "/a/b/f%d", i);
+        fileDescriptor fd = tfs_openFile(name);
+        assert(fd >= 0 && tfs_writeFile(fd, "data", 4) == 0 && tfs_closeFile(fd) == 0);
+    }
+    assert(tfs_createDir("/c") == 0);
+    fileDescriptor fd = tfs_openFile("/c/g");
+    assert(fd >= 0 && tfs_closeFile(fd) == 0);
+    fd = tfs_openFile("/a/b/f0");
+    assert(fd_table[fd].inode[INODE_PARENT_LOC] == b);
+    assert(_fetch_parent(fd_table[fd].inodeNum) == b);
+
+    // ... which stays through writes and renames
+    assert(tfs_writeFile(fd, "longer data", 11) == 0);
+    assert(tfs_rename(fd, "renamed") == 0);
+    assert(_fetch_parent(fd_table[fd].inodeNum) == b);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+
+    // Deleting a file reads its inode and its directory, however big the disk is
+    fd = tfs_openFile("/a/b/f1");
+    assert(resetCacheStats(mounted->cache) == 0);
+    assert(tfs_deleteFile(fd) == 0);
+    assert(tfs_getCacheStats(&stats) == 0);
+    unsigned long pointerReads = stats.hits + stats.misses;
+    assert(pointerReads < 10);
+
+    // An inode from before parents were kept is still found, by scanning the disk up to its directory
+    fd = tfs_openFile("/c/g");
+    int inodeNum = fd_table[fd].inodeNum;
+    assert(tfs_closeFile(fd) == 0);
+    assert(cacheReadBlock(mounted->cache, inodeNum, inode) == 0);
+    inode[INODE_PARENT_LOC] = 0;
+    assert(cacheWriteBlock(mounted->cache, inodeNum, inode) == 0);
+    fd = tfs_openFile("/c/g");
+    assert(resetCacheStats(mounted->cache) == 0);
+    assert(tfs_deleteFile(fd) == 0);
+    assert(tfs_getCacheStats(&stats) == 0);
+    unsigned long scanReads = stats.hits + stats.misses;
+    assert(scanReads > (unsigned long) MAX_BLOCKS / 2);
+    printf("> tfs_deleteFile: %lu block accesses with the parent pointer, %lu scanning a %d block disk\n",
+        pointerReads, scanReads, MAX_BLOCKS);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+
+    // The mount check refuses a pointer to the wrong directory
+    fd = tfs_openFile("/a/b/f3");
+    inodeNum = fd_table[fd].inodeNum;
+    assert(tfs_closeFile(fd) == 0);
+    assert(cacheReadBlock(mounted->cache, inodeNum, inode) == 0);
+    inode[INODE_PARENT_LOC] = a;
+    assert(cacheWriteBlock(mounted->cache, inodeNum, inode) == 0);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == ERR_BAD_DISK);
+    remove(diskName);
+}
+
+void testTfs_readdirIter()
+{
+    char diskName[26] = "testFiles/readdirTest.dsk";
+    char name[20];
+    char data[64];
+    cacheStats stats;
+    int numFiles = 300;
+    int batch = 64;
+    dirEntry entries[64];
+    remove(diskName);
+    tfs_unmount();
+    memset(data, 'r', sizeof(data));
+
+    // A directory hands out its entries by name, type, inode and size
+    assert(tfs_opendir("/") == ERR_NO_DISK_MOUNTED);
+    int features = TFS_FEAT_BITMAP | TFS_FEAT_ADDR32 | TFS_FEAT_DIRENTS | TFS_FEAT_DIRINDEX;
+    assert(tfs_mkfsFormat(diskName, 4096 * BLOCKSIZE, features) == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_createDir("/d") == 0);
+    assert(tfs_createDir("/d/sub") == 0);
+    for (int i = 0; i < numFiles; i++) {
+        snprintf(name, sizeof(name), "/d/f%d", i);
+        fileDescriptor fd = tfs_openFile(name);
+        assert(fd >= 0 && tfs_writeFile(fd, data, i % 50 + 1) == 0 && tfs_closeFile(fd) == 0);
+    }
+    int sub;
+    assert(_navigate_to_dir("/d/sub", name, &sub, NULL, FILE_TYPE_DIR) == 1);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+
+    // Opening reads each block of the directory once, batches read only the files' inodes
+    assert(resetCacheStats(mounted->cache) == 0);
+    dirDescriptor dd = tfs_opendir("/d");
+    assert(dd >= 0);
+    assert(tfs_getCacheStats(&stats) == 0);
+    unsigned long openReads = stats.misses;
+    dirEntry* listed;
+    uint32_t* blocks;
+    int numBlocks;
+    int dir;
+    assert(_navigate_to_dir("/d", name, &dir, NULL, FILE_TYPE_DIR) == 1);
+    assert(_dir_list(dir, &listed, &blocks, &numBlocks) == numFiles + 1);
+    free(listed);
+    free(blocks);
+    assert(openReads <= (unsigned long) numBlocks + 2);
+
+    char seen[300] = {0};
+    int total = 0;
+    int calls = 0;
+    int got;
+    assert(resetCacheStats(mounted->cache) == 0);
+    while ((got = tfs_readdirEntries(dd, entries, batch)) > 0) {
+        assert(got <= batch);
+        calls++;
+        for (int i = 0; i < got; i++) {
+            if (entries[i].type == FILE_TYPE_DIR) {
+                assert(strcmp(entries[i].name, "sub") == 0);
+                assert(entries[i].inode == (uint32_t) sub && entries[i].size == 0);
+                continue;
+            }
+            int n = atoi(entries[i].name + 1);
+            assert(entries[i].type == FILE_TYPE_FILE && n >= 0 && n < numFiles && !seen[n]);
+            assert(entries[i].size == n % 50 + 1);
+            seen[n] = 1;
+            total++;
+        }
+    }
+    assert(got == 0 && total == numFiles && calls == (numFiles + 1 + batch - 1) / batch);
+    assert(tfs_getCacheStats(&stats) == 0);
+    assert(stats.hits + stats.misses == (unsigned long) numFiles);
+    assert(tfs_readdirEntry(dd, entries) == 0);
+    printf("> readdir %d entries: %lu block reads to open, %d batch calls, 1 inode read per file\n",
+        numFiles + 1, openReads, calls);
+
+    // One at a time gives the same entries, in the same order
+    dirDescriptor dd2 = tfs_opendir("/d");
+    assert(dd2 >= 0 && dd2 != dd);
+    assert(tfs_closedir(dd) == 0);
+    dd = tfs_opendir("/d");
+    assert(tfs_readdirEntries(dd, entries, batch) == batch);
+    for (int i = 0; i < batch; i++) {
+        dirEntry entry;
+        assert(tfs_readdirEntry(dd2, &entry) == 1);
+        assert(entry.inode == entries[i].inode && entry.type == entries[i].type);
+        assert(strcmp(entry.name, entries[i].name) == 0 && entry.size == entries[i].size);
+    }
+    assert(tfs_closedir(dd) == 0 && tfs_closedir(dd2) == 0);
+    assert(tfs_closedir(dd) == ERR_INVALID_DD);
+    assert(tfs_readdirEntries(dd, entries, batch) == ERR_INVALID_DD);
+    assert(tfs_readdirEntry(DIR_TABLESIZE, entries) == ERR_INVALID_DD);
+
+    // The root, an empty directory and the errors
+    dd = tfs_opendir("/");
+    assert(tfs_readdirEntry(dd, entries) == 1 && strcmp(entries[0].name, "d") == 0);
+    assert(entries[0].type == FILE_TYPE_DIR && entries[0].inode == (uint32_t) dir);
+    assert(tfs_readdirEntry(dd, entries) == 0);
+    assert(tfs_readdirEntries(dd, NULL, batch) == ERR_INVALID_INPUT);
+    assert(tfs_closedir(dd) == 0);
+    dd = tfs_opendir("/d/sub");
+    assert(tfs_readdirEntries(dd, entries, batch) == 0 && tfs_closedir(dd) == 0);
+    assert(tfs_opendir("/d/none") == ERR_DIR_NOT_FOUND);
+    assert(tfs_opendir("/d/f1") == ERR_NOT_A_DIR);
+    assert(tfs_opendir(NULL) == ERR_INVALID_INPUT);
+
+    // Directory descriptors run out, and unmounting closes them all
+    for (int i = 0; i < DIR_TABLESIZE; i++) {
+        assert(tfs_opendir("/d") == i);
+    }
+    assert(tfs_opendir("/d") == ERR_OUT_OF_DDS);
+    assert(tfs_unmount() == 0);
+    assert(tfs_mount(diskName) == 0);
+    assert(tfs_readdirEntry(0, entries) == ERR_INVALID_DD);
+    assert(tfs_opendir("/d") == 0 && tfs_closedir(0) == 0);
+    assert(tfs_unmount() == 0);
+    remove(diskName);
+}
+
 void* verify_contents(char *filePath, int location, size_t dataSize)
 {
     FILE *readFile = fopen(filePath, "r");
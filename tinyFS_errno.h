@@ -13,10 +13,12 @@
 #define SYS_ERR_SEEK				-6		// system error for seek
 #define SYS_ERR_READ				-7		// system error for read
 #define SYS_ERR_FSTAT				-8		// system error for fstat
+#define SYS_ERR_SYNC				-9		// system error for msync/fsync
 
 // LIBDISK ERR MACROS
 #define ERR_DISK_FILE_NOT_FOUND		-10		// the given disk file does not exist and cannot be created
 #define ERR_INVALID_DISK_FD			-11		// calling libdisk function for an invalid disk fd
+#define ERR_TOO_MANY_DISKS			-12		// every slot in the libdisk disk table is in use
 
 // DISK ERR MACROS
 #define ERR_BAD_DISK				-20		// can't mount a improperly set up disk
@@ -27,12 +29,17 @@
 #define ERR_INVALID_FD				-30		// calling tfs function for an invalid fd
 #define ERR_OUT_OF_FDS				-31		// out of file descriptors
 #define ERR_FILE_PNTR_OUT_OF_BOUNDS	-32		// trying to read beyond the bounds of the file
+#define ERR_NO_STREAM				-33		// no write stream is open on the fd
+#define ERR_STREAM_OPEN				-34		// a write stream is already open on the fd
 
 // DIR ERR MACROS
 #define ERR_DIR_NOT_FOUND			-40		// directory does not exist
 #define ERR_NOT_A_DIR				-41		// is a file, not a directory
 #define ERR_DIR_ALREADY_EXISTS		-42		// trying to create a directory that already exists
 #define ERR_DIR_NOT_EMPTY			-43		// trying to remove a directory that isn't empty
+#define ERR_DIR_FULL				-44		// no room for another entry in the directory
+#define ERR_INVALID_DD				-45		// calling tfs function for an invalid directory descriptor
+#define ERR_OUT_OF_DDS				-46		// out of directory descriptors
 
 extern int dont_ingore_me;
 